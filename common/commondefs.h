@@ -75,8 +75,25 @@ struct tdrive_stats {
 	uint64_t bytes_written_to_tape;
 	uint64_t compressed_bytes_read;
 	uint64_t compressed_bytes_written; 
+	uint64_t compression_bypassed_bytes;
+	uint64_t locate_count;
+	uint64_t locate_entries_visited;
+	uint32_t cmd_queue_depth;
+	uint32_t cmd_batch_max;
+	uint64_t cmd_batches;
+	uint64_t cmd_batch_cmds;
 };
 
+/* Drive compression algorithms, level zero selects the algorithm default */
+enum {
+	DRIVE_COMP_ALG_DEFAULT,
+	DRIVE_COMP_ALG_LZ4,
+	DRIVE_COMP_ALG_LZ4_HC,
+	DRIVE_COMP_ALG_LZF,
+};
+
+#define DRIVE_COMP_ALG_MAX	DRIVE_COMP_ALG_LZF
+
 struct vdeviceinfo {
 	int tl_id;
 	int iscsi_tid;
@@ -92,6 +109,10 @@ struct vdeviceinfo {
 	uint8_t free_alloc;
 	uint8_t enable_compression;
 	uint8_t mod_type; /* modification type */
+	uint8_t comp_alg;
+	uint8_t comp_level;
+	uint16_t write_cache_size; /* MB, zero for the default */
+	uint8_t data_csum; /* CRC32C for every data block written */
 	uint8_t tape_label[40];
 	uint32_t tape_id;
 	uint32_t target_id;
@@ -497,6 +518,7 @@ struct raw_partition {
 #define MAX_TAPE_PARTITIONS	4
 
 #define TAPE_FLAGS_V2		0x1
+#define TAPE_FLAGS_USAGE	0x4 /* partition_used is in sync with the tmaps */
 
 struct raw_tape {
 	uint16_t csum;
@@ -513,6 +535,7 @@ struct raw_tape {
 	struct vtl_info vtl_info;
 	uint64_t pad1[4];
 	struct raw_partition raw_partitions[MAX_TAPE_PARTITIONS];
+	uint64_t partition_used[MAX_TAPE_PARTITIONS];
 } __attribute__ ((__packed__));
 
 #define MAX_VTAPES		60000
@@ -37,5 +37,6 @@
 #define TLTARGIOCRELOADEXPORT		_IOWR(TL_MAGIC, 53, struct vcartridge)
 #define TLTARGIOCRESETSTATS		_IOWR(TL_MAGIC, 54, struct vdeviceinfo)
 #define TLTARGIOCQLOADDONE		_IO(TL_MAGIC, 55) 
+#define TLTARGIOCLOADVCARTRIDGESTATUS	_IOWR(TL_MAGIC, 56, struct vcartridge)
 
 #endif
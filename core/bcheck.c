@@ -329,6 +329,12 @@ bint_index_check(struct bdevint *bint, int index_id)
 		return -1;
 	}
 
+	if (bint->index_free) {
+		bint_lock(bint);
+		bint->index_free[index_id] = bint_index_free_blocks(bint, index);
+		bint_unlock(bint);
+	}
+
 	reclaimed += freed_blocks;
 	bint_incr_free(bint, (freed_blocks << BINT_UNIT_SHIFT));
 	restored += alloced_blocks;
@@ -151,6 +151,31 @@ bint_index_io(struct bdevint *bint, struct bintindex *index, int rw)
 	return retval;
 }
 
+/* Writes out index bitmaps with releases not yet on disk, bint lock held */
+static int
+bint_index_flush(struct bdevint *bint)
+{
+	struct bintindex *index;
+	int retval, error = 0;
+
+	STAILQ_FOREACH(index, &bint->index_list, i_list) {
+		if (!atomic_test_bit(META_IO_PENDING, &index->flags))
+			continue;
+
+		retval = bint_index_io(bint, index, QS_IO_SYNC);
+		if (unlikely(retval != 0)) {
+			debug_warn("index sync failed for index_id %d bid %u\n", index->index_id, bint->bid);
+			error = -1;
+			continue;
+		}
+		atomic_clear_bit(META_IO_PENDING, &index->flags);
+	}
+
+	if (!error)
+		atomic_clear_bit(BINT_INDEX_DIRTY, &bint->flags);
+	return error;
+}
+
 void
 bint_index_free(struct bintindex *index)
 {
@@ -244,6 +269,13 @@ bint_index_insert(struct bdevint *bint, struct bintindex *index)
 	chan_lock_intr(tmp->index_wait, &flags);
 	unmap_done = TAILQ_EMPTY(&tmp->unmap_list);
 	chan_unlock_intr(tmp->index_wait, &flags);
+	if (unmap_done && atomic_test_bit(META_IO_PENDING, &tmp->flags)) {
+		if (bint_index_io(bint, tmp, QS_IO_SYNC) == 0)
+			atomic_clear_bit(META_IO_PENDING, &tmp->flags);
+		else
+			unmap_done = 0;
+	}
+
 	if (unmap_done) {
 		STAILQ_REMOVE_HEAD(&bint->index_list, i_list);
 		bint_index_free(tmp);
@@ -256,6 +288,7 @@ bint_index_free_all(struct bdevint *bint)
 {
 	struct bintindex *index;
 
+	bint_index_flush(bint);
 	while ((index = STAILQ_FIRST(&bint->index_list)) != NULL) {
 		STAILQ_REMOVE_HEAD(&bint->index_list, i_list);
 		bint_index_free(index);
@@ -322,6 +355,8 @@ skip:
 		bint_dev_close(bint);
 
 	bint_index_free_all(bint);
+	if (bint->index_free)
+		free(bint->index_free, M_BINT);
 	sx_free(bint->bint_lock);
 	free(bint, M_BINT);
 	return 0;
@@ -345,7 +380,7 @@ bint_get_index(struct bdevint *bint, int index_id)
 	return index;
 }
 
-static uint64_t
+uint64_t
 bint_index_free_blocks(struct bdevint *bint, struct bintindex *index)
 {
 	int i, j, bmap_entries, nindexes;
@@ -400,14 +435,20 @@ again:
 	return 1;
 }
 
+/*
+ * Allocates the first free unit at or after the allocation cursor, wrapping
+ * around to the start of the index. Consecutive allocations thus return
+ * contiguous segments while the disk has free space after the cursor
+ */
 static uint64_t
 bint_get_block(struct bdevint *bint, struct bintindex *index, uint64_t *b_end)
 {
-	int i, j;
+	int i, j, n, jend;
+	int start_i = 0, start_j = 0;
 	uint64_t block;
 	uint64_t end;
 	int index_id;
-	uint8_t *bmap;
+	uint8_t *bmap, val;
 	int retval, bmap_entries;
 	int wait = 0;
 	int retry;
@@ -417,25 +458,41 @@ bint_get_block(struct bdevint *bint, struct bintindex *index, uint64_t *b_end)
 	bmap = (uint8_t *)(vm_pg_address(index->metadata));
 
 	bmap_entries = calc_bmap_entries(bint, index_id);
+	if (bint->alloc_index == index_id && bint->alloc_unit < (bmap_entries << 3)) {
+		start_i = bint->alloc_unit >> 3;
+		start_j = bint->alloc_unit & 0x7;
+	}
 again:
 	retry = 0;
-	for (i = 0; i < bmap_entries; i++) {
-		uint8_t val = bmap[i];
+	for (n = 0; n <= bmap_entries; n++) {
+		i = start_i + n;
+		if (i >= bmap_entries)
+			i -= bmap_entries;
 
+		val = bmap[i];
 		if (val == 0xFF)
 			continue;
 
 		j = get_iter_start(index_id, i);
-		for (; j < 8; j++) {
-			if (!(val & (1 << j))) {
-				retval = bint_index_unmap_done(index, i, j, wait);
-				if (retval) {
-					bmap[i] |= (1 << j);
-					goto found;
-				}
-				debug_check(wait);
-				retry = 1;
+		if (!n)
+			j = max_t(int, j, start_j);
+		jend = (n == bmap_entries) ? start_j : 8;
+		for (; j < jend; j++) {
+			if (val & (1 << j))
+				continue;
+
+			block = calc_alloc_block(bint, index_id, i, j);
+			end = block + (BINT_UNIT_SIZE >> bint->sector_shift);
+			if (end > bint->b_end)
+				continue;
+
+			retval = bint_index_unmap_done(index, i, j, wait);
+			if (retval) {
+				bmap[i] |= (1 << j);
+				goto found;
 			}
+			debug_check(wait);
+			retry = 1;
 		}
 	}
 
@@ -446,13 +503,6 @@ again:
 
 	return 0;
 found:
-	block = calc_alloc_block(bint, index_id, i, j);
-	end = block + (BINT_UNIT_SIZE >> bint->sector_shift);
-	if (end > bint->b_end) {
-		bmap[i] &= ~(1 << j);
-		return 0ULL;
-	}
-
 	retval = bint_index_io(bint, index, QS_IO_SYNC);
 	if (unlikely(retval != 0)) {
 		bmap[i] &= ~(1 << j);
@@ -460,6 +510,12 @@ found:
 		return 0ULL;
 	}
 
+	atomic_clear_bit(META_IO_PENDING, &index->flags);
+	bint->alloc_index = index_id;
+	bint->alloc_unit = (i << 3) + j + 1;
+	if (bint->index_free && bint->index_free[index_id])
+		bint->index_free[index_id]--;
+
 	*b_end = end;
 	debug_check(bint->free < BINT_UNIT_SIZE);
 	bint_decr_free(bint, BINT_UNIT_SIZE);
@@ -471,30 +527,34 @@ __bint_get_block(struct bdevint *bint, uint64_t *b_end)
 {
 	struct bintindex *index;
 	uint64_t block;
-	int index_id = 0, nindexes;
+	int index_id, nindexes, count;
 
 	nindexes = bint_nindexes(bint->usize);
 	bint_lock(bint);
-again:
-	if (index_id == nindexes) {
-		bint_unlock(bint);
-		return 0;
-	}
+	index_id = bint->alloc_index;
+	if (index_id >= nindexes)
+		index_id = 0;
 
-	index = bint_get_index(bint, index_id);
-	if (unlikely(!index)) {
-		bint_unlock(bint);
-		return 0;
-	}
+	for (count = 0; count < nindexes; count++) {
+		if (bint->index_free && !bint->index_free[index_id])
+			goto next;
 
-	block = bint_get_block(bint, index, b_end);
-	if (unlikely(!block)) {
-		index_id++;
-		goto again;
+		index = bint_get_index(bint, index_id);
+		if (unlikely(!index))
+			break;
+
+		block = bint_get_block(bint, index, b_end);
+		if (block) {
+			bint_unlock(bint);
+			return block;
+		}
+next:
+		if (++index_id == nindexes)
+			index_id = 0;
 	}
 
 	bint_unlock(bint);
-	return block;
+	return 0;
 }
 
 #ifdef FREEBSD 
@@ -520,8 +580,13 @@ static void bio_unmap_end_bio(bio_t *bio, int err)
 	free(unmap, M_UNMAP);
 }
 
+/*
+ * With sync unset the bitmap update is left in memory until the next
+ * bint_index_flush. A crash before then only leaks the block, since the
+ * caller has already dropped its own reference to it on disk
+ */
 static int
-__bint_release_block(struct bdevint *bint, uint64_t block)
+__bint_release_block(struct bdevint *bint, uint64_t block, int sync)
 {
 	struct bintindex *index;
 	struct bintunmap *unmap;
@@ -547,11 +612,23 @@ __bint_release_block(struct bdevint *bint, uint64_t block)
 
 	bmap[entry] &= ~(1 << pos);
 
-	retval = bint_index_io(bint, index, QS_IO_SYNC);
+	if (!sync) {
+		atomic_set_bit(META_IO_PENDING, &index->flags);
+		atomic_set_bit(BINT_INDEX_DIRTY, &bint->flags);
+		retval = 0;
+	}
+	else {
+		retval = bint_index_io(bint, index, QS_IO_SYNC);
+		if (retval == 0)
+			atomic_clear_bit(META_IO_PENDING, &index->flags);
+	}
+
 	if (unlikely(retval != 0)) {
 		debug_warn("index write failed\n");
 		bmap[entry] |= (1 << pos);
 	}
+	else if (bint->index_free)
+		bint->index_free[index_id]++;
 	bint_incr_free(bint, BINT_UNIT_SIZE);
 	if (bint_unmap_supported(bint)) {
 		unmap = zalloc(sizeof(*unmap), M_UNMAP, Q_WAITOK);
@@ -744,6 +821,9 @@ bint_zero_indexes(struct bdevint *bint, int start_idx)
 	int error = 0;
 
 	nindexes = bint_nindexes(bint->usize);
+	if (!bint->index_free)
+		bint->index_free = zalloc(nindexes * sizeof(uint32_t), M_BINT, Q_WAITOK);
+
 	for (i = start_idx; i < nindexes; i++)
 	{
 		index = bint_index_new(bint, i);
@@ -751,6 +831,7 @@ bint_zero_indexes(struct bdevint *bint, int start_idx)
 			error = -1;
 			break;
 		}
+		bint->index_free[i] = bint_index_free_blocks(bint, index);
 		bint_index_insert(bint, index);
 	}
 
@@ -829,6 +910,7 @@ bint_load(struct bdevint *bint)
 	bint->group_flags = raw_bint->group_flags;
 	memcpy(bint->mrid, raw_bint->mrid, TL_RID_MAX);
 	nindexes = bint_nindexes(raw_bint->usize);
+	bint->index_free = zalloc(nindexes * sizeof(uint32_t), M_BINT, Q_WAITOK);
 
 	for (i = 0; i < nindexes; i++) {
 		index = bint_index_load(bint, i);
@@ -837,7 +919,8 @@ bint_load(struct bdevint *bint)
 			goto err;
 		}
 
-		free += bint_index_free_blocks(bint, index);
+		bint->index_free[i] = bint_index_free_blocks(bint, index);
+		free += bint->index_free[i];
 		bint_index_insert(bint, index);
 	}
 
@@ -1166,8 +1249,45 @@ bdev_release_block(struct bdevint *bint, uint64_t block)
 {
 	debug_check(!block);
 	bint_lock(bint);
-	__bint_release_block(bint, block);
+	__bint_release_block(bint, block, 1);
 	bint_unlock(bint);
 	bdev_alloc_list_insert(bint);
 	return 0;
 }
+
+/*
+ * Releases a block without writing out the index bitmap. The caller
+ * follows a series of these with bdev_release_flush
+ */
+int
+bdev_release_block_batch(struct bdevint *bint, uint64_t block)
+{
+	debug_check(!block);
+	bint_lock(bint);
+	__bint_release_block(bint, block, 0);
+	bint_unlock(bint);
+	bdev_alloc_list_insert(bint);
+	return 0;
+}
+
+int
+bdev_release_flush(void)
+{
+	struct bdevint *bint;
+	int i, retval, error = 0;
+
+	sx_xlock(gchain_lock);
+	for (i = 0; i < TL_MAX_DISKS; i++) {
+		bint = bint_list[i];
+		if (!bint || !atomic_test_bit(BINT_INDEX_DIRTY, &bint->flags))
+			continue;
+
+		bint_lock(bint);
+		retval = bint_index_flush(bint);
+		bint_unlock(bint);
+		if (unlikely(retval != 0))
+			error = -1;
+	}
+	sx_xunlock(gchain_lock);
+	return error;
+}
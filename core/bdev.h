@@ -42,6 +42,7 @@ struct bintindex {
 	wait_chan_t *index_wait;
 	atomic_t refs;
 	int index_id;
+	int flags;
 };
 
 static inline void
@@ -83,6 +84,11 @@ struct bdevint {
 	STAILQ_HEAD(, bintindex) check_list;
 	int index_count;
 	sx_t *bint_lock;
+
+	/* Free units in each index and where the next allocation starts */
+	uint32_t *index_free;
+	int alloc_index;
+	int alloc_unit;
 };
 
 static inline uint32_t
@@ -200,12 +206,15 @@ int bdev_remove(struct bdev_info *binfo);
 int bdev_get_info(struct bdev_info *binfo);
 int bdev_unmap_config(struct bdev_info *binfo);
 int bdev_release_block(struct bdevint *bint, uint64_t block);
+int bdev_release_block_batch(struct bdevint *bint, uint64_t block);
+int bdev_release_flush(void);
 uint64_t bdev_get_block(struct bdevint *bint, struct bdevint **ret, uint64_t *b_end);
 void bdev_finalize(void);
 void bint_decr_free(struct bdevint *bint, uint64_t used);
 void bint_incr_free(struct bdevint *bint, uint64_t freed);
 struct bintindex * bint_get_index(struct bdevint *bint, int index_id);
 int bint_index_io(struct bdevint *bint, struct bintindex *index, int rw);
+uint64_t bint_index_free_blocks(struct bdevint *bint, struct bintindex *index);
 
 uint64_t bint_index_bstart(struct bdevint *bint, int index);
 int bint_toggle_index_full(struct bdevint *bint, int index, int full, int async);
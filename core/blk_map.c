@@ -21,6 +21,7 @@
 #include "mchanger.h"
 #include "qs_lib.h"
 #include "gdevq.h"
+#include "crc32c.h"
 
 extern uma_t *bentry_cache;
 extern uma_t *bmap_cache;
@@ -62,11 +63,25 @@ cache_data_decr(struct blk_map *map, uint32_t size)
 	debug_check(map->partition->cached_blocks < 0);
 }
 
+static void
+blk_entry_uncomp_wait(struct blk_entry *entry)
+{
+	if (!entry->completion)
+		return;
+
+	wait_for_done(entry->completion);
+	wait_completion_free(entry->completion);
+	entry->completion = NULL;
+	atomic_clear_bit(BLK_ENTRY_UNCOMP, &entry->flags);
+}
+
 static void
 blk_entry_free_data(struct blk_entry *entry)
 {
 	uint32_t size = 0;
 
+	blk_entry_uncomp_wait(entry);
+
 	if (entry->cpglist) {
 		pglist_free(entry->cpglist, entry->cpglist_cnt);
 		entry->cpglist = NULL;
@@ -103,9 +118,84 @@ blk_entry_free_all(struct blkentry_list *entry_list)
 	}
 }
 
+static void
+blk_map_index_free(struct blk_map *map)
+{
+	if (map->entry_index) {
+		free(map->entry_index, M_BLKENTRY);
+		map->entry_index = NULL;
+	}
+	map->index_entries = 0;
+}
+
+/*
+ * Builds an array of the map's entries along with the number of filemarks
+ * and setmarks before each entry, so that a locate within the map does not
+ * need to walk the entry list
+ */
+static int
+blk_map_index_build(struct blk_map *map)
+{
+	struct blk_entry *entry;
+	uint16_t f_ids = 0, s_ids = 0;
+	int count = 0, i = 0, size;
+
+	if (map->entry_index)
+		return 0;
+
+	TAILQ_FOREACH(entry, &map->entry_list, e_list)
+		count++;
+
+	if (!count)
+		return -1;
+
+	/* Sized for a full map so that new entries can be appended */
+	size = max_t(int, count, blk_map_max_entries(map));
+	map->entry_index = malloc((size * sizeof(entry)) + ((size + 1) * 2 * sizeof(uint16_t)), M_BLKENTRY, Q_NOWAIT);
+	if (unlikely(!map->entry_index))
+		return -1;
+
+	map->f_ids_prefix = (uint16_t *)(map->entry_index + size);
+	map->s_ids_prefix = map->f_ids_prefix + (size + 1);
+	map->f_ids_prefix[0] = map->s_ids_prefix[0] = 0;
+	map->index_size = size;
+
+	TAILQ_FOREACH(entry, &map->entry_list, e_list) {
+		if (entry_is_filemark(entry))
+			f_ids++;
+		else if (entry_is_setmark(entry))
+			s_ids++;
+		map->entry_index[i++] = entry;
+		map->f_ids_prefix[i] = f_ids;
+		map->s_ids_prefix[i] = s_ids;
+	}
+	map->index_entries = count;
+	return 0;
+}
+
+static void
+blk_map_index_append(struct blk_map *map, struct blk_entry *entry)
+{
+	int i = map->index_entries;
+
+	if (!map->entry_index)
+		return;
+
+	if (i == map->index_size || entry->entry_id != i) {
+		blk_map_index_free(map);
+		return;
+	}
+
+	map->entry_index[i] = entry;
+	map->f_ids_prefix[i + 1] = map->f_ids_prefix[i] + (entry_is_filemark(entry) ? 1 : 0);
+	map->s_ids_prefix[i + 1] = map->s_ids_prefix[i] + (entry_is_setmark(entry) ? 1 : 0);
+	map->index_entries++;
+}
+
 static void
 blk_map_free(struct blk_map *map)
 {
+	blk_map_index_free(map);
 	blk_entry_free_all(&map->entry_list);
 	tcache_list_wait(&map->tcache_list);
 	map_lookup_put(map->mlookup);
@@ -155,6 +245,7 @@ blk_map_entry_free_from_entry(struct blk_map *map, struct blk_entry *entry)
 {
 	struct blk_entry *next;
 
+	blk_map_index_free(map);
 	while (entry) {
 		next = TAILQ_NEXT(entry, e_list);
 		TAILQ_REMOVE(&map->entry_list, entry, e_list);
@@ -181,6 +272,8 @@ blk_map_new(struct tape_partition *partition, struct map_lookup *mlookup, uint64
 	map->bint = bint;
 	map->l_ids_start = l_ids_start;
 	map->segment_id = segment_id;
+	if (partition->tape->data_csum)
+		map->version = BLK_MAP_VERSION_CSUM;
 	atomic_set_bit(META_DATA_NEW, &map->flags);
 	atomic_set_bit(META_DATA_LOADED, &map->flags);
 	return map;
@@ -250,8 +343,12 @@ blk_map_meta_valid(struct blk_map *map)
 		debug_warn("Mismatch in csum got %x stored %x\n", csum, raw_map->csum);
 		return -1;
 	}
-	else
-		return 0;
+
+	if (raw_map->version > BLK_MAP_VERSION_CSUM) {
+		debug_warn("Unknown map version %d\n", raw_map->version);
+		return -1;
+	}
+	return 0;
 }
 
 static void 
@@ -263,6 +360,7 @@ blk_map_read_header(struct blk_map *map)
 	raw_map = (struct raw_blk_map *)(vm_pg_address(map->metadata) + (LBA_SIZE - sizeof(*raw_map)));
 	map->segment_id = raw_map->segment_id;
 	map->nr_entries = raw_map->nr_entries;
+	map->version = raw_map->version;
 
 	map->f_ids = MENTRY_FILEMARKS(mlookup_entry);
 	map->s_ids = MENTRY_SETMARKS(mlookup_entry);
@@ -274,9 +372,12 @@ blk_map_load_entries(struct blk_map *map)
 	struct raw_blk_entry *raw_entry;
 	struct blk_entry *prev = NULL, *entry; 
 	uint64_t lid_start = map->l_ids_start;
+	uint32_t *csums = NULL;
 	int i;
 
 	raw_entry = (struct raw_blk_entry *)(vm_pg_address(map->metadata));
+	if (map->version == BLK_MAP_VERSION_CSUM)
+		csums = blk_map_csum_array(map);
 	for (i = 0; i < map->nr_entries; i++, lid_start++, raw_entry++) {
 		entry = blk_entry_new();
 		if (unlikely(!entry)) {
@@ -302,9 +403,14 @@ blk_map_load_entries(struct blk_map *map)
 		entry->block_size = entry_block_size(entry);
 		entry->comp_size = entry_comp_size(entry);
 		entry->lid_start = lid_start;
+		if (csums && entry_is_data_block(entry)) {
+			entry->csum = le32toh(csums[i]);
+			atomic_set_bit(BLK_ENTRY_CSUM, &entry->flags);
+		}
 		prev = entry;
 	}
 
+	blk_map_index_build(map);
 	return 0;
 err:
 	blk_entry_free_all(&map->entry_list);
@@ -459,12 +565,13 @@ blk_map_write_header(struct blk_map *map)
 	struct raw_blk_map *raw_map;
 	uint16_t csum;
 
-	debug_check(map->nr_entries > BLK_MAX_ENTRIES);
+	debug_check(map->nr_entries > blk_map_max_entries(map));
 	raw_map = (struct raw_blk_map *)(vm_pg_address(map->metadata) + (LBA_SIZE - sizeof(*raw_map)));
 	csum = net_calc_csum16(vm_pg_address(map->metadata), LBA_SIZE - sizeof(*raw_map));
 	raw_map->csum = csum;
 	raw_map->segment_id = map->segment_id;
 	raw_map->nr_entries = map->nr_entries;
+	raw_map->version = map->version;
 }
 
 static int
@@ -599,6 +706,30 @@ blk_map_set_prev(struct blk_map *map)
 	return tmap;
 }
 
+/*
+ * The filemark being located is the entry at which the filemark count
+ * before it reaches block_address - f_ids_start + 1
+ */
+static struct blk_entry *
+blk_map_index_locate_file(struct blk_map *map, uint64_t f_ids)
+{
+	struct tape_partition *partition = map->partition;
+	int lo = 1, hi = map->index_entries, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) >> 1;
+		partition->locate_visited++;
+		if (map->f_ids_prefix[mid] > f_ids)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	if (map->f_ids_prefix[lo] != (f_ids + 1) || map->f_ids_prefix[lo - 1] != f_ids)
+		return NULL;
+	return map->entry_index[lo - 1];
+}
+
 int
 blk_map_locate_file(struct blk_map *map, uint64_t block_address)
 {
@@ -608,7 +739,14 @@ blk_map_locate_file(struct blk_map *map, uint64_t block_address)
 	map_lookup_get_ids_start(map->mlookup, map->mlookup_entry_id, &f_ids_start, &s_ids_start);
 
 	debug_check(TAILQ_EMPTY(&map->entry_list));
+	if (block_address >= f_ids_start && blk_map_index_build(map) == 0) {
+		entry = blk_map_index_locate_file(map, block_address - f_ids_start);
+		map->c_entry = entry;
+		return entry ? 0 : EOD_REACHED;
+	}
+
 	TAILQ_FOREACH(entry, &map->entry_list, e_list) {
+		map->partition->locate_visited++;
 		if (!entry_is_filemark(entry))
 			continue;
 		if (f_ids_start == block_address) {
@@ -625,15 +763,30 @@ int
 blk_map_locate(struct blk_map *map, uint64_t block_address)
 {
 	struct blk_entry *entry;
+	uint64_t idx;
 
 	debug_check(TAILQ_EMPTY(&map->entry_list));
+	if (block_address >= map->l_ids_start && blk_map_index_build(map) == 0) {
+		idx = block_address - map->l_ids_start;
+		map->partition->locate_visited++;
+		if (idx < map->index_entries && map->entry_index[idx]->lid_start == block_address) {
+			map->c_entry = map->entry_index[idx];
+			return 0;
+		}
+		/* Entry ids are contiguous, block_address is not within the map */
+		if (idx >= map->index_entries && map->entry_index[map->index_entries - 1]->lid_start == (map->l_ids_start + map->index_entries - 1))
+			goto check_end;
+	}
+
 	TAILQ_FOREACH(entry, &map->entry_list, e_list) {
+		map->partition->locate_visited++;
 		if (entry->lid_start == block_address) {
 			map->c_entry = entry;
 			return 0;
 		}
 	}
 
+check_end:
 	map->c_entry = NULL;
 	entry = blk_map_last_entry(map);
 	if (entry && (block_address == (entry->lid_start + 1)))
@@ -671,6 +824,20 @@ blk_map_read_position(struct tape_partition *partition, struct tape_position_inf
 
 	map_lookup_get_ids_start(map->mlookup, map->mlookup_entry_id, &f_id_count, &s_id_count);
 
+	if (blk_map_index_build(map) == 0) {
+		entry = map->c_entry;
+		if (!entry) {
+			f_id_count += map->f_ids_prefix[map->index_entries];
+			s_id_count += map->s_ids_prefix[map->index_entries];
+			goto skip;
+		}
+		if (entry->entry_id < map->index_entries && map->entry_index[entry->entry_id] == entry) {
+			f_id_count += map->f_ids_prefix[entry->entry_id + 1];
+			s_id_count += map->s_ids_prefix[entry->entry_id + 1];
+			goto skip;
+		}
+	}
+
 	TAILQ_FOREACH(entry, &map->entry_list, e_list) {
 		if (entry_is_filemark(entry))
 			f_id_count++;
@@ -994,16 +1161,31 @@ entry_pglist_map(struct pgdata **entry_pglist, int *entry_idx, int entry_pglist_
 	*src_idx = j;
 }
 
+static void
+blk_entry_uncompress_warn(struct blk_entry *entry)
+{
+	struct blk_entry *prev, *next;
+
+	debug_warn("Uncompress failed for entry id %d lid_start %llu b_start %llu bid %u comp size %u block size %u\n", entry->entry_id, (unsigned long long)entry->lid_start, (unsigned long long)entry->b_start, entry->bint->bid, entry->comp_size, entry->block_size); 
+	prev = blk_entry_get_prev(entry);
+	if (prev) 
+		debug_warn("Uncompress failed for prev id %d lid_start %llu b_start %llu bid %u comp size %u block size %u\n", prev->entry_id, (unsigned long long)prev->lid_start, (unsigned long long)prev->b_start, prev->bint->bid, prev->comp_size, prev->block_size); 
+	next = blk_entry_get_next(entry);
+	if (next)  {
+		debug_warn("Uncompress failed for next id %d lid_start %llu b_start %llu bid %u comp size %u block size %u data block %d\n", next->entry_id, (unsigned long long)next->lid_start, (unsigned long long)next->b_start, next->bint->bid, next->comp_size, next->block_size, entry_is_data_block(next)); 
+		next = blk_entry_get_next(next);
+		if (next)
+			debug_warn("Uncompress failed for next id %d lid_start %llu b_start %llu bid %u comp size %u block size %u data block %d\n", next->entry_id, (unsigned long long)next->lid_start, (unsigned long long)next->b_start, next->bint->bid, next->comp_size, next->block_size, entry_is_data_block(next)); 
+	}
+}
+
 static int
-blk_entry_uncompress(struct blk_entry *entry)
+blk_entry_uncompress_map(struct blk_entry *entry)
 {
 	pagestruct_t **cpages, **upages;
 	uint8_t *uaddr = NULL, *caddr = NULL;
 	int retval;
 
-	if (entry->pglist)
-		return 0;
-
 	entry->pglist = pgdata_allocate(entry->block_size, 1, &entry->pglist_cnt, Q_NOWAIT, 1);
 	if (unlikely(!entry->pglist))
 		return -1;
@@ -1021,21 +1203,8 @@ blk_entry_uncompress(struct blk_entry *entry)
 		goto err;
 
 	retval = qs_inflate_block(caddr, entry->comp_size, uaddr, entry->block_size);
-	if (unlikely(retval != 0)) {
-		struct blk_entry *prev, *next;
-		debug_warn("Uncompress failed for entry id %d lid_start %llu b_start %llu bid %u comp size %u block size %u\n", entry->entry_id, (unsigned long long)entry->lid_start, (unsigned long long)entry->b_start, entry->bint->bid, entry->comp_size, entry->block_size); 
-		prev = blk_entry_get_prev(entry);
-		if (prev) 
-			debug_warn("Uncompress failed for prev id %d lid_start %llu b_start %llu bid %u comp size %u block size %u\n", prev->entry_id, (unsigned long long)prev->lid_start, (unsigned long long)prev->b_start, prev->bint->bid, prev->comp_size, prev->block_size); 
-		next = blk_entry_get_next(entry);
-		if (next)  {
-			debug_warn("Uncompress failed for next id %d lid_start %llu b_start %llu bid %u comp size %u block size %u data block %d\n", next->entry_id, (unsigned long long)next->lid_start, (unsigned long long)next->b_start, next->bint->bid, next->comp_size, next->block_size, entry_is_data_block(next)); 
-			next = blk_entry_get_next(next);
-			if (next)
-				debug_warn("Uncompress failed for next id %d lid_start %llu b_start %llu bid %u comp size %u block size %u data block %d\n", next->entry_id, (unsigned long long)next->lid_start, (unsigned long long)next->b_start, next->bint->bid, next->comp_size, next->block_size, entry_is_data_block(next)); 
-		}
-		
-	}
+	if (unlikely(retval != 0))
+		blk_entry_uncompress_warn(entry);
 
 	vm_pg_unmap(caddr, entry->cpglist_cnt);
 	vm_pg_unmap(uaddr, entry->pglist_cnt);
@@ -1054,6 +1223,88 @@ err:
 	return -1;
 }
 
+/*
+ * scratch is set when called from a gdevq thread. Blocks which fit in the
+ * scratch buffers are gathered, decompressed and scattered without mapping
+ * the entry pages
+ */
+int
+blk_entry_uncompress(struct blk_entry *entry, struct comp_scratch *scratch)
+{
+	struct pgdata **pglist;
+	int pglist_cnt, retval;
+
+	if (entry->pglist)
+		return 0;
+
+	if (!scratch || entry->block_size > COMP_SCRATCH_SIZE)
+		return blk_entry_uncompress_map(entry);
+
+	pglist = pgdata_allocate(entry->block_size, 1, &pglist_cnt, Q_NOWAIT, 1);
+	if (unlikely(!pglist))
+		return -1;
+
+	pglist_copy_to_buf(entry->cpglist, entry->cpglist_cnt, scratch->caddr, entry->comp_size);
+	retval = qs_inflate_block(scratch->caddr, entry->comp_size, scratch->uaddr, entry->block_size);
+	if (unlikely(retval != 0))
+		blk_entry_uncompress_warn(entry);
+
+	pglist_copy_from_buf(pglist, pglist_cnt, scratch->uaddr, entry->block_size);
+	entry->pglist = pglist;
+	entry->pglist_cnt = pglist_cnt;
+	return 0;
+}
+
+static int
+blk_entry_verify_csum(struct blk_entry *entry)
+{
+	uint32_t csum;
+
+	if (!atomic_test_bit(BLK_ENTRY_CSUM, &entry->flags))
+		return 0;
+
+	csum = crc32c_pglist(entry->pglist, entry->pglist_cnt, entry->block_size);
+	if (unlikely(csum != entry->csum)) {
+		debug_warn("Data csum mismatch for lid_start %llu b_start %llu bid %u got %x stored %x\n", (unsigned long long)entry->lid_start, (unsigned long long)entry->b_start, entry->bint->bid, csum, entry->csum);
+		return -1;
+	}
+	return 0;
+}
+
+#define UNCOMP_READ_AHEAD_MAX		64
+
+/*
+ * Hand compressed entries whose reads have completed to the gdevq threads,
+ * so that they are decompressed in parallel ahead of the reader
+ */
+static void
+blk_map_queue_uncompress(struct blk_entry *entry)
+{
+	struct blk_entry *next;
+	struct blk_map *map;
+	int count = 0;
+
+	while (entry && entry_is_data_block(entry) && count < UNCOMP_READ_AHEAD_MAX) {
+		if (!entry->tcache || !entry->tcache->completion->done)
+			break;
+
+		if (entry->comp_size && !entry->pglist && !entry->completion)
+			gdevq_uncomp_insert(entry);
+		count++;
+
+		next = blk_entry_get_next(entry);
+		if (next) {
+			entry = next;
+			continue;
+		}
+
+		map = blk_map_get_next(entry->map);
+		if (!map || !atomic_test_bit(META_DATA_LOADED, &map->flags))
+			break;
+		entry = blk_map_first_entry(map);
+	}
+}
+
 int
 blk_map_read(struct tape_partition *partition, struct qsio_scsiio *ctio, uint32_t block_size, uint32_t num_blocks, uint8_t fixed, uint32_t *done_blocks, uint32_t *ili_block_size, uint32_t *ret_compressed_size)
 {
@@ -1126,6 +1377,7 @@ blk_map_read(struct tape_partition *partition, struct qsio_scsiio *ctio, uint32_
 		goto skip;
 	}
 
+	blk_map_queue_uncompress(orig_entry);
 	pglist = pgdata_allocate(block_size, num_blocks, &pglist_cnt, Q_WAITOK, 0);
 	read_entry = orig_entry;
 	read_map = map;
@@ -1140,13 +1392,18 @@ blk_map_read(struct tape_partition *partition, struct qsio_scsiio *ctio, uint32_
 		wait_for_done(read_entry->tcache->completion);
 
 		if (read_entry->comp_size) {
-			retval = blk_entry_uncompress(read_entry);
+			blk_entry_uncomp_wait(read_entry);
+			retval = blk_entry_uncompress(read_entry, NULL);
 			if (retval != 0) {
 				debug_warn("Uncompress failed for lid_start %llu b_start %llu bid %u comp size %u\n", (unsigned long long)read_entry->lid_start, (unsigned long long)read_entry->b_start, read_entry->bint->bid, read_entry->comp_size); 
 				goto reset_and_return;
 			}
 			compressed_size += read_entry->comp_size;
 		}
+
+		retval = blk_entry_verify_csum(read_entry);
+		if (unlikely(retval != 0))
+			goto reset_and_return;
 			
 		entry_idx = 0;
 		entry_pglist_map(pglist, &pg_idx, pglist_cnt, read_entry->pglist, &entry_idx, read_entry->pglist_cnt);
@@ -1162,8 +1419,10 @@ blk_map_read(struct tape_partition *partition, struct qsio_scsiio *ctio, uint32_
 		debug_check(!read_map);
 	}
 
-	if (read_entry)
+	if (read_entry) {
 		blk_map_readahead(read_entry);
+		blk_map_queue_uncompress(partition->cur_map->c_entry);
+	}
 
 	for (i = pg_idx; i < pglist_cnt; i++)
 		pgdata_free(pglist[i]);
@@ -1369,16 +1628,18 @@ err:
 }
 
 static int
-blk_entries_write_insert(struct tape_partition *partition, struct blk_map *start, struct blkentry_list *entry_list, int tmark, int new, uint64_t f_ids_start, uint64_t s_ids_start, uint32_t *ret_compressed_size)
+blk_entries_write_insert(struct tape_partition *partition, struct blk_map *start, struct blkentry_list *entry_list, int tmark, int new, uint64_t f_ids_start, uint64_t s_ids_start, uint32_t *ret_compressed_size, uint32_t *ret_sample_size, uint32_t *ret_entries)
 {
 	struct blkmap_list map_list;
 	struct maplookup_list mlookup_list;
 	struct blk_map *map = start;
+	struct blk_map *orig_start = start;
 	struct map_lookup *mlookup;
 	struct tsegment saved_meta_segment;
 	struct tsegment saved_data_segment;
 	struct blk_entry *entry;
-	uint32_t compressed_size = 0;
+	uint32_t compressed_size = 0, sample_size = 0;
+	uint32_t entries = 0, kept = 0;
 	int retval;
 	int entry_id;
 
@@ -1397,7 +1658,7 @@ blk_entries_write_insert(struct tape_partition *partition, struct blk_map *start
 	}
 
 	TAILQ_FOREACH(entry, entry_list, e_list) {
-		if (!map || entry_id == BLK_MAX_ENTRIES || new) {
+		if (!map || entry_id == blk_map_max_entries(map) || new || !blk_map_entry_fits(map, entry)) {
 			map = tape_partition_add_map(partition, entry->lid_start, f_ids_start, s_ids_start, &mlookup, &mlookup_list, &map_list);
 			if (unlikely(!map))
 				goto reset;
@@ -1426,14 +1687,23 @@ blk_entries_write_insert(struct tape_partition *partition, struct blk_map *start
 			entry->pglist = NULL;
 			entry->pglist_cnt = 0;
 			compressed_size += align_size(entry->comp_size, 512);
+			sample_size += align_size(entry->comp_size, 512);
 		}
 		else if (entry->block_size) {
 			cache_data_incr(map, entry->block_size);
 			map->pending_pglist_cnt += entry->pglist_cnt;
+			/* Compression was tried but didn't reduce the size */
+			if (entry->comp_type)
+				sample_size += entry->block_size;
 		}
 		map->nr_entries++;
 		TAILQ_INSERT_TAIL(&map->entry_list, entry, e_list);
+		blk_map_index_append(map, entry);
 		atomic_set_bit(META_IO_PENDING, &map->flags);
+		entries++;
+		/* Only the existing map survives a reset */
+		if (map == orig_start)
+			kept++;
 	}
 
 	partition->cur_map = map;
@@ -1464,13 +1734,19 @@ blk_entries_write_insert(struct tape_partition *partition, struct blk_map *start
 
 	if (ret_compressed_size)
 		*ret_compressed_size = compressed_size;
+	if (ret_sample_size)
+		*ret_sample_size = sample_size;
+	if (ret_entries)
+		*ret_entries = entries;
 	return 0;
 reset:
 	memcpy(&partition->msegment, &saved_meta_segment, sizeof(saved_meta_segment));
 	memcpy(&partition->dsegment, &saved_data_segment, sizeof(saved_data_segment));
 	__map_lookup_free_all(&mlookup_list);
 	__blk_map_free_all(&map_list);
-	partition->cur_map = start;
+	partition->cur_map = orig_start;
+	if (ret_entries)
+		*ret_entries = kept;
 	return -1;
 }
 
@@ -1519,7 +1795,7 @@ blk_map_write_filemarks(struct tape_partition *partition, uint8_t wsmk)
 		f_ids_start = 0;
 		s_ids_start = 0;
 	}
-	retval = blk_entries_write_insert(partition, map, &entry_list, 1, new, f_ids_start, s_ids_start, NULL);
+	retval = blk_entries_write_insert(partition, map, &entry_list, 1, new, f_ids_start, s_ids_start, NULL, NULL, NULL);
 	if (unlikely(retval != 0))
 		goto err;
 
@@ -1561,7 +1837,7 @@ new_write_entry(uint32_t block_size, uint64_t lid_start)
 }
 
 static int
-setup_entries(struct blkentry_list *entry_list, struct tape_partition *partition, struct qsio_scsiio *ctio, uint32_t block_size, uint32_t num_blocks, uint64_t lid_start, uint8_t compression_enabled)
+setup_entries(struct blkentry_list *entry_list, struct tape_partition *partition, struct qsio_scsiio *ctio, uint32_t block_size, uint32_t num_blocks, uint64_t lid_start, uint16_t comp_type)
 {
 	int i, src_idx, entry_idx, entry_pglist_cnt, src_pglist_cnt;
 	struct blk_entry *entry;
@@ -1580,19 +1856,114 @@ setup_entries(struct blkentry_list *entry_list, struct tape_partition *partition
 		entry->pglist = entry_pglist;
 		debug_check(!entry->pglist);
 		entry->pglist_cnt = entry_pglist_cnt;
-		if (compression_enabled)
+		entry->comp_type = comp_type;
+		if (partition->tape->data_csum)
+			atomic_set_bit(BLK_ENTRY_CSUM, &entry->flags);
+		if (comp_type || partition->tape->data_csum)
 			gdevq_comp_insert(entry);
 		TAILQ_INSERT_TAIL(entry_list, entry, e_list);
 	}
+	return 0;
+}
 
-	if (!compression_enabled)
+static int
+blk_entry_comp_wait(struct blk_entry *entry, int wait)
+{
+	if (!entry->completion)
+		return 1;
+
+	if (!wait && !entry->completion->done)
 		return 0;
 
+	wait_for_done(entry->completion);
+	wait_completion_free(entry->completion);
+	entry->completion = NULL;
+	return 1;
+}
+
+static void
+blk_entry_comp_wait_all(struct blkentry_list *entry_list)
+{
+	struct blk_entry *entry;
+
 	TAILQ_FOREACH(entry, entry_list, e_list) {
-		wait_for_done(entry->completion);
-		wait_completion_free(entry->completion);
-		entry->completion = NULL;
+		blk_entry_comp_wait(entry, 1);
 	}
+}
+
+/*
+ * Insert the entries into the blk maps in order as their compression
+ * completes. Waits only for the head of the list, everything behind it which
+ * is already compressed is inserted in the same batch. Once the current map
+ * has enough cached data its writes are started, so that disk I/O for the
+ * initial blocks of a command overlaps compression of the later ones
+ */
+static int
+blk_entries_pipeline_insert(struct tape_partition *partition, struct blkentry_list *entry_list, uint32_t *blocks_written, uint32_t *ret_compressed_size, uint32_t *ret_sample_size)
+{
+	struct blkentry_list done_list;
+	struct blk_entry *entry;
+	struct blk_map *map;
+	struct map_lookup *mlookup;
+	uint64_t f_ids_start, s_ids_start;
+	uint32_t compressed_size, total_compressed_size = 0;
+	uint32_t sample_size, total_sample_size = 0;
+	uint32_t inserted;
+	int retval, count;
+
+	*blocks_written = 0;
+	TAILQ_INIT(&done_list);
+	while ((entry = TAILQ_FIRST(entry_list)) != NULL) {
+		count = 0;
+		while (entry && blk_entry_comp_wait(entry, !count)) {
+			TAILQ_REMOVE(entry_list, entry, e_list);
+			TAILQ_INSERT_TAIL(&done_list, entry, e_list);
+			count++;
+			entry = TAILQ_FIRST(entry_list);
+		}
+
+		map = partition->cur_map;
+		if (map) {
+			mlookup = map->mlookup;
+			f_ids_start = mlookup->f_ids_start + mlookup->f_ids;
+			s_ids_start = mlookup->s_ids_start + mlookup->s_ids;
+		}
+		else {
+			f_ids_start = 0;
+			s_ids_start = 0;
+		}
+
+		compressed_size = 0;
+		sample_size = 0;
+		inserted = 0;
+		retval = blk_entries_write_insert(partition, map, &done_list, 0, 0, f_ids_start, s_ids_start, &compressed_size, &sample_size, &inserted);
+		if (unlikely(retval != 0)) {
+			/* Entries left in the current map are on the tape */
+			*blocks_written += inserted;
+			blk_entry_free_all(&done_list);
+			blk_entry_comp_wait_all(entry_list);
+			*ret_compressed_size = total_compressed_size;
+			*ret_sample_size = total_sample_size;
+			return retval;
+		}
+		total_compressed_size += compressed_size;
+		total_sample_size += sample_size;
+		*blocks_written += count;
+
+		map = partition->cur_map;
+		if (!TAILQ_EMPTY(entry_list) && map->cached_data > MAX_CACHED_WRITES) {
+			retval = blk_map_setup_writes(map, 0);
+			if (unlikely(retval != 0)) {
+				blk_entry_comp_wait_all(entry_list);
+				*ret_compressed_size = total_compressed_size;
+			*ret_sample_size = total_sample_size;
+				return retval;
+			}
+		}
+	}
+
+	*ret_compressed_size = total_compressed_size;
+	*ret_sample_size = total_sample_size;
 	return 0;
 }
 
@@ -1715,32 +2086,122 @@ tape_partition_post_space(struct tape_partition *partition)
 	atomic_set_bit(PARTITION_LOOKUP_SEGMENTS, &partition->flags);
 }
 
+/*
+ * Metadata of consecutive maps sits next to each other in the meta segment.
+ * Instead of a sync write per map, the pages are gathered into a tcache so
+ * that each contiguous run goes out as a single sync write
+ */
+static int
+blk_map_queue_meta(struct blk_map *map, struct tcache *tcache, struct blkmap_wlist *wlist)
+{
+	int retval;
+
+	if (!atomic_test_bit(META_IO_PENDING, &map->flags))
+		return 0;
+
+	wait_on_chan(map->blk_map_wait, !atomic_test_bit(META_DATA_DIRTY, &map->flags));
+	if (atomic_test_bit(META_DATA_ERROR, &map->flags) || atomic_test_bit(CACHE_DATA_ERROR, &map->flags))
+		return -1;
+
+	blk_map_flush_entries(map);
+	blk_map_write_header(map);
+	retval = tcache_add_page(tcache, map->metadata, map->b_start, map->bint, LBA_SIZE, QS_IO_SYNC);
+	if (unlikely(retval != 0))
+		return -1;
+
+	atomic_set_bit(META_DATA_DIRTY, &map->flags);
+	atomic_clear_bit(META_IO_PENDING, &map->flags);
+	atomic_clear_bit(META_DATA_CLONED, &map->flags);
+	blk_map_get(map);
+	STAILQ_INSERT_TAIL(wlist, map, w_list);
+	return 0;
+}
+
+/* tcache end_io, completes the metadata write of every map in the group */
+static void
+blk_maps_meta_end_io(struct tcache *tcache, void *priv)
+{
+	struct blkmap_wlist *wlist = priv;
+	struct blk_map *map;
+	int error;
+
+	error = atomic_test_bit(TCACHE_IO_ERROR, &tcache->flags);
+	while ((map = STAILQ_FIRST(wlist)) != NULL) {
+		STAILQ_REMOVE_HEAD(wlist, w_list);
+		if (unlikely(error))
+			atomic_set_bit(META_DATA_ERROR, &map->flags);
+		atomic_clear_bit(META_DATA_DIRTY, &map->flags);
+		chan_wakeup(map->blk_map_wait);
+		blk_map_put(map);
+	}
+	free(wlist, M_BLKENTRY);
+}
+
+/*
+ * Submits the grouped metadata writes without waiting. The maps are released
+ * by blk_maps_meta_end_io, callers wait on each map's META_DATA_DIRTY
+ */
+static void
+blk_maps_write_meta(struct tcache *tcache, struct blkmap_wlist *wlist)
+{
+	if (STAILQ_EMPTY(wlist)) {
+		free(wlist, M_BLKENTRY);
+		tcache_put(tcache);
+		return;
+	}
+
+	tcache->end_io = blk_maps_meta_end_io;
+	tcache->priv = wlist;
+	tcache_entry_rw(tcache, QS_IO_SYNC);
+	tcache_put(tcache);
+}
+
 static int 
 __tape_partition_flush_writes(struct tape_partition *partition, int wait)
 {
-	struct blk_map *map, *next;
+	struct blk_map *map, *next, *end = NULL;
 	struct map_lookup *mlookup, *prev_mlookup = NULL, *next_mlookup;
-	int retval;
+	struct blkmap_wlist *wlist;
+	struct tcache *tcache;
+	int retval, count = 0;
 	int error = 0;
 
-	TAILQ_FOREACH_SAFE(map, &partition->map_list, m_list, next) {
+	TAILQ_FOREACH(map, &partition->map_list, m_list) {
+		count++;
+	}
+
+	wlist = zalloc(sizeof(*wlist), M_BLKENTRY, Q_WAITOK);
+	STAILQ_INIT(wlist);
+	tcache = tcache_alloc(max_t(int, count, 1));
+	TAILQ_FOREACH(map, &partition->map_list, m_list) {
+		end = TAILQ_NEXT(map, m_list);
 		if (!wait && map == partition->cur_map)
 			continue;
-		blk_map_setup_writes(map, wait && !next);
+		blk_map_setup_writes(map, wait && !end);
 		if (wait || error)
 			blk_map_wait_for_data_completion(map);
 		else {
 			retval = blk_map_check_data_completion(map);
 			if (!retval) {
+				end = map;
 				break;
 			}
 		}
 
-		retval = blk_map_flush_meta(map);
+		retval = blk_map_queue_meta(map, tcache, wlist);
 		if (unlikely(retval != 0)) {
 			debug_warn("Flushing metadata for blk map at %llu failed\n", (unsigned long long)map->l_ids_start);
 			error = MEDIA_ERROR;
 		}
+	}
+
+	blk_maps_write_meta(tcache, wlist);
+
+	TAILQ_FOREACH_SAFE(map, &partition->map_list, m_list, next) {
+		if (map == end)
+			break;
+		if (!wait && map == partition->cur_map)
+			continue;
 
 		if (!error && !wait && atomic_test_bit(META_DATA_DIRTY, &map->flags))
 			continue;
@@ -1830,13 +2291,12 @@ tape_partition_start_writes(struct tape_partition *partition, int wait)
 }
 
 int
-blk_map_write(struct tape_partition *partition, struct qsio_scsiio *ctio, uint32_t block_size, uint32_t num_blocks, uint32_t *blocks_written, uint8_t compression_enabled, uint32_t *compressed_size)
+blk_map_write(struct tape_partition *partition, struct qsio_scsiio *ctio, uint32_t block_size, uint32_t num_blocks, uint32_t *blocks_written, uint16_t comp_type, uint32_t *compressed_size, uint32_t *sample_size)
 {
 	int retval;
 	struct blk_map *map;
-	struct map_lookup *mlookup;
 	struct blkentry_list entry_list;
-	uint64_t lid_start, f_ids_start, s_ids_start;
+	uint64_t lid_start;
 
 	if (partition->cached_data > PARTITION_CACHED_WRITES_MAX) {
 		retval = tape_partition_start_writes(partition, !ctio_buffered(ctio));
@@ -1864,29 +2324,19 @@ blk_map_write(struct tape_partition *partition, struct qsio_scsiio *ctio, uint32
 	TAILQ_INIT(&entry_list);
 
 	lid_start = blk_map_current_lid(map);
-	retval = setup_entries(&entry_list, partition, ctio, block_size, num_blocks, lid_start, compression_enabled);
+	retval = setup_entries(&entry_list, partition, ctio, block_size, num_blocks, lid_start, comp_type);
 	if (unlikely(retval != 0)) {
 		debug_warn("Setup entries failed\n");
 		goto err;
 	}
 
-	if (map) {
-		mlookup = map->mlookup;
-		f_ids_start = mlookup->f_ids_start + mlookup->f_ids;
-		s_ids_start = mlookup->s_ids_start + mlookup->s_ids;
-	}
-	else {
-		f_ids_start = 0;
-		s_ids_start = 0;
-	}
-
-	retval = blk_entries_write_insert(partition, map, &entry_list, 0, 0, f_ids_start, s_ids_start, compressed_size);
+	retval = blk_entries_pipeline_insert(partition, &entry_list, blocks_written, compressed_size, sample_size);
 	if (unlikely(retval != 0)) {
 		debug_warn("Insert entries failed\n");
 		goto err;
 	}
 
-	*blocks_written = num_blocks;
+	debug_check(*blocks_written != num_blocks);
 	ctio_free_data(ctio);
 	if (!ctio_buffered(ctio)) {
 		retval = tape_partition_start_writes(partition, 1);
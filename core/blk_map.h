@@ -29,16 +29,27 @@ enum {
 	BLK_ENTRY_NEW,
 	BLK_ENTRY_WRITE_SETUP_DONE,
 	BLK_ENTRY_READ_SETUP_DONE,
+	BLK_ENTRY_UNCOMP,
+	BLK_ENTRY_CSUM,
 };
 
 struct raw_blk_map {
 	uint32_t segment_id;
 	uint16_t csum;
 	uint16_t  nr_entries;
-	uint64_t pad; /* Each blk entry is 16 bytes long, so this is is free */
+	uint8_t version;
+	uint8_t pad[7]; /* Each blk entry is 16 bytes long, so this is is free */
 } __attribute__ ((__packed__));
 
+/*
+ * Maps of BLK_MAP_VERSION_CSUM keep a CRC32C of every data block in an
+ * array following the entries, at the cost of fewer entries per map
+ */
+#define BLK_MAP_VERSION_CSUM	1
+
 #define BLK_MAX_ENTRIES		((LBA_SIZE - sizeof(struct raw_blk_map)) / sizeof(struct raw_blk_entry))
+#define BLK_MAX_ENTRIES_CSUM	((LBA_SIZE - sizeof(struct raw_blk_map)) / (sizeof(struct raw_blk_entry) + sizeof(uint32_t)))
+#define BLK_MAP_CSUM_OFFSET	(BLK_MAX_ENTRIES_CSUM * sizeof(struct raw_blk_entry))
 #define MIN_MAP_READ_AHEAD	4
 
 struct blk_map * blk_map_new(struct tape_partition *partition, struct map_lookup *mlookup, uint64_t l_ids_start, uint64_t b_start, struct bdevint *bint, uint32_t segment_id);
@@ -58,13 +69,15 @@ int blk_map_locate_file(struct blk_map *map, uint64_t block_address);
 void blk_map_read_position(struct tape_partition *partition, struct tape_position_info *info);
 int blk_map_write_filemarks(struct tape_partition *partition, uint8_t wmsk);
 int blk_map_read(struct tape_partition *partition, struct qsio_scsiio *ctio, uint32_t block_size, uint32_t num_blocks, uint8_t fixed, uint32_t *bytes_read, uint32_t *ili_block_size, uint32_t *compressed_size);
-int blk_map_write(struct tape_partition *partition, struct qsio_scsiio *ctio, uint32_t block_size, uint32_t num_blocks, uint32_t *blocks_written, uint8_t compression_enabled, uint32_t *compressed_size);
+int blk_map_write(struct tape_partition *partition, struct qsio_scsiio *ctio, uint32_t block_size, uint32_t num_blocks, uint32_t *blocks_written, uint16_t comp_type, uint32_t *compressed_size, uint32_t *sample_size);
 
 /* Spacing support functions */
 int blk_map_space_forward(struct blk_map *map, uint8_t code, int *count);
 int blk_map_space_backward(struct blk_map *map, uint8_t code, int *count);
 int blk_map_erase(struct blk_map *map);
 
+int blk_entry_uncompress(struct blk_entry *entry, struct comp_scratch *scratch);
+
 /* Misc */
 void print_map_location_info(struct blk_map *map);
 
@@ -194,6 +207,33 @@ blk_map_first_entry_block(struct blk_map *map)
 	return entry->b_start;
 }
 
+static inline int
+blk_map_max_entries(struct blk_map *map)
+{
+	if (map->version == BLK_MAP_VERSION_CSUM)
+		return BLK_MAX_ENTRIES_CSUM;
+	else
+		return BLK_MAX_ENTRIES;
+}
+
+static inline uint32_t *
+blk_map_csum_array(struct blk_map *map)
+{
+	return (uint32_t *)(vm_pg_address(map->metadata) + BLK_MAP_CSUM_OFFSET);
+}
+
+/* A data block goes only into a map whose layout matches its checksum */
+static inline int
+blk_map_entry_fits(struct blk_map *map, struct blk_entry *entry)
+{
+	int csum_map = (map->version == BLK_MAP_VERSION_CSUM);
+	int csum_entry = (atomic_test_bit(BLK_ENTRY_CSUM, &entry->flags) != 0);
+
+	if (!entry_is_data_block(entry))
+		return 1;
+	return (csum_map == csum_entry);
+}
+
 static inline void
 blk_map_write_entry(struct blk_map *map, struct blk_entry *entry)
 {
@@ -204,6 +244,8 @@ blk_map_write_entry(struct blk_map *map, struct blk_entry *entry)
 	entry_set_block_size(entry);
 	SET_BLOCK(raw_entry->block, entry->b_start, entry->bint->bid);
 	raw_entry->bits = entry->bits;
+	if (map->version == BLK_MAP_VERSION_CSUM)
+		blk_map_csum_array(map)[entry->entry_id] = htole32(entry->csum);
 }
 
 static inline void 
@@ -43,6 +43,7 @@ MALLOC_DEFINE(M_RESERVATION, "quad reservation", "QUADStor reservation allocatio
 MALLOC_DEFINE(M_DEVQ, "quad devq", "QUADStor devq allocations");
 MALLOC_DEFINE(M_GDEVQ, "quad gdevq", "QUADStor gdevq allocations");
 MALLOC_DEFINE(M_WRKMEM, "quad wrkmem", "QUADStor wrkmem allocations");
+MALLOC_DEFINE(M_MLOOKUP, "quad mlookup", "QUADStor mlookup allocations");
 int
 tcache_need_new_bio(struct tcache *tcache, struct biot *biot, uint64_t b_start, struct bdevint *bint, int stat)
 {
@@ -467,6 +467,12 @@ get_cpu_count(void)
 	return mp_ncpus;
 }
 
+static inline int
+get_cpu_id(void)
+{
+	return curcpu;
+}
+
 static inline uint64_t
 get_availmem(void)
 {
@@ -501,6 +507,7 @@ MALLOC_DECLARE(M_RESERVATION);
 MALLOC_DECLARE(M_DEVQ);
 MALLOC_DECLARE(M_GDEVQ);
 MALLOC_DECLARE(M_WRKMEM);
+MALLOC_DECLARE(M_MLOOKUP);
 
 #define processor_yield	uio_yield
 struct tpriv;
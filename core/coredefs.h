@@ -40,6 +40,7 @@ enum {
 	META_DATA_LOADED,
 	DATA_WRITE_PENDING,
 	BINT_ALLOC_INSERTED,
+	BINT_INDEX_DIRTY,
 	CACHE_DATA_ERROR,
 };
 
@@ -102,7 +103,6 @@ calc_csum(uint8_t *buf, int len)
 }
 
 extern uma_t *ctio_cache;
-extern uma_t *pgdata_cache;
 extern uma_t *tcache_cache;
 #ifdef FREEBSD
 extern uma_t *biot_cache;
@@ -125,7 +125,6 @@ struct pgdata {
 	int flags;
 	pagestruct_t *verify_page;
 	STAILQ_ENTRY(pgdata) w_list;
-	wait_compl_t *completion;
 };
 
 static inline void
@@ -163,23 +162,40 @@ pgdata_add_ref(struct pgdata *dest, struct pgdata *src)
 	dest->pg_len = src->pg_len;
 }
 
+/*
+ * pgdata are carved out of slabs of PGDATA_SLAB_ENTRIES allocated along
+ * with the pglist. Freeing a pgdata releases its page, the slab goes with
+ * the pglist
+ */
+#define PGDATA_SLAB_ENTRIES	64
+
 static inline void
 pgdata_free(struct pgdata *pgdata)
 {
 	pgdata_free_page(pgdata);
-	debug_check(!pgdata->completion);
-	wait_completion_free(pgdata->completion);
-	uma_zfree(pgdata_cache, pgdata);
+}
+
+/* The slot before a pglist holds the number of pgdata it was allocated for */
+static inline int
+pglist_nsegs(struct pgdata **pglist)
+{
+	return (int)((unsigned long)pglist[-1]);
 }
 
 static inline void
 pglist_free(struct pgdata **pglist, int pglist_cnt)
 {
-	int i;
+	int i, nsegs;
 
 	for (i = 0; i < pglist_cnt; i++)
 		pgdata_free(pglist[i]);
-	free(pglist, M_PGLIST);
+
+	nsegs = pglist_nsegs(pglist);
+	for (i = 0; i < nsegs; i += PGDATA_SLAB_ENTRIES) {
+		if (pglist[i])
+			free(pglist[i], M_PGLIST);
+	}
+	free(pglist - 1, M_PGLIST);
 }
 
 #include "../export/qsio_ccb.h"
@@ -198,6 +214,32 @@ map_pglist_pages(struct pgdata **pglist, int pglist_cnt, pagestruct_t **pages)
 	}
 }
 
+static inline void
+pglist_copy_to_buf(struct pgdata **pglist, int pglist_cnt, uint8_t *buf, int len)
+{
+	int i, todo;
+
+	for (i = 0; i < pglist_cnt && len > 0; i++) {
+		todo = min_t(int, len, LBA_SIZE);
+		memcpy(buf, vm_pg_address(pglist[i]->page), todo);
+		buf += todo;
+		len -= todo;
+	}
+}
+
+static inline void
+pglist_copy_from_buf(struct pgdata **pglist, int pglist_cnt, uint8_t *buf, int len)
+{
+	int i, todo;
+
+	for (i = 0; i < pglist_cnt && len > 0; i++) {
+		todo = min_t(int, len, LBA_SIZE);
+		memcpy(vm_pg_address(pglist[i]->page), buf, todo);
+		buf += todo;
+		len -= todo;
+	}
+}
+
 static inline int
 pgdata_get_count(uint32_t block_size, uint32_t num_blocks)
 {
@@ -216,22 +258,23 @@ pgdata_allocate_pglist(int nsegs, allocflags_t flags)
 {
 	struct pgdata **pglist;
 
-	pglist = zalloc(sizeof(struct pgdata *) * nsegs, M_PGLIST, flags);
+	pglist = zalloc(sizeof(struct pgdata *) * (nsegs + 1), M_PGLIST, flags);
 	if (unlikely(!pglist)) {
 		debug_warn("Allocation failure nsegs %d, flags %u\n", nsegs, flags);
 		return NULL;
 	}
 
-	return pglist;
+	pglist[0] = (struct pgdata *)((unsigned long)nsegs);
+	return (pglist + 1);
 }
 
 static inline struct pgdata **
 pgdata_allocate(uint32_t block_size, uint32_t num_blocks, int *ret_pglist_cnt, allocflags_t flags, int alloc_page)
 {
-	struct pgdata **pglist, *pgtmp;
+	struct pgdata **pglist, *pgtmp, *slab = NULL;
 	int remaining;
 	int pglist_cnt;
-	int i, retval, idx;
+	int i, retval, idx, slab_cnt;
 	
 	*ret_pglist_cnt = pglist_cnt = pgdata_get_count(block_size, num_blocks);
 	debug_check(!pglist_cnt);
@@ -245,12 +288,15 @@ pgdata_allocate(uint32_t block_size, uint32_t num_blocks, int *ret_pglist_cnt, a
 	idx = 0;
 	for (i = 0; i < num_blocks; i++) {
 		for (remaining = block_size; remaining > 0; remaining -= LBA_SIZE) {
-			pgtmp = __uma_zalloc(pgdata_cache, flags | Q_ZERO, sizeof(*pgtmp));
-			if (unlikely(!pgtmp)) {
-				pglist_free(pglist, idx);
-				return NULL;
+			if (!(idx % PGDATA_SLAB_ENTRIES)) {
+				slab_cnt = min_t(int, PGDATA_SLAB_ENTRIES, pglist_cnt - idx);
+				slab = zalloc(sizeof(*slab) * slab_cnt, M_PGLIST, flags);
+				if (unlikely(!slab)) {
+					pglist_free(pglist, idx);
+					return NULL;
+				}
 			}
-			pgtmp->completion = wait_completion_alloc("pgdata compl"); 
+			pgtmp = &slab[idx % PGDATA_SLAB_ENTRIES];
 
 			pglist[idx] = pgtmp;
 			idx++;
@@ -299,14 +345,38 @@ ctio_new(allocflags_t flags)
 enum {
 	COMP_ALG_LZF	= 0x00,
 	COMP_ALG_LZ4	= 0x01,
+	COMP_ALG_LZ4_HC	= 0x02,
 };
 
+/*
+ * Compression selected for a write, passed down to the blk entries. Zero
+ * when compression is disabled, level zero is the algorithm default
+ */
+#define COMP_TYPE(alg, level)	(0x8000 | ((alg) << 8) | (level))
+#define COMP_TYPE_ALG(type)	(((type) >> 8) & 0x7F)
+#define COMP_TYPE_LEVEL(type)	((type) & 0xFF)
+
 #define COMP_ALG_SHIFT	28	
 #define COMP_ALG_MASK	((1 << COMP_ALG_SHIFT) - 1)
 
 #define SET_COMP_SIZE(ptr, csize, alg)	(*((uint32_t *)(ptr)) = (csize | (alg << COMP_ALG_SHIFT)))
 
-int qs_deflate_block(uint8_t *uncomp_addr, int uncomp_len, uint8_t *comp_addr, int *comp_size, void *wrkmem, int algo);
+/*
+ * Contiguous buffers owned by a compression thread. The source block is
+ * gathered into uaddr and compressed into caddr (and the reverse for
+ * decompression), so that the per block path does not need to map pages
+ */
+#define COMP_SCRATCH_SIZE	(1024 * 1024)
+
+struct comp_scratch {
+	pagestruct_t **pages;
+	uint8_t *uaddr;
+	uint8_t *caddr;
+	uint8_t *wrkmem;
+	int pg_count;
+};
+
+int qs_deflate_block(uint8_t *uncomp_addr, int uncomp_len, uint8_t *comp_addr, int *comp_size, void *wrkmem, int algo, int level);
 int qs_inflate_block(uint8_t *comp_addr, int comp_len, uint8_t *uncomp_addr, int uncomp_len);
 
 /* timeouts */
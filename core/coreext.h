@@ -141,6 +141,7 @@ typedef void bio_t;
 #define M_DEVQ			0
 #define M_GDEVQ			0
 #define M_WRKMEM		0
+#define M_MLOOKUP		0
 
 /* SCSI defs */
 #define SSD_MIN_SIZE			18
@@ -287,6 +288,7 @@ extern struct qs_kern_cbs kcbs;
 #define kernel_thread_check	(*kcbs.kernel_thread_check)
 #define sched_prio	(*kcbs.sched_prio)
 #define get_cpu_count	(*kcbs.get_cpu_count)
+#define get_cpu_id	(*kcbs.get_cpu_id)
 #define sock_create	(*kcbs.sock_create)
 #define sock_connect	(*kcbs.sock_connect)
 #define sock_close	(*kcbs.sock_close)
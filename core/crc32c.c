@@ -0,0 +1,48 @@
+/* 
+ * Copyright (C) Shivaram Upadhyayula <shivaram.u@quadstor.com>
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * Version 2 as published by the Free Software Foundation
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include "crc32c.h"
+#include "crc32c_impl.h"
+
+static crc32c_fn_t crc32c_fn = crc32c_sb8;
+
+void
+crc32c_init(void)
+{
+	crc32c_fn = crc32c_impl_init();
+}
+
+uint32_t
+crc32c_buf(uint8_t *buf, int len)
+{
+	return ~((*crc32c_fn)(~0U, buf, len));
+}
+
+uint32_t
+crc32c_pglist(struct pgdata **pglist, int pglist_cnt, int len)
+{
+	uint32_t crc = ~0U;
+	int i, todo;
+
+	for (i = 0; i < pglist_cnt && len > 0; i++) {
+		todo = min_t(int, len, pglist[i]->pg_len);
+		crc = (*crc32c_fn)(crc, vm_pg_address(pglist[i]->page), todo);
+		len -= todo;
+	}
+	return ~crc;
+}
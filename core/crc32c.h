@@ -0,0 +1,28 @@
+/* 
+ * Copyright (C) Shivaram Upadhyayula <shivaram.u@quadstor.com>
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * Version 2 as published by the Free Software Foundation
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+ * Boston, MA  02110-1301, USA.
+ */
+
+#ifndef QUADSTOR_CRC32C_H_
+#define QUADSTOR_CRC32C_H_
+
+#include "coredefs.h"
+
+void crc32c_init(void);
+uint32_t crc32c_buf(uint8_t *buf, int len);
+uint32_t crc32c_pglist(struct pgdata **pglist, int pglist_cnt, int len);
+
+#endif
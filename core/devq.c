@@ -21,30 +21,49 @@
 #include "mchanger.h"
 #include "tdrive.h"
 
-static struct qsio_hdr *
-get_next_ccb(struct qs_devq *devq)
+/* Takes everything queued so far, reversing it into submission order */
+static int
+get_next_batch(struct qs_devq *devq, struct ccb_list *batch)
 {
-	struct qsio_hdr *ccb;
-
-	chan_lock(devq->devq_wait);
-	ccb = STAILQ_FIRST(&devq->pending_queue);
-	if (ccb)
-		STAILQ_REMOVE_HEAD(&devq->pending_queue, c_list);
-	chan_unlock(devq->devq_wait);
-	return ccb;
+	struct qsio_hdr *ccb_h, *next;
+	int count = 0;
+
+	ccb_h = (struct qsio_hdr *)atomic_readandclear_ptr((volatile u_long *)&devq->pending_head);
+	while (ccb_h) {
+		next = STAILQ_NEXT(ccb_h, c_list);
+		STAILQ_INSERT_HEAD(batch, ccb_h, c_list);
+		ccb_h = next;
+		count++;
+	}
+	return count;
 }
 
 /* process_queue returns only after draining the queue */
 static void
 devq_process_queue(struct qs_devq *devq)
 {
+	struct ccb_list batch;
 	struct qsio_hdr *ccb_h;
-
-	while ((ccb_h = get_next_ccb(devq)) != NULL) {
-		(*devq->proc_cmd)(devq->tdevice, ccb_h);
-		debug_check(!atomic_read(&devq->pending_cmds));
-		atomic_dec(&devq->pending_cmds);
+	int count;
+
+	STAILQ_INIT(&batch);
+	atomic_set_int(&devq->running, 1);
+	while ((count = get_next_batch(devq, &batch)) != 0) {
+		devq->batch_count++;
+		devq->batch_cmds += count;
+		if (count > devq->batch_max)
+			devq->batch_max = count;
+
+		while ((ccb_h = STAILQ_FIRST(&batch)) != NULL) {
+			STAILQ_REMOVE_HEAD(&batch, c_list);
+			(*devq->proc_cmd)(devq->tdevice, ccb_h);
+			debug_check(!atomic_read(&devq->pending_cmds));
+			if (atomic_dec_and_test(&devq->pending_cmds))
+				chan_wakeup(devq->drain_wait);
+		}
 	}
+	/* Locked op, the wait below sees any push which missed the flag */
+	atomic_clear_int(&devq->running, 1);
 }
 
 #ifdef FREEBSD 
@@ -59,7 +78,7 @@ static int devq_thread(void *data)
 
 	for (;;)
 	{
-		wait_on_chan_interruptible(devq->devq_wait, !STAILQ_EMPTY(&devq->pending_queue) || kernel_thread_check(&devq->flags, DEVQ_EXIT));
+		wait_on_chan_interruptible(devq->devq_wait, devq->pending_head != NULL || kernel_thread_check(&devq->flags, DEVQ_EXIT));
 
 		devq_process_queue(devq);
 
@@ -90,6 +109,7 @@ devq_exit(struct qs_devq *devq)
 	}	
 
 	wait_chan_free(devq->devq_wait);
+	wait_chan_free(devq->drain_wait);
 	free(devq, M_DEVQ);
 }
 
@@ -107,12 +127,13 @@ devq_init(uint32_t bus_id, uint32_t target_id, struct tdevice *tdevice, const ch
 
 	devq->tdevice = tdevice;
 	devq->devq_wait = wait_chan_alloc("devq wait");
+	devq->drain_wait = wait_chan_alloc("devq drain wait");
 	devq->proc_cmd = proc_cmd;
-	STAILQ_INIT(&devq->pending_queue);
 	retval = kernel_thread_create(devq_thread, devq, devq->task, "%s%03u%02u", name, bus_id, target_id);
 	if(retval != 0)
 	{
 		wait_chan_free(devq->devq_wait);
+		wait_chan_free(devq->drain_wait);
 		free(devq, M_DEVQ);
 		return NULL;
 	}
@@ -22,11 +22,23 @@
 #include "coredefs.h"
 
 struct tdevice;
+
+/*
+ * Producers push commands onto pending_head with a compare and swap, newest
+ * first. The devq thread takes the whole list in one swap and runs it in
+ * submission order, so a wakeup is only needed when the list goes from
+ * empty to non empty while the thread isn't already draining
+ */
 struct qs_devq {
-	struct ccb_list pending_queue;
+	struct qsio_hdr * volatile pending_head;
 	wait_chan_t *devq_wait;
+	wait_chan_t *drain_wait; /* woken when pending_cmds drops to zero */
 	atomic_t pending_cmds;
+	volatile u_int running;
 	int flags;
+	uint32_t batch_max;
+	uint64_t batch_count;
+	uint64_t batch_cmds;
 	struct tdevice *tdevice;
 	kproc_t *task;
 	void (*proc_cmd)(void *drive, void *iop);
@@ -44,10 +56,29 @@ enum {
 static inline void
 devq_insert_ccb(struct qs_devq *devq, struct qsio_hdr *ccb_h)
 {
-	chan_lock(devq->devq_wait);
-	STAILQ_INSERT_TAIL(&devq->pending_queue, ccb_h, c_list);
+	struct qsio_hdr *head;
+
 	atomic_inc(&devq->pending_cmds);
-	chan_wakeup_unlocked(devq->devq_wait);
-	chan_unlock(devq->devq_wait);
+	do {
+		head = devq->pending_head;
+		STAILQ_NEXT(ccb_h, c_list) = head;
+	} while (!atomic_cmpset_ptr((volatile u_long *)&devq->pending_head, (u_long)head, (u_long)ccb_h));
+
+	if (!head && !devq->running)
+		chan_wakeup_one(devq->devq_wait);
+}
+
+static inline void
+devq_wait_for_drain(struct qs_devq *devq)
+{
+	wait_on_chan(devq->drain_wait, !atomic_read(&devq->pending_cmds));
+}
+
+static inline void
+devq_reset_stats(struct qs_devq *devq)
+{
+	devq->batch_max = 0;
+	devq->batch_count = 0;
+	devq->batch_cmds = 0;
 }
 #endif
@@ -18,35 +18,128 @@
 
 #include "gdevq.h"
 #include "bdevgroup.h"
+#include "lz4.h"
+#include "crc32c.h"
 
-struct blkentry_clist pending_comp_queue = STAILQ_HEAD_INITIALIZER(pending_comp_queue);
-static SLIST_HEAD(, qs_cdevq) cdevq_list = SLIST_HEAD_INITIALIZER(cdevq_list);
-wait_chan_t *devq_comp_wait;
+static struct qs_cdevq **cdevq_array;
+static int cdevq_count;
+static int steal_cursor;
 
 static inline struct blk_entry *
-get_next_comp_entry(void)
+cdevq_get_next_entry(struct qs_cdevq *devq)
 {
 	struct blk_entry *entry;
 
-	chan_lock(devq_comp_wait);
-	entry = STAILQ_FIRST(&pending_comp_queue);
-	if (entry)
-		STAILQ_REMOVE_HEAD(&pending_comp_queue, c_list);
-	chan_unlock(devq_comp_wait);
+	if (STAILQ_EMPTY(&devq->comp_queue))
+		return NULL;
+
+	chan_lock(devq->comp_wait);
+	entry = STAILQ_FIRST(&devq->comp_queue);
+	if (entry) {
+		STAILQ_REMOVE_HEAD(&devq->comp_queue, c_list);
+		atomic_dec(&devq->pending_entries);
+	}
+	chan_unlock(devq->comp_wait);
 	return entry;
 }
 
+static struct blk_entry *
+get_next_comp_entry(struct qs_cdevq *devq)
+{
+	struct blk_entry *entry;
+	struct qs_cdevq *victim;
+	int i;
+
+	entry = cdevq_get_next_entry(devq);
+	if (entry)
+		return entry;
+
+	/* Own queue is empty, steal from the other queues */
+	for (i = 1; i < cdevq_count; i++) {
+		victim = cdevq_array[(devq->id + i) % cdevq_count];
+		if (!atomic_read(&victim->pending_entries))
+			continue;
+		entry = cdevq_get_next_entry(victim);
+		if (entry)
+			return entry;
+	}
+	return NULL;
+}
+
 static void
-blk_entry_compress(struct blk_entry *entry, struct qs_cdevq *devq)
+gdevq_insert(struct blk_entry *entry)
+{
+	struct qs_cdevq *devq, *next;
+	int pending, wanted, start, i;
+
+	entry->completion = wait_completion_alloc("entry compl");
+	devq = cdevq_array[get_cpu_id() % cdevq_count];
+	chan_lock(devq->comp_wait);
+	STAILQ_INSERT_TAIL(&devq->comp_queue, entry, c_list);
+	atomic_inc(&devq->pending_entries);
+	pending = atomic_read(&devq->pending_entries);
+	chan_wakeup_one_unlocked(devq->comp_wait);
+	chan_unlock(devq->comp_wait);
+
+	if (pending < CDEVQ_STEAL_THRESHOLD || cdevq_count == 1)
+		return;
+
+	/*
+	 * Wakeup one idle thread for every CDEVQ_STEAL_THRESHOLD entries
+	 * pending, starting from a rotating position so that a single hot
+	 * stream spreads over all the threads
+	 */
+	wanted = pending / CDEVQ_STEAL_THRESHOLD;
+	start = steal_cursor;
+	for (i = 0; i < cdevq_count && wanted; i++) {
+		next = cdevq_array[(start + i) % cdevq_count];
+		if (next == devq)
+			continue;
+		if (atomic_read(&next->pending_entries) || atomic_test_bit(CDEVQ_STEAL, &next->flags))
+			continue;
+		chan_lock(next->comp_wait);
+		atomic_set_bit(CDEVQ_STEAL, &next->flags);
+		chan_wakeup_one_unlocked(next->comp_wait);
+		chan_unlock(next->comp_wait);
+		wanted--;
+		steal_cursor = next->id + 1;
+	}
+}
+
+void
+gdevq_comp_insert(struct blk_entry *entry)
+{
+	gdevq_insert(entry);
+}
+
+void
+gdevq_uncomp_insert(struct blk_entry *entry)
+{
+	atomic_set_bit(BLK_ENTRY_UNCOMP, &entry->flags);
+	gdevq_insert(entry);
+}
+
+/* buf, when set, holds the uncompressed block already gathered or mapped */
+static void
+blk_entry_set_csum(struct blk_entry *entry, uint8_t *buf)
+{
+	if (!atomic_test_bit(BLK_ENTRY_CSUM, &entry->flags))
+		return;
+
+	if (buf)
+		entry->csum = crc32c_buf(buf, entry->block_size);
+	else
+		entry->csum = crc32c_pglist(entry->pglist, entry->pglist_cnt, entry->block_size);
+}
+
+static void
+blk_entry_compress_map(struct blk_entry *entry, struct qs_cdevq *devq)
 {
 	struct pgdata **cpglist = NULL;
 	pagestruct_t **cpages, **upages;
 	uint8_t *uaddr = NULL, *caddr = NULL;
 	int cpglist_cnt, retval, comp_size, i, actual_cnt;
 
-	if (entry->block_size < LBA_SIZE)
-		return;
-
 	cpages = malloc(sizeof(pagestruct_t *) * entry->pglist_cnt, M_GDEVQ, Q_WAITOK);
 	upages = malloc(sizeof(pagestruct_t *) * entry->pglist_cnt, M_GDEVQ, Q_WAITOK);
 
@@ -59,13 +152,14 @@ blk_entry_compress(struct blk_entry *entry, struct qs_cdevq *devq)
 	uaddr = vm_pg_map(upages, entry->pglist_cnt);
 	if (!uaddr)
 		goto err;
+	blk_entry_set_csum(entry, uaddr);
 
 	map_pglist_pages(cpglist, cpglist_cnt, cpages);
 	caddr = vm_pg_map(cpages, cpglist_cnt);
 	if (!caddr)
 		goto err;
 
-	retval = qs_deflate_block(uaddr, entry->block_size, caddr, &comp_size, devq->wrkmem, COMP_ALG_LZ4);
+	retval = qs_deflate_block(uaddr, entry->block_size, caddr, &comp_size, devq->scratch.wrkmem, COMP_TYPE_ALG(entry->comp_type), COMP_TYPE_LEVEL(entry->comp_type));
 	if (retval != 0)
 		goto err;
 
@@ -86,6 +180,8 @@ blk_entry_compress(struct blk_entry *entry, struct qs_cdevq *devq)
 err:
 	if (uaddr)
 		vm_pg_unmap(uaddr, entry->pglist_cnt);
+	else
+		blk_entry_set_csum(entry, NULL);
 	if (caddr)
 		vm_pg_unmap(caddr, cpglist_cnt);
 	if (cpglist)
@@ -94,13 +190,49 @@ err:
 	free(cpages, M_GDEVQ);
 }
 
+static void
+blk_entry_compress(struct blk_entry *entry, struct qs_cdevq *devq)
+{
+	struct comp_scratch *scratch = &devq->scratch;
+	struct pgdata **cpglist;
+	int cpglist_cnt, retval, comp_size;
+
+	if (!entry->comp_type || entry->block_size < LBA_SIZE) {
+		blk_entry_set_csum(entry, NULL);
+		return;
+	}
+
+	if (entry->block_size > COMP_SCRATCH_SIZE) {
+		blk_entry_compress_map(entry, devq);
+		return;
+	}
+
+	pglist_copy_to_buf(entry->pglist, entry->pglist_cnt, scratch->uaddr, entry->block_size);
+	blk_entry_set_csum(entry, scratch->uaddr);
+	retval = qs_deflate_block(scratch->uaddr, entry->block_size, scratch->caddr, &comp_size, scratch->wrkmem, COMP_TYPE_ALG(entry->comp_type), COMP_TYPE_LEVEL(entry->comp_type));
+	if (retval != 0)
+		return;
+
+	cpglist = pgdata_allocate(comp_size, 1, &cpglist_cnt, Q_NOWAIT, 1);
+	if (unlikely(!cpglist))
+		return;
+
+	pglist_copy_from_buf(cpglist, cpglist_cnt, scratch->caddr, comp_size);
+	entry->cpglist = cpglist;
+	entry->comp_size = comp_size;
+	entry->cpglist_cnt = cpglist_cnt;
+}
+
 static void
 devq_process_comp_queue(struct qs_cdevq *devq)
 {
 	struct blk_entry *entry;
 
-	while ((entry = get_next_comp_entry()) != NULL) {
-		blk_entry_compress(entry, devq);
+	while ((entry = get_next_comp_entry(devq)) != NULL) {
+		if (atomic_test_bit(BLK_ENTRY_UNCOMP, &entry->flags))
+			blk_entry_uncompress(entry, &devq->scratch);
+		else
+			blk_entry_compress(entry, devq);
 		wait_complete_all(entry->completion);
 	}
 }
@@ -118,7 +250,8 @@ static int cdevq_thread(void *data)
 
 	for (;;)
 	{
-		wait_on_chan_interruptible(devq_comp_wait, !STAILQ_EMPTY(&pending_comp_queue) || kernel_thread_check(&devq->exit_flags, GDEVQ_EXIT));
+		wait_on_chan_interruptible(devq->comp_wait, !STAILQ_EMPTY(&devq->comp_queue) || atomic_test_bit(CDEVQ_STEAL, &devq->flags) || kernel_thread_check(&devq->exit_flags, GDEVQ_EXIT));
+		atomic_clear_bit(CDEVQ_STEAL, &devq->flags);
 		devq_process_comp_queue(devq);
 
 		if (unlikely(kernel_thread_check(&devq->exit_flags, GDEVQ_EXIT)))
@@ -133,6 +266,50 @@ static int cdevq_thread(void *data)
 #endif
 }
 
+/* Large enough for the LZ4 HC tables, which are the largest of the algorithms */
+#define COMP_WRKMEM_SIZE	(align_size(LZ4HC_WRKMEM_SIZE, LBA_SIZE))
+
+static void
+cdevq_scratch_free(struct comp_scratch *scratch)
+{
+	int i;
+
+	if (scratch->uaddr)
+		vm_pg_unmap(scratch->uaddr, scratch->pg_count);
+
+	for (i = 0; i < scratch->pg_count; i++)
+		vm_pg_free(scratch->pages[i]);
+
+	if (scratch->pages)
+		free(scratch->pages, M_GDEVQ);
+	bzero(scratch, sizeof(*scratch));
+}
+
+static int
+cdevq_scratch_alloc(struct comp_scratch *scratch)
+{
+	int pg_count = ((COMP_SCRATCH_SIZE * 2) + COMP_WRKMEM_SIZE) >> LBA_SHIFT;
+	int i;
+
+	scratch->pages = zalloc(sizeof(pagestruct_t *) * pg_count, M_GDEVQ, Q_WAITOK);
+	for (i = 0; i < pg_count; i++) {
+		scratch->pages[i] = vm_pg_alloc(0);
+		if (unlikely(!scratch->pages[i]))
+			goto err;
+		scratch->pg_count++;
+	}
+
+	scratch->uaddr = vm_pg_map(scratch->pages, pg_count);
+	if (unlikely(!scratch->uaddr))
+		goto err;
+	scratch->caddr = scratch->uaddr + COMP_SCRATCH_SIZE;
+	scratch->wrkmem = scratch->caddr + COMP_SCRATCH_SIZE;
+	return 0;
+err:
+	cdevq_scratch_free(scratch);
+	return -1;
+}
+
 static struct qs_cdevq *
 init_cdevq(int id)
 {
@@ -145,10 +322,21 @@ init_cdevq(int id)
 		return NULL;
 	}
 	devq->id = id;
+	STAILQ_INIT(&devq->comp_queue);
+
+	retval = cdevq_scratch_alloc(&devq->scratch);
+	if (unlikely(retval != 0)) {
+		debug_warn("Failed to allocate devq scratch buffers\n");
+		free(devq, M_GDEVQ);
+		return NULL;
+	}
+	devq->comp_wait = wait_chan_alloc("gdevq comp wait");
 
 	retval = kernel_thread_create(cdevq_thread, devq, devq->task, "cdevq_%d", id);
 	if (unlikely(retval != 0)) {
 		debug_warn("Failed to run devq\n");
+		wait_chan_free(devq->comp_wait);
+		cdevq_scratch_free(&devq->scratch);
 		free(devq, M_GDEVQ);
 		return NULL;
 	}
@@ -162,15 +350,15 @@ init_gdevq_threads(void)
 	struct qs_cdevq *cdevq;
 	int cpu_count = get_cpu_count();
 
-	devq_comp_wait = wait_chan_alloc("gdevq comp wait");
-
+	cdevq_array = zalloc(sizeof(struct qs_cdevq *) * cpu_count, M_GDEVQ, Q_WAITOK);
 	for (i = 0; i < cpu_count; i++) {
 		cdevq = init_cdevq(i);
 		if (unlikely(!cdevq)) {
 			debug_warn("Failed to init cdevq at i %d\n", i);
 			return -1;
 		}
-		SLIST_INSERT_HEAD(&cdevq_list, cdevq, c_list);
+		cdevq_array[i] = cdevq;
+		cdevq_count++;
 	}
 
 	return 0;
@@ -180,17 +368,32 @@ void
 exit_gdevq_threads(void)
 {
 	struct qs_cdevq *cdevq;
-	int err;
+	int err, i, failed = 0;
+
+	if (!cdevq_array)
+		return;
 
-	while ((cdevq = SLIST_FIRST(&cdevq_list)) != NULL) {
-		SLIST_REMOVE_HEAD(&cdevq_list, c_list);
-		err = kernel_thread_stop(cdevq->task, &cdevq->exit_flags, devq_comp_wait, GDEVQ_EXIT);
+	/* Running threads steal from and wakeup the other cdevqs */
+	for (i = 0; i < cdevq_count; i++) {
+		cdevq = cdevq_array[i];
+		err = kernel_thread_stop(cdevq->task, &cdevq->exit_flags, cdevq->comp_wait, GDEVQ_EXIT);
 		if (err) {
 			debug_warn("Shutting down qs cdevq failed\n");
-			continue;
+			failed = 1;
 		}
+	}
+
+	if (failed)
+		return;
+
+	for (i = 0; i < cdevq_count; i++) {
+		cdevq = cdevq_array[i];
+		wait_chan_free(cdevq->comp_wait);
+		cdevq_scratch_free(&cdevq->scratch);
 		free(cdevq, M_GDEVQ);
 	}
 
-	wait_chan_free(devq_comp_wait);
+	free(cdevq_array, M_GDEVQ);
+	cdevq_array = NULL;
+	cdevq_count = 0;
 }
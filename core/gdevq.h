@@ -24,28 +24,27 @@
 #include "blk_map.h"
 
 struct qs_cdevq {
-	uint8_t wrkmem[65536];
+	struct comp_scratch scratch;
+	struct blkentry_clist comp_queue;
+	wait_chan_t *comp_wait;
+	atomic_t pending_entries;
 	kproc_t *task;
-	SLIST_ENTRY(qs_cdevq) c_list;
+	int flags;
 	int exit_flags;
 	int id;
 };
 
 #define GDEVQ_EXIT		0x02
 
-extern struct blkentry_clist pending_comp_queue;
-extern wait_chan_t *devq_comp_wait;
+enum {
+	CDEVQ_STEAL,
+};
 
-static inline void
-gdevq_comp_insert(struct blk_entry *entry)
-{
-	entry->completion = wait_completion_alloc("entry compl");
-	chan_lock(devq_comp_wait);
-	STAILQ_INSERT_TAIL(&pending_comp_queue, entry, c_list);
-	chan_wakeup_one_unlocked(devq_comp_wait);
-	chan_unlock(devq_comp_wait);
-}
+/* Wakeup an idle thread for stealing for every this many pending entries */
+#define CDEVQ_STEAL_THRESHOLD	4
 
+void gdevq_comp_insert(struct blk_entry *entry);
+void gdevq_uncomp_insert(struct blk_entry *entry);
 int init_gdevq_threads(void);
 void exit_gdevq_threads(void);
 #endif
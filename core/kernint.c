@@ -26,6 +26,7 @@
 #include "blk_map.h"
 #include "bdevgroup.h"
 #include "gdevq.h"
+#include "crc32c.h"
 #include "lz4.h"
 #include "lzfP.h"
 
@@ -33,7 +34,7 @@ int stale_initiator_timeout = STALE_INITIATOR_TIMEOUT;
 struct qs_kern_cbs kcbs;
 
 int
-qs_deflate_block(uint8_t *in_buf, int uncomp_len, uint8_t *out_buf, int *comp_size, void *wrkmem, int algo)
+qs_deflate_block(uint8_t *in_buf, int uncomp_len, uint8_t *out_buf, int *comp_size, void *wrkmem, int algo, int level)
 {
 	int retval;
 
@@ -43,7 +44,10 @@ qs_deflate_block(uint8_t *in_buf, int uncomp_len, uint8_t *out_buf, int *comp_si
 		retval = lzf_compress(in_buf, uncomp_len, out_buf+sizeof(uint32_t), uncomp_len - 508, wrkmem);
 		break;
 	case COMP_ALG_LZ4:
-		retval = LZ4_compress_limitedOutput(wrkmem, in_buf, out_buf+sizeof(uint32_t), uncomp_len, uncomp_len - 508);
+		retval = LZ4_compress_fast_limitedOutput(wrkmem, in_buf, out_buf+sizeof(uint32_t), uncomp_len, uncomp_len - 508, level ? level : 1);
+		break;
+	case COMP_ALG_LZ4_HC:
+		retval = LZ4_compressHC_limitedOutput(wrkmem, in_buf, out_buf+sizeof(uint32_t), uncomp_len, uncomp_len - 508, level ? level : LZ4HC_LEVEL_DEFAULT);
 		break;
 	default:
 		debug_check(1);
@@ -77,6 +81,7 @@ qs_inflate_block(uint8_t *in_buf, int comp_len, uint8_t *out_buf, int uncomp_len
 		retval = lzf_decompress(in_buf+sizeof(uint32_t), comp_size, out_buf, uncomp_len);
 		break;
 	case COMP_ALG_LZ4:
+	case COMP_ALG_LZ4_HC:
 		retval = LZ4_uncompress_unknownOutputSize(in_buf+sizeof(uint32_t), out_buf, comp_size, uncomp_len);
 		break;
 	default:
@@ -99,7 +104,6 @@ uma_t *chan_cache;
 uma_t *compl_cache;
 uma_t *ctio_cache;
 uma_t *istate_cache;
-uma_t *pgdata_cache;
 #ifdef FREEBSD
 uma_t *biot_cache;
 uma_t *biot_page_cache;
@@ -170,9 +174,6 @@ exit_caches(void)
 	if (istate_cache)
 		__uma_zdestroy("vt_qs_istate", istate_cache);
 
-	debug_print("free pgdata_cache\n");
-	if (pgdata_cache)
-		__uma_zdestroy("vt_qs_pgdata", pgdata_cache);
 #ifdef FREEBSD
 	debug_print("biot_cache_free\n");
 	if (biot_cache)
@@ -264,12 +265,6 @@ init_caches(void)
 		return -1;
 	}
 
-	CREATE_CACHE(pgdata_cache, "vt_pgdata_cache", sizeof(struct pgdata));
-	if (!pgdata_cache) {
-		debug_warn("Cannot create pgdata_cache\n");
-		return -1;
-	}
-
 #ifdef FREEBSD
 	CREATE_CACHE(biot_cache, "vt_qs_biot", sizeof(struct biot));
 	if (unlikely(!biot_cache)) {
@@ -368,6 +363,9 @@ __kern_exit(void)
 	debug_print("detach interfaces\n");
 	device_detach_interfaces();
 
+	debug_print("exit vcart load threads\n");
+	exit_vcart_load_threads();
+
 	debug_print("exit gdevq threads\n");
 	exit_gdevq_threads();
 
@@ -395,6 +393,7 @@ init_globals(void)
 	cbs_lock = sx_alloc("cbs lock");
 	tdevice_lookup_lock = mtx_alloc("tdevice lookup lock");
 	glbl_lock = mtx_alloc("glbl lock");
+	crc32c_init();
 }
 
 static int
@@ -417,6 +416,7 @@ coremod_qload_done(void)
 static int
 coremod_load_done(void)
 {
+	vcartridge_load_wait();
 	atomic_set(&mdaemon_load_done, 1);
 	return 0;
 }
@@ -449,6 +449,7 @@ vtkern_interface_init(struct qs_kern_cbs *kern_cbs)
 	kern_cbs->vcartridge_delete = vcartridge_delete;
 	kern_cbs->vcartridge_info = vcartridge_info;
 	kern_cbs->vcartridge_reload = vcartridge_reload;
+	kern_cbs->vcartridge_load_status = vcartridge_load_status;
 	kern_cbs->target_add_fc_rule = target_add_fc_rule;
 	kern_cbs->target_remove_fc_rule = target_remove_fc_rule;
 
@@ -469,6 +470,15 @@ vtkern_interface_init(struct qs_kern_cbs *kern_cbs)
 		return -1;
 	}
 
+	retval = init_vcart_load_threads();
+	if (unlikely(retval != 0)) {
+		exit_vcart_load_threads();
+		exit_gdevq_threads();
+		exit_globals();
+		exit_caches();
+		return -1;
+	}
+
 	atomic_set(&kern_inited, 1);
 	atomic_set(&itf_enabled, 1);
 	return 0;
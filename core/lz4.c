@@ -394,7 +394,8 @@ FORCE_INLINE int LZ4_compress_generic(
 
                  limitedOutput_directive limitedOutput,
                  tableType_t tableType,
-                 prefix64k_directive prefix)
+                 prefix64k_directive prefix,
+                 int acceleration)
 {
     BYTE* ip = (BYTE*) source;
     BYTE* const base = (prefix==withPrefix) ? ((LZ4_Data_Structure*)ctx)->base : (BYTE*) source;
@@ -425,7 +426,7 @@ FORCE_INLINE int LZ4_compress_generic(
     // Main Loop
     for ( ; ; )
     {
-        int findMatchAttempts = (1U << skipStrength) + 3;
+        int findMatchAttempts = (acceleration << skipStrength) + 3;
         BYTE* forwardIp = ip;
         BYTE* ref;
         BYTE* token;
@@ -527,19 +528,202 @@ _last_literals:
     return (int) (((char*)op)-dest);
 }
 
-int LZ4_compress_limitedOutput(void *ctx, char* source, char* dest, int inputSize, int maxOutputSize)
+int LZ4_compress_fast_limitedOutput(void *ctx, char* source, char* dest, int inputSize, int maxOutputSize, int acceleration)
 {
     int result;
 
+    if (acceleration < 1) acceleration = 1;
+    if (acceleration > LZ4_ACCELERATION_MAX) acceleration = LZ4_ACCELERATION_MAX;
+
     bzero(ctx, HASHNBCELLS4 << 2);
     if (inputSize < (int)LZ4_64KLIMIT)
-        result = LZ4_compress_generic((void*)ctx, source, dest, inputSize, maxOutputSize, limited, byU16, noPrefix);
+        result = LZ4_compress_generic((void*)ctx, source, dest, inputSize, maxOutputSize, limited, byU16, noPrefix, acceleration);
     else
-        result = LZ4_compress_generic((void*)ctx, source, dest, inputSize, maxOutputSize, limited, (sizeof(void*)==8) ? byU32 : byPtr, noPrefix);
+        result = LZ4_compress_generic((void*)ctx, source, dest, inputSize, maxOutputSize, limited, (sizeof(void*)==8) ? byU32 : byPtr, noPrefix, acceleration);
 
     return result;
 }
 
+int LZ4_compress_limitedOutput(void *ctx, char* source, char* dest, int inputSize, int maxOutputSize)
+{
+    return LZ4_compress_fast_limitedOutput(ctx, source, dest, inputSize, maxOutputSize, 1);
+}
+
+
+//****************************
+// High compression functions
+//****************************
+// Produces the regular LZ4 block format, so the output is decoded by LZ4_decompress_safe().
+// Matches are searched through a hash chain over a 64KB window instead of a single hash slot.
+
+#define LZ4HC_HASH_LOG      15
+#define LZ4HC_HASHTABLESIZE (1 << LZ4HC_HASH_LOG)
+#define LZ4HC_MAXD          (1 << MAXD_LOG)
+#define LZ4HC_MAXD_MASK     (LZ4HC_MAXD - 1)
+
+typedef struct {
+    U32 hashTable[LZ4HC_HASHTABLESIZE];
+    U16 chainTable[LZ4HC_MAXD];
+    BYTE* base;
+    U32 nextToUpdate;
+} LZ4HC_Data_Structure;
+
+FORCE_INLINE U32 LZ4HC_hashPosition(BYTE* p) { return (A32(p) * 2654435761U) >> ((MINMATCH*8)-LZ4HC_HASH_LOG); }
+
+FORCE_INLINE void LZ4HC_insert(LZ4HC_Data_Structure* hc4, BYTE* ip)
+{
+    BYTE* const base = hc4->base;
+    U32 target = (U32)(ip - base);
+    U32 idx = hc4->nextToUpdate;
+
+    while (idx < target)
+    {
+        U32 h = LZ4HC_hashPosition(base + idx);
+        U32 delta = idx - hc4->hashTable[h];
+        if (delta > MAX_DISTANCE) delta = MAX_DISTANCE;
+        hc4->chainTable[idx & LZ4HC_MAXD_MASK] = (U16)delta;
+        hc4->hashTable[h] = idx;
+        idx++;
+    }
+    hc4->nextToUpdate = target;
+}
+
+FORCE_INLINE int LZ4HC_count(BYTE* ip, BYTE* ref, BYTE* const matchlimit)
+{
+    BYTE* const start = ip;
+
+    while (ip < matchlimit-(STEPSIZE-1))
+    {
+        size_t diff = AARCH(ref) ^ AARCH(ip);
+        if (!diff) { ip+=STEPSIZE; ref+=STEPSIZE; continue; }
+        ip += LZ4_NbCommonBytes(diff);
+        return (int)(ip - start);
+    }
+    if (LZ4_ARCH64) if ((ip<(matchlimit-3)) && (A32(ref) == A32(ip))) { ip+=4; ref+=4; }
+    if ((ip<(matchlimit-1)) && (A16(ref) == A16(ip))) { ip+=2; ref+=2; }
+    if ((ip<matchlimit) && (*ref == *ip)) ip++;
+    return (int)(ip - start);
+}
+
+FORCE_INLINE int LZ4HC_findLongestMatch(LZ4HC_Data_Structure* hc4, BYTE* ip, BYTE* const matchlimit, BYTE** matchpos, int maxAttempts)
+{
+    BYTE* const base = hc4->base;
+    U32 cur = (U32)(ip - base);
+    U32 ref;
+    U16 delta;
+    int ml = 0;
+
+    LZ4HC_insert(hc4, ip);
+    ref = hc4->hashTable[LZ4HC_hashPosition(ip)];
+
+    while ((ref < cur) && (cur - ref <= MAX_DISTANCE) && (maxAttempts-- > 0))
+    {
+        BYTE* r = base + ref;
+        if ((*(r+ml) == *(ip+ml)) && (A32(r) == A32(ip)))
+        {
+            int mlt = MINMATCH + LZ4HC_count(ip+MINMATCH, r+MINMATCH, matchlimit);
+            if (mlt > ml) { ml = mlt; *matchpos = r; }
+        }
+        delta = hc4->chainTable[ref & LZ4HC_MAXD_MASK];
+        if (!delta || delta > ref) break;
+        ref -= delta;
+    }
+
+    return ml;
+}
+
+FORCE_INLINE int LZ4HC_encodeSequence(BYTE** ip, BYTE** op, BYTE** anchor, int matchLength, BYTE* ref, BYTE* oend)
+{
+    int length;
+    BYTE* token;
+
+    // Encode Literal length
+    length = (int)(*ip - *anchor);
+    token = (*op)++;
+    if (*op + length + (2 + 1 + LASTLITERALS) + (length/255) > oend) return 1;    // Check output limit
+    if (length>=(int)RUN_MASK) { int len; *token=(RUN_MASK<<ML_BITS); len = length-RUN_MASK; for(; len > 254 ; len-=255) *(*op)++ = 255; *(*op)++ = (BYTE)len; }
+    else *token = (BYTE)(length<<ML_BITS);
+
+    // Copy Literals
+    memcpy(*op, *anchor, length);
+    *op += length;
+
+    // Encode Offset
+    LZ4_WRITE_LITTLEENDIAN_16(*op,(U16)(*ip-ref));
+
+    // Encode MatchLength
+    length = (int)(matchLength-MINMATCH);
+    if (*op + (1 + LASTLITERALS) + (length>>8) > oend) return 1;                 // Check output limit
+    if (length>=(int)ML_MASK) { *token+=ML_MASK; length-=ML_MASK; for(; length > 509 ; length-=510) { *(*op)++ = 255; *(*op)++ = 255; } if (length > 254) { length-=255; *(*op)++ = 255; } *(*op)++ = (BYTE)length; }
+    else *token += (BYTE)(length);
+
+    // Prepare next loop
+    *ip += matchLength;
+    *anchor = *ip;
+
+    return 0;
+}
+
+int LZ4_compressHC_limitedOutput(void *ctx, char* source, char* dest, int inputSize, int maxOutputSize, int level)
+{
+    LZ4HC_Data_Structure* hc4 = (LZ4HC_Data_Structure*)ctx;
+    BYTE* ip = (BYTE*) source;
+    BYTE* anchor = ip;
+    BYTE* const iend = ip + inputSize;
+    BYTE* const mflimit = iend - MFLIMIT;
+    BYTE* const matchlimit = (iend - LASTLITERALS);
+
+    BYTE* op = (BYTE*) dest;
+    BYTE* const oend = op + maxOutputSize;
+
+    int maxAttempts;
+    int ml, ml2;
+    BYTE* ref = NULL;
+    BYTE* ref2 = NULL;
+
+    if ((U32)inputSize > (U32)LZ4_MAX_INPUT_SIZE) return 0;
+    if (level < 1) level = 1;
+    if (level > LZ4HC_LEVEL_MAX) level = LZ4HC_LEVEL_MAX;
+    maxAttempts = 1 << (level - 1);
+
+    bzero(hc4->hashTable, sizeof(hc4->hashTable));
+    hc4->base = ip;
+    hc4->nextToUpdate = 0;
+
+    if (inputSize < LZ4_minLength) goto _last_literals;
+    ip++;
+
+    // Main Loop
+    while (ip < mflimit)
+    {
+        ml = LZ4HC_findLongestMatch(hc4, ip, matchlimit, &ref, maxAttempts);
+        if (!ml) { ip++; continue; }
+
+        // Lazy evaluation, prefer a longer match starting at the next byte
+        if (ip+1 < mflimit)
+        {
+            ml2 = LZ4HC_findLongestMatch(hc4, ip+1, matchlimit, &ref2, maxAttempts);
+            if (ml2 > ml + 1) { ip++; ml = ml2; ref = ref2; }
+        }
+
+        if (LZ4HC_encodeSequence(&ip, &op, &anchor, ml, ref, oend)) return 0;
+    }
+
+_last_literals:
+    // Encode Last Literals
+    {
+        int lastRun = (int)(iend - anchor);
+        if ((((char*)op - dest) + lastRun + 1 + ((lastRun+255-RUN_MASK)/255)) > (U32)maxOutputSize) return 0;  // Check output limit
+        if (lastRun>=(int)RUN_MASK) { *op++=(RUN_MASK<<ML_BITS); lastRun-=RUN_MASK; for(; lastRun > 254 ; lastRun-=255) *op++ = 255; *op++ = (BYTE) lastRun; }
+        else *op++ = (BYTE)(lastRun<<ML_BITS);
+        memcpy(op, anchor, iend - anchor);
+        op += iend-anchor;
+    }
+
+    // End
+    return (int) (((char*)op)-dest);
+}
+
 //****************************
 // Decompression functions
 //****************************
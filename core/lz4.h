@@ -105,6 +105,27 @@ LZ4_compress_limitedOutput() :
              or 0 if the compression fails
 */
 
+int LZ4_compress_fast_limitedOutput (void *ctx, char* source, char* dest, int inputSize, int maxOutputSize, int acceleration);
+int LZ4_compressHC_limitedOutput (void *ctx, char* source, char* dest, int inputSize, int maxOutputSize, int level);
+
+#define LZ4_ACCELERATION_MAX   16
+#define LZ4HC_LEVEL_DEFAULT    9
+#define LZ4HC_LEVEL_MAX        12
+#define LZ4HC_WRKMEM_SIZE      ((1 << 15) * 4 + (1 << 16) * 2 + 64)
+
+/*
+LZ4_compress_fast_limitedOutput() :
+    Same as LZ4_compress_limitedOutput(), but skips ahead faster on data without matches.
+    acceleration : 1 is the default speed, larger values trade compression ratio for speed
+                   (capped at LZ4_ACCELERATION_MAX)
+
+LZ4_compressHC_limitedOutput() :
+    Slower but higher ratio compression, searching a hash chain for the longest match.
+    The output is the regular LZ4 format and is decoded with LZ4_decompress_safe().
+    ctx   : must be at least LZ4HC_WRKMEM_SIZE bytes
+    level : 1 to LZ4HC_LEVEL_MAX, the search depth is 2^(level-1) candidates
+*/
+
 
 int LZ4_decompress_fast (char* source, char* dest, int outputSize);
 
@@ -24,6 +24,7 @@
 
 extern uma_t *map_lookup_cache;
 static struct map_lookup * __map_lookup_load(struct tape_partition *partition, uint64_t b_start, uint32_t bid);
+static inline int map_lookup_check_read(struct map_lookup *mlookup);
 
 static uint64_t
 map_lookup_bstart(struct map_lookup *map_lookup)
@@ -85,6 +86,186 @@ map_lookup_insert_after(struct map_lookup *mlookup, struct map_lookup *new)
 	TAILQ_INSERT_AFTER(&mlookup->partition->mlookup_list, mlookup, new, l_list);
 }
 
+static inline uint64_t
+map_lookup_block(struct map_lookup *mlookup)
+{
+	uint64_t block;
+
+	SET_BLOCK(block, mlookup->b_start, mlookup->bint->bid);
+	return block;
+}
+
+#define MLOOKUP_INDEX_MIN	64
+
+enum {
+	MLOOKUP_KEY_LIDS,
+	MLOOKUP_KEY_FIDS,
+	MLOOKUP_KEY_SIDS,
+};
+
+static inline uint64_t
+mlookup_index_key(struct mlookup_index_entry *ientry, int key)
+{
+	switch (key) {
+	case MLOOKUP_KEY_FIDS:
+		return ientry->f_ids_start;
+	case MLOOKUP_KEY_SIDS:
+		return ientry->s_ids_start;
+	default:
+		return ientry->l_ids_start;
+	}
+}
+
+static void
+map_lookup_index_append(struct mlookup_index *index, struct map_lookup *mlookup)
+{
+	struct mlookup_index_entry *entries, *ientry;
+	int size;
+
+	if (index->count == index->size) {
+		size = index->size ? (index->size << 1) : MLOOKUP_INDEX_MIN;
+		entries = malloc(size * sizeof(*entries), M_MLOOKUP, Q_NOWAIT);
+		if (unlikely(!entries))
+			return;
+		if (index->count)
+			memcpy(entries, index->entries, index->count * sizeof(*entries));
+		if (index->entries)
+			free(index->entries, M_MLOOKUP);
+		index->entries = entries;
+		index->size = size;
+	}
+
+	ientry = &index->entries[index->count];
+	ientry->l_ids_start = mlookup->l_ids_start;
+	ientry->f_ids_start = mlookup->f_ids_start;
+	ientry->s_ids_start = mlookup->s_ids_start;
+	ientry->block = map_lookup_block(mlookup);
+	index->count++;
+	index->complete = !mlookup->next_block;
+}
+
+/* Extends the index if mlookup follows the last indexed lookup in the chain */
+static void
+map_lookup_index_add(uint64_t prev_block, struct map_lookup *mlookup)
+{
+	struct tape_partition *partition = mlookup->partition;
+	struct mlookup_index *index = &partition->mlookup_index;
+
+	if (!index->count) {
+		if (mlookup == tape_partition_first_mlookup(partition))
+			map_lookup_index_append(index, mlookup);
+		return;
+	}
+
+	if (index->complete || index->entries[index->count - 1].block != prev_block)
+		return;
+
+	map_lookup_index_append(index, mlookup);
+}
+
+/* The chain after mlookup is being rewritten */
+static void
+map_lookup_index_truncate(struct map_lookup *mlookup)
+{
+	struct mlookup_index *index = &mlookup->partition->mlookup_index;
+
+	while (index->count && index->entries[index->count - 1].l_ids_start > mlookup->l_ids_start)
+		index->count--;
+	index->complete = 0;
+}
+
+static void
+map_lookup_index_free(struct tape_partition *partition)
+{
+	struct mlookup_index *index = &partition->mlookup_index;
+
+	if (index->entries)
+		free(index->entries, M_MLOOKUP);
+	bzero(index, sizeof(*index));
+}
+
+/* Returns the last index entry with key <= value, -1 if none */
+static int
+map_lookup_index_search(struct mlookup_index *index, int key, uint64_t value)
+{
+	int lo = 0, hi = index->count - 1, mid, found = -1;
+
+	while (lo <= hi) {
+		mid = (lo + hi) >> 1;
+		if (mlookup_index_key(&index->entries[mid], key) <= value) {
+			found = mid;
+			lo = mid + 1;
+		}
+		else
+			hi = mid - 1;
+	}
+	return found;
+}
+
+static struct map_lookup *
+map_lookup_index_get(struct tape_partition *partition, struct mlookup_index_entry *ientry)
+{
+	struct map_lookup *mlookup, *iter;
+	uint64_t b_start = BLOCK_BLOCKNR(ientry->block);
+	uint32_t bid = BLOCK_BID(ientry->block);
+
+	TAILQ_FOREACH(iter, &partition->mlookup_list, l_list) {
+		if (iter->b_start == b_start && iter->bint->bid == bid) {
+			if (map_lookup_check_read(iter) != 0)
+				return NULL;
+			return iter;
+		}
+		if (iter->l_ids_start > ientry->l_ids_start)
+			break;
+	}
+
+	mlookup = map_lookup_load(partition, b_start, bid);
+	if (unlikely(!mlookup))
+		return NULL;
+
+	if (unlikely(mlookup->l_ids_start != ientry->l_ids_start)) {
+		debug_warn("Stale lookup index entry at %llu bid %u l_ids_start %llu %llu\n", (unsigned long long)b_start, bid, (unsigned long long)mlookup->l_ids_start, (unsigned long long)ientry->l_ids_start);
+		map_lookup_free(mlookup);
+		return NULL;
+	}
+
+	if (iter)
+		map_lookup_insert_before(iter, mlookup);
+	else
+		map_lookup_insert(partition, mlookup);
+	return mlookup;
+}
+
+/*
+ * Returns the lookup from which to walk forward to the one holding value.
+ * Without a usable index this is the first lookup
+ */
+static struct map_lookup *
+map_lookup_index_start(struct tape_partition *partition, int key, uint64_t value)
+{
+	struct mlookup_index *index = &partition->mlookup_index;
+	struct map_lookup *first, *mlookup;
+	int i;
+
+	first = tape_partition_first_mlookup(partition);
+	if (!index->count) {
+		map_lookup_index_add(0, first);
+		return first;
+	}
+
+	i = map_lookup_index_search(index, key, value);
+	if (i <= 0)
+		return first;
+
+	mlookup = map_lookup_index_get(partition, &index->entries[i]);
+	if (unlikely(!mlookup)) {
+		index->count = 0;
+		map_lookup_index_add(0, first);
+		return first;
+	}
+	return mlookup;
+}
+
 void
 map_lookup_remove(struct tape_partition *partition, struct map_lookup *mlookup)
 {
@@ -182,6 +363,7 @@ map_lookup_flush_meta(struct map_lookup *mlookup)
 	if (!atomic_test_bit(META_IO_PENDING, &mlookup->flags))
 		return 0;
 
+	map_lookup_index_truncate(mlookup);
 	wait_on_chan(mlookup->map_lookup_wait, !atomic_test_bit(META_DATA_DIRTY, &mlookup->flags));
 	if (atomic_test_bit(META_DATA_ERROR, &mlookup->flags))
 		return -1;
@@ -216,6 +398,7 @@ void
 map_lookup_free_all(struct tape_partition *partition)
 {
 	__map_lookup_free_all(&partition->mlookup_list);
+	map_lookup_index_free(partition);
 }
 
 void
@@ -236,6 +419,9 @@ map_lookup_free_from_mlookup(struct tape_partition *partition, struct map_lookup
 void
 map_lookup_free(struct map_lookup *mlookup)
 {
+	if (mlookup->f_ids_prefix)
+		free(mlookup->f_ids_prefix, M_MLOOKUP);
+
 	if (mlookup->metadata)
 		vm_pg_free(mlookup->metadata);
 
@@ -264,6 +450,7 @@ map_lookup_read_header(struct map_lookup *mlookup)
 	mlookup->l_ids_start = raw_mlookup->l_ids_start;
 	mlookup->f_ids_start = raw_mlookup->f_ids_start;
 	mlookup->s_ids_start = raw_mlookup->s_ids_start;
+	mlookup->prefix_valid = 0;
 	map_lookup_resync_ids(mlookup);
 	atomic_set_bit(META_DATA_LOADED, &mlookup->flags);
 	return 0;
@@ -403,6 +590,7 @@ map_lookup_load_next(struct map_lookup *mlookup)
 		}
 
 		ret_lookup = next_lookup;
+		map_lookup_index_add(map_lookup_block(mlookup), ret_lookup);
 		return ret_lookup;
 	}
 
@@ -411,6 +599,7 @@ map_lookup_load_next(struct map_lookup *mlookup)
 		return NULL;
 
 	map_lookup_insert_after(mlookup, ret_lookup);
+	map_lookup_index_add(map_lookup_block(mlookup), ret_lookup);
 	return ret_lookup;
 }
 
@@ -418,10 +607,11 @@ map_lookup_load_next(struct map_lookup *mlookup)
 struct map_lookup *
 map_lookup_find_last(struct tape_partition *partition)
 {
-	uint64_t lookup_start;
+	struct mlookup_index *index = &partition->mlookup_index;
+	uint64_t lookup_start, prev_block;
 	uint32_t lookup_bid;
 	int retval;
-	struct map_lookup *mlookup;
+	struct map_lookup *mlookup, *last;
 
 	mlookup = tape_partition_last_mlookup(partition);
 	retval = map_lookup_check_read(mlookup);
@@ -432,11 +622,18 @@ map_lookup_find_last(struct tape_partition *partition)
 		return NULL;
 	}
 
+	if (index->count && index->entries[index->count - 1].l_ids_start > mlookup->l_ids_start) {
+		last = map_lookup_index_get(partition, &index->entries[index->count - 1]);
+		if (last)
+			mlookup = last;
+	}
+
 	lookup_start =  BLOCK_BLOCKNR(mlookup->next_block);
 	lookup_bid =  BLOCK_BID(mlookup->next_block);
 	if (!lookup_start)
 		return mlookup;
 
+	prev_block = map_lookup_block(mlookup);
 	while (lookup_start)
 	{
 		struct map_lookup *new;
@@ -446,10 +643,12 @@ map_lookup_find_last(struct tape_partition *partition)
 		if (!new)
 			return NULL;
 
+		map_lookup_index_add(prev_block, new);
 		if (new->next_block)
 		{
 			lookup_start =  BLOCK_BLOCKNR(new->next_block);
 			lookup_bid =  BLOCK_BID(new->next_block);
+			prev_block = map_lookup_block(new);
 			map_lookup_free(new);
 			continue;
 		}
@@ -554,6 +753,7 @@ map_lookup_write_eod(struct blk_map *map)
 
 	mlookup->next_block = 0;
 	mlookup->map_nrs = map->mlookup_entry_id + 1;
+	mlookup->prefix_valid = 0;
 	mlookup->pending_new_maps = 0;
 	atomic_set_bit(META_IO_PENDING, &mlookup->flags);
 	retval = map_lookup_flush_meta(mlookup);
@@ -574,6 +774,7 @@ map_lookup_entry_update(struct blk_map *map)
 	entry = map_lookup_get_entry(mlookup, map->mlookup_entry_id);
 	MENTRY_SET_LID_INFO(entry, map->l_ids_start, map->f_ids, map->s_ids);
 	SET_BLOCK(entry->block, map->b_start, map->bint->bid);
+	mlookup->prefix_valid = 0;
 	atomic_set_bit(META_IO_PENDING, &mlookup->flags);
 }
 
@@ -676,33 +877,65 @@ map_lookup_next_entry(struct map_lookup *mlookup, uint16_t mlookup_entry_id, str
 	}
 }
 
+/*
+ * Computes the number of filemarks and setmarks before each entry in the
+ * lookup. Entry i starts at f_ids_start + f_ids_prefix[i]
+ */
+static int
+map_lookup_prefix_build(struct map_lookup *mlookup)
+{
+	struct map_lookup_entry *entry;
+	int i;
+
+	if (mlookup->prefix_valid)
+		return 0;
+
+	if (!mlookup->f_ids_prefix) {
+		mlookup->f_ids_prefix = malloc(2 * (NR_MAP_DATA_ENTRIES + 1) * sizeof(uint16_t), M_MLOOKUP, Q_NOWAIT);
+		if (unlikely(!mlookup->f_ids_prefix))
+			return -1;
+		mlookup->s_ids_prefix = mlookup->f_ids_prefix + (NR_MAP_DATA_ENTRIES + 1);
+	}
+
+	mlookup->f_ids_prefix[0] = mlookup->s_ids_prefix[0] = 0;
+	entry = map_lookup_get_entry(mlookup, 0);
+	for (i = 0; i < mlookup->map_nrs; i++, entry++) {
+		mlookup->f_ids_prefix[i + 1] = mlookup->f_ids_prefix[i] + MENTRY_FILEMARKS(entry);
+		mlookup->s_ids_prefix[i + 1] = mlookup->s_ids_prefix[i] + MENTRY_SETMARKS(entry);
+	}
+	mlookup->prefix_valid = 1;
+	return 0;
+}
+
 static struct map_lookup_entry *
 map_lookup_locate_entry(struct map_lookup *mlookup, uint64_t block_address, uint16_t *ret_entry_id)
 {
-	struct map_lookup_entry *entry, *prev = NULL;
-	int i;
+	struct map_lookup_entry *entry;
+	int lo = 0, hi = mlookup->map_nrs, mid;
 
 	if (!mlookup->map_nrs)
 		return NULL;
 
+	/* Last entry with a starting id not beyond block_address */
 	entry  = map_lookup_get_entry(mlookup, 0);
-	for (i = 0; i < mlookup->map_nrs; i++, entry++) {
-		if (MENTRY_LID_START(entry) > block_address) {
-			debug_check(!prev);
-			*ret_entry_id = (i - 1);
-			return prev;
-		}
-		prev = entry;
+	while (lo < hi) {
+		mid = (lo + hi) >> 1;
+		mlookup->partition->locate_visited++;
+		if (MENTRY_LID_START((entry + mid)) > block_address)
+			hi = mid;
+		else
+			lo = mid + 1;
 	}
-	*ret_entry_id = (i - 1);
-	return prev;
+	debug_check(!lo);
+	*ret_entry_id = (lo - 1);
+	return lo ? (entry + (lo - 1)) : NULL;
 }
 
 static struct map_lookup_entry *
 map_lookup_locate_file_entry(struct map_lookup *mlookup, uint64_t block_address, uint16_t *ret_entry_id)
 {
 	struct map_lookup_entry *entry, *prev = NULL;
-	int i;
+	int i, lo, hi, mid;
 	uint8_t f_ids;
 	uint64_t f_ids_start = mlookup->f_ids_start;
 
@@ -710,7 +943,24 @@ map_lookup_locate_file_entry(struct map_lookup *mlookup, uint64_t block_address,
 		return NULL;
 
 	entry  = map_lookup_get_entry(mlookup, 0);
+	if (map_lookup_prefix_build(mlookup) == 0) {
+		/* First entry whose filemarks reach past block_address, else the last */
+		lo = 1;
+		hi = mlookup->map_nrs;
+		while (lo < hi) {
+			mid = (lo + hi) >> 1;
+			mlookup->partition->locate_visited++;
+			if ((f_ids_start + mlookup->f_ids_prefix[mid]) > block_address)
+				hi = mid;
+			else
+				lo = mid + 1;
+		}
+		*ret_entry_id = (lo - 1);
+		return (entry + (lo - 1));
+	}
+
 	for (i = 0; i < mlookup->map_nrs; i++, entry++) {
+		mlookup->partition->locate_visited++;
 		f_ids = MENTRY_FILEMARKS(entry);
 		if ((f_ids_start + f_ids) > block_address) {
 			*ret_entry_id = i;
@@ -730,8 +980,7 @@ map_lookup_locate(struct tape_partition *partition, uint64_t block_address, stru
 	struct map_lookup *mlookup;
 	struct map_lookup *next;
 
-	/* We need to squeeze in maps. But for later */
-	mlookup = tape_partition_first_mlookup(partition);
+	mlookup = map_lookup_index_start(partition, MLOOKUP_KEY_LIDS, block_address);
 
 	while (mlookup) {
 		if (!mlookup->next_block)
@@ -766,8 +1015,7 @@ map_lookup_locate_file(struct tape_partition *partition, uint64_t block_address,
 	struct map_lookup *mlookup;
 	struct map_lookup *next;
 
-	/* We need to squeeze in maps. But for later */
-	mlookup = tape_partition_first_mlookup(partition);
+	mlookup = map_lookup_index_start(partition, MLOOKUP_KEY_FIDS, block_address);
 
 	while (mlookup) {
 		if (!mlookup->next_block)
@@ -795,6 +1043,72 @@ map_lookup_locate_file(struct tape_partition *partition, uint64_t block_address,
 	return entry;
 }
 
+/*
+ * Skip whole lookups that a forward space would walk through entry by entry,
+ * which are those without marks that stop the space and with fewer than
+ * count objects of the kind being spaced over
+ */
+static void
+map_lookup_index_space_forward(struct tape_partition *partition, uint8_t code, struct map_lookup **ret_lookup, uint16_t *ret_entry_id, int *count)
+{
+	struct mlookup_index *index = &partition->mlookup_index;
+	struct mlookup_index_entry *ientry;
+	struct map_lookup *mlookup = *ret_lookup, *next;
+	struct map_lookup_entry *entry;
+	uint64_t lids, fids, sids;
+	int i, todo = *count;
+
+	if (todo <= 0 || index->count < 2)
+		return;
+
+	entry = map_lookup_get_entry(mlookup, *ret_entry_id);
+	lids = MENTRY_LID_START(entry);
+	map_lookup_get_ids_start(mlookup, *ret_entry_id, &fids, &sids);
+
+	switch (code) {
+	case SPACE_CODE_BLOCKS:
+		i = map_lookup_index_search(index, MLOOKUP_KEY_LIDS, lids + todo - 1);
+		i = min_t(int, i, map_lookup_index_search(index, MLOOKUP_KEY_FIDS, fids));
+		i = min_t(int, i, map_lookup_index_search(index, MLOOKUP_KEY_SIDS, sids));
+		break;
+	case SPACE_CODE_FILEMARKS:
+		i = map_lookup_index_search(index, MLOOKUP_KEY_FIDS, fids + todo - 1);
+		i = min_t(int, i, map_lookup_index_search(index, MLOOKUP_KEY_SIDS, sids));
+		break;
+	case SPACE_CODE_SETMARKS:
+		i = map_lookup_index_search(index, MLOOKUP_KEY_SIDS, sids + todo - 1);
+		break;
+	default:
+		return;
+	}
+
+	if (i < 0)
+		return;
+
+	ientry = &index->entries[i];
+	if (ientry->l_ids_start <= mlookup->l_ids_start)
+		return;
+
+	next = map_lookup_index_get(partition, ientry);
+	if (!next)
+		return;
+
+	switch (code) {
+	case SPACE_CODE_BLOCKS:
+		todo -= (ientry->l_ids_start - lids);
+		break;
+	case SPACE_CODE_FILEMARKS:
+		todo -= (ientry->f_ids_start - fids);
+		break;
+	case SPACE_CODE_SETMARKS:
+		todo -= (ientry->s_ids_start - sids);
+		break;
+	}
+	*ret_lookup = next;
+	*ret_entry_id = 0;
+	*count = todo;
+}
+
 struct map_lookup_entry *
 map_lookup_space_forward(struct tape_partition *partition, uint8_t code, int *count, int *error, struct map_lookup **ret_lookup, uint16_t *ret_entry_id)
 {
@@ -818,6 +1132,7 @@ map_lookup_space_forward(struct tape_partition *partition, uint8_t code, int *co
 
 	mlookup = next_mlookup;
 	entry_id = next_entry_id;
+	map_lookup_index_space_forward(partition, code, &mlookup, &entry_id, &todo);
 	while (entry) {
 		entry = map_lookup_get_entry(mlookup, entry_id);
 		if (!todo)
@@ -935,6 +1250,12 @@ map_lookup_get_ids_start(struct map_lookup *mlookup, uint16_t entry_id, uint64_t
 	uint64_t s_ids_start = mlookup->s_ids_start;
 	int i;
 
+	if (entry_id <= mlookup->map_nrs && map_lookup_prefix_build(mlookup) == 0) {
+		*ret_f_ids_start = f_ids_start + mlookup->f_ids_prefix[entry_id];
+		*ret_s_ids_start = s_ids_start + mlookup->s_ids_prefix[entry_id];
+		return;
+	}
+
 	entry = map_lookup_get_entry(mlookup, 0);
 	for (i = 0; i < entry_id; i++, entry++) {
 		f_ids_start += MENTRY_FILEMARKS(entry);
@@ -442,25 +442,23 @@ mchanger_insert_export_tape(struct mchanger *mchanger, struct tape *tape)
 }
 
 int
-mchanger_load_vcartridge(struct mchanger *mchanger, struct vcartridge *vinfo)
+mchanger_load_vcartridge(struct mchanger *mchanger, struct vcartridge *vinfo, struct tape *tape)
 {
-	struct tape *tape;
 	struct raw_tape *raw_tape;
 	struct mchanger_element *element = NULL;
 
+	mchanger_lock(mchanger);
 	element = get_free_element(mchanger, vinfo->elem_address, vinfo->type, 1);
 	if (!element) {
+		mchanger_unlock(mchanger);
 		debug_warn("Cannot get a free element for tape\n");
 		return -1;
 	}	
-	
-	tape = tape_load((struct tdevice *)mchanger, vinfo);
-	if (!tape)
-		return -1;
 
 	raw_tape = (struct raw_tape *)(vm_pg_address(tape->metadata));
 	if (raw_tape->vstatus & MEDIA_STATUS_EXPORTED) {
 		mchanger_insert_export_tape(mchanger, tape);
+		mchanger_unlock(mchanger);
 		return 0;
 	}
 
@@ -475,6 +473,7 @@ mchanger_load_vcartridge(struct mchanger *mchanger, struct vcartridge *vinfo)
 
 	update_mchanger_element_flags(element, get_mchanger_element_flags(element) | ELEMENT_DESCRIPTOR_ACCESS_MASK | ELEMENT_DESCRIPTOR_FULL_MASK);
 	update_mchanger_element_pvoltag(element);
+	mchanger_unlock(mchanger);
 	return 0;
 }
 
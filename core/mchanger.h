@@ -233,7 +233,7 @@ int mchanger_get_info(struct mchanger *mchanger, struct vdeviceinfo *deviceinfo)
 
 /* Tape vcartridge opterations */
 struct tdrive * mchanger_add_tdrive(struct mchanger *mchanger, struct vdeviceinfo *deviceinfo);
-int mchanger_load_vcartridge(struct mchanger *mchanger, struct vcartridge *vinfo);
+int mchanger_load_vcartridge(struct mchanger *mchanger, struct vcartridge *vinfo, struct tape *tape);
 int mchanger_new_vcartridge(struct mchanger *mchanger, struct vcartridge *vinfo);
 int mchanger_check_mnt_busy(struct mchanger *mchanger, struct tape *tape);
 
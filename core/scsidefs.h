@@ -245,6 +245,10 @@ struct log_parameter8 {
 #define SYNCHRONIZE_CACHE_16		0x91
 #endif
 
+#ifndef VERIFY_6
+#define VERIFY_6			0x13
+#endif
+
 #ifndef VERIFY_12 
 #define VERIFY_12			0xaf
 #endif
@@ -31,6 +31,9 @@
 #define WRITE_ERROR_ASC				0x0C
 #define WRITE_ERROR_ASCQ			0x00
 
+#define UNRECOVERED_READ_ERROR_ASC		0x11
+#define UNRECOVERED_READ_ERROR_ASCQ		0x00
+
 #define FILEMARK_DETECTED_ASC			0x00
 #define FILEMARK_DETECTED_ASCQ			0x01
 
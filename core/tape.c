@@ -70,9 +70,71 @@ tape_write_metadata(struct tape *tape)
 	return __tape_write_metadata(tape);
 }
 
+int
+tape_get_saved_usage(struct tape *tape, int partition_id, uint64_t *used)
+{
+	struct raw_tape *raw_tape = (struct raw_tape *)(vm_pg_address(tape->metadata));
+
+	if (!(raw_tape->flags & TAPE_FLAGS_USAGE))
+		return -1;
+
+	if (raw_tape->partition_used[partition_id] & ~BINT_UNIT_MASK) {
+		debug_warn("Tape %s invalid saved usage %llu for partition %d\n", tape->label, (unsigned long long)raw_tape->partition_used[partition_id], partition_id);
+		return -1;
+	}
+
+	*used = raw_tape->partition_used[partition_id];
+	return 0;
+}
+
+/*
+ * Called before the tmaps of a partition are modified. Once the flag is
+ * cleared on disk a crash leaves the tape to be scanned on the next load
+ */
+int
+tape_invalidate_usage(struct tape *tape)
+{
+	struct raw_tape *raw_tape = (struct raw_tape *)(vm_pg_address(tape->metadata));
+	int retval;
+
+	if (!(raw_tape->flags & TAPE_FLAGS_USAGE))
+		return 0;
+
+	raw_tape->flags &= ~TAPE_FLAGS_USAGE;
+	retval = tape_write_metadata(tape);
+	if (unlikely(retval != 0)) {
+		debug_warn("Failed to write tape metadata\n");
+		raw_tape->flags |= TAPE_FLAGS_USAGE;
+		return -1;
+	}
+	tape->flags = raw_tape->flags;
+	return 0;
+}
+
+static void
+tape_save_usage(struct tape *tape)
+{
+	struct raw_tape *raw_tape = (struct raw_tape *)(vm_pg_address(tape->metadata));
+	struct tape_partition *partition;
+
+	if (raw_tape->flags & TAPE_FLAGS_USAGE)
+		return;
+
+	bzero(raw_tape->partition_used, sizeof(raw_tape->partition_used));
+	SLIST_FOREACH(partition, &tape->partition_list, p_list) {
+		raw_tape->partition_used[partition->partition_id] = partition->used;
+	}
+	raw_tape->flags |= TAPE_FLAGS_USAGE;
+	if (tape_write_metadata(tape) != 0)
+		debug_warn("Failed to save usage for tape %s\n", tape->label);
+}
+
 void
 tape_free(struct tape *tape, int free_alloc)
 {
+	if (!free_alloc && tape->save_usage)
+		tape_save_usage(tape);
+
 	tape_free_partitions(tape, free_alloc);
 
 	if (tape->metadata) {
@@ -288,6 +350,7 @@ tape_new(struct tdevice *tdevice, struct vcartridge *vinfo)
 		tape_free(tape, 1);
 		return NULL;
 	}
+	tape->save_usage = 1;
 	return tape;
 }
 
@@ -340,6 +403,7 @@ tape_load(struct tdevice *tdevice, struct vcartridge *vinfo)
 		return NULL;
 	}
 
+	tape->save_usage = 1;
 	return tape;
 }
 
@@ -543,6 +607,12 @@ tape_cmd_read_position(struct tape *tape, struct qsio_scsiio *ctio, uint8_t serv
 	tape_partition_read_position(tape->cur_partition, ctio, service_action);
 }
 
+void
+tape_cmd_position_info(struct tape *tape, struct tape_position_info *info)
+{
+	tape_partition_position_info(tape->cur_partition, info);
+}
+
 struct tape_partition *
 tape_get_partition(struct tape *tape, uint8_t pnum)
 {
@@ -574,7 +644,7 @@ tape_set_partition(struct tape *tape, uint8_t pnum)
 }
 
 int
-tape_cmd_locate(struct tape *tape, uint64_t block_address, uint8_t cp, uint8_t pnum, uint8_t locate_type)
+tape_cmd_locate(struct tape *tape, uint64_t block_address, uint8_t cp, uint8_t pnum, uint8_t locate_type, uint32_t *entries_visited)
 {
 	int retval;
 
@@ -583,7 +653,9 @@ tape_cmd_locate(struct tape *tape, uint64_t block_address, uint8_t cp, uint8_t p
 		if (unlikely(retval != 0))
 			return retval;
 	}
-	return tape_partition_locate(tape->cur_partition, block_address, locate_type);
+	retval = tape_partition_locate(tape->cur_partition, block_address, locate_type);
+	*entries_visited = tape->cur_partition->locate_visited;
+	return retval;
 }
 
 int
@@ -599,9 +671,9 @@ tape_cmd_write_filemarks(struct tape *tape, uint8_t wmsk, uint32_t transfer_leng
 }
 
 int
-tape_cmd_write(struct tape *tape, struct qsio_scsiio *ctio, uint32_t block_size, uint32_t num_blocks, uint32_t *blocks_written, uint8_t compression_enabled, uint32_t *compressed_size)
+tape_cmd_write(struct tape *tape, struct qsio_scsiio *ctio, uint32_t block_size, uint32_t num_blocks, uint32_t *blocks_written, uint16_t comp_type, uint32_t *compressed_size, uint32_t *sample_size)
 {
-	return tape_partition_write(tape->cur_partition, ctio, block_size, num_blocks, blocks_written, compression_enabled, compressed_size);
+	return tape_partition_write(tape->cur_partition, ctio, block_size, num_blocks, blocks_written, comp_type, compressed_size, sample_size);
 }
 
 int
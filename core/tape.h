@@ -23,6 +23,8 @@
 #include "bdev.h"
 #include "../common/commondefs.h"
 
+struct tape_position_info;
+
 enum {
 	TAPE_FLAGS_DISABLE = 0x02,
 };
@@ -49,6 +51,8 @@ struct tape {
 	int ddenabled;
 	int make; /* Make for this tape */
 	int worm; /* Worm enabled */
+	int data_csum; /* Checksum data blocks, set from the loading drive */
+	int save_usage; /* Write back partition usage on free */
 	char label[40];
 	struct tape_partition *cur_partition;
 	SLIST_HEAD(, tape_partition) partition_list;
@@ -58,6 +62,8 @@ struct tape {
 struct tape *tape_new(struct tdevice *tdevice, struct vcartridge *vinfo);
 struct tape *tape_load(struct tdevice *tdevice, struct vcartridge *vinfo);
 void tape_free(struct tape *tape, int free_alloc);
+int tape_get_saved_usage(struct tape *tape, int partition_id, uint64_t *used);
+int tape_invalidate_usage(struct tape *tape);
 int tape_read_entry_position(struct tape *tape, struct tl_entryinfo *entryinfo);
 int tape_flush_buffers(struct tape *tape);
 
@@ -69,9 +75,10 @@ int tape_cmd_load(struct tape *tape, uint8_t eot);
 int tape_cmd_unload(struct tape *tape, int rewind);
 int tape_cmd_rewind(struct tape *tape, int bot);
 void tape_cmd_read_position(struct tape *tape, struct qsio_scsiio *ctio, uint8_t service_action);
-int tape_cmd_locate(struct tape *tape, uint64_t block_address, uint8_t cp, uint8_t pnum, uint8_t locate_type);
+void tape_cmd_position_info(struct tape *tape, struct tape_position_info *info);
+int tape_cmd_locate(struct tape *tape, uint64_t block_address, uint8_t cp, uint8_t pnum, uint8_t locate_type, uint32_t *entries_visited);
 int tape_cmd_write_filemarks(struct tape *tape, uint8_t wmsk, uint32_t transfer_length);
-int tape_cmd_write(struct tape *tape, struct qsio_scsiio *ctio, uint32_t block_size, uint32_t num_blocks, uint32_t *blocks_written, uint8_t compression_enabled, uint32_t *compressed_size);
+int tape_cmd_write(struct tape *tape, struct qsio_scsiio *ctio, uint32_t block_size, uint32_t num_blocks, uint32_t *blocks_written, uint16_t comp_type, uint32_t *compressed_size, uint32_t *sample_size);
 int tape_cmd_read(struct tape *tape, struct qsio_scsiio *ctio, uint32_t block_size, uint32_t num_blocks, uint8_t fixed,  uint32_t *blocks_read, uint32_t *ili_block_size, uint32_t *compressed_size);
 int tape_cmd_space(struct tape *tape, uint8_t code, int *count);
 int tape_at_bop(struct tape *tape);
@@ -340,23 +340,37 @@ tmap_list_free_all(struct tmap_list *tmap_list)
 
 	while ((tmap = TAILQ_FIRST(tmap_list)) != NULL) {
 		TAILQ_REMOVE(tmap_list, tmap, t_list);
-		free(tmap, M_TMAPS);
+		tmap_free(tmap);
 	}
 }
 
-struct tsegment_map *
-tmap_locate(struct tape_partition *partition, int type, uint16_t tmap_id)
+static struct tsegment_map *
+tmap_find(struct tape_partition *partition, int type, uint16_t tmap_id)
 {
 	struct tmap_list *tmap_list;
 	struct tsegment_map *tmap;
-	int retval;
-	uint64_t b_start;
 
 	tmap_list = tmap_head(partition, type); 
 	TAILQ_FOREACH(tmap, tmap_list, t_list) {
 		if (tmap->tmap_id == tmap_id)
 			return tmap; 
 	}
+	return NULL;
+}
+
+struct tsegment_map *
+tmap_locate(struct tape_partition *partition, int type, uint16_t tmap_id)
+{
+	struct tmap_list *tmap_list;
+	struct tsegment_map *tmap;
+	int retval;
+	uint64_t b_start;
+
+	tmap = tmap_find(partition, type, tmap_id);
+	if (tmap)
+		return tmap;
+
+	tmap_list = tmap_head(partition, type); 
 
 	b_start = tmap_bstart(partition, type, tmap_id);
 	tmap = zalloc(sizeof (*tmap), M_TMAPS, Q_WAITOK);
@@ -460,6 +474,13 @@ tape_partition_alloc_segment(struct tape_partition *partition, int type)
 			}
 		}
 
+		retval = tape_invalidate_usage(partition->tape);
+		if (unlikely(retval != 0)) {
+			if (!skip_alloc)
+				bdev_release_block(bint, b_start);
+			return -1;
+		}
+
 		SET_BLOCK(entry->block, b_start, bint->bid);
 		retval = tmap_write(partition, tmap);
 		if (unlikely(retval != 0)) {
@@ -610,7 +631,7 @@ tape_partition_at_bop(struct tape_partition *partition)
 }
 
 static void 
-tape_partition_read_position_long(struct tape_partition *partition, struct qsio_scsiio *ctio, struct tape_position_info *info)
+tape_position_format_long(struct qsio_scsiio *ctio, struct tape_position_info *info)
 {
 	struct read_position_long *readpos = (struct read_position_long *)ctio->data_ptr;
 
@@ -619,14 +640,14 @@ tape_partition_read_position_long(struct tape_partition *partition, struct qsio_
 		readpos->pos_info |= 0x80;
 	else if (info->eop)
 		readpos->pos_info |= 0x40;
-	readpos->partition_number = htobe32(partition->partition_id);
+	readpos->partition_number = htobe32(info->partition_id);
 	readpos->block_number = htobe64(info->block_number);
 	readpos->file_number = htobe64(info->file_number);
 	readpos->set_number = htobe64(info->set_number);
 }
 
 static void
-tape_partition_read_position_extended(struct tape_partition *partition, struct qsio_scsiio *ctio, struct tape_position_info *info)
+tape_position_format_extended(struct qsio_scsiio *ctio, struct tape_position_info *info)
 {
 	struct read_position_extended readpos;
 
@@ -635,7 +656,7 @@ tape_partition_read_position_extended(struct tape_partition *partition, struct q
 		readpos.pos_info |= 0x80;
 	else if (info->eop)
 		readpos.pos_info |= 0x40;
-	readpos.partition_number = partition->partition_id;
+	readpos.partition_number = info->partition_id;
 	readpos.additional_length = htobe16(0x1C);
 	readpos.blocks_in_buffer[0] = info->blocks_in_buffer & 0xFF;
 	readpos.blocks_in_buffer[1] = (info->blocks_in_buffer >> 8) & 0xFF;
@@ -647,7 +668,7 @@ tape_partition_read_position_extended(struct tape_partition *partition, struct q
 }
 
 static void 
-tape_partition_read_position_short(struct tape_partition *partition, struct qsio_scsiio *ctio, struct tape_position_info *info)
+tape_position_format_short(struct qsio_scsiio *ctio, struct tape_position_info *info)
 {
 	struct read_position_short *readpos = (struct read_position_short *)ctio->data_ptr;
 
@@ -657,7 +678,7 @@ tape_partition_read_position_short(struct tape_partition *partition, struct qsio
 	else if (info->eop)
 		readpos->pos_info |= 0x40;
 
-	readpos->partition_number = partition->partition_id;
+	readpos->partition_number = info->partition_id;
 	readpos->first_block_location = htobe32(info->block_number);
 	readpos->last_block_location = htobe32(info->block_number - info->blocks_in_buffer);
 	readpos->blocks_in_buffer[0] = info->blocks_in_buffer & 0xFF;
@@ -667,31 +688,43 @@ tape_partition_read_position_short(struct tape_partition *partition, struct qsio
 }
 
 void
-tape_partition_read_position(struct tape_partition *partition, struct qsio_scsiio *ctio, uint8_t service_action)
+tape_partition_position_info(struct tape_partition *partition, struct tape_position_info *info)
 {
-	struct tape_position_info info;
-
-	tape_partition_print_cur_position(partition, "At READ POSITION");
-	bzero(&info, sizeof(info));
-	blk_map_read_position(partition, &info);
-	if (info.eop) {
+	bzero(info, sizeof(*info));
+	blk_map_read_position(partition, info);
+	if (info->eop) {
 		if ((partition->used + EW_SIZE) <= partition->size)
-			info.eop = 0;
+			info->eop = 0;
 	}
+	info->partition_id = partition->partition_id;
+}
 
+void
+tape_position_format(struct qsio_scsiio *ctio, uint8_t service_action, struct tape_position_info *info)
+{
 	switch (service_action) {
 	case READ_POSITION_SHORT:
-		tape_partition_read_position_short(partition, ctio, &info);
+		tape_position_format_short(ctio, info);
 		break;
 	case READ_POSITION_LONG:
-		tape_partition_read_position_long(partition, ctio, &info);
+		tape_position_format_long(ctio, info);
 		break;
 	case READ_POSITION_EXTENDED:
-		tape_partition_read_position_extended(partition, ctio, &info);
+		tape_position_format_extended(ctio, info);
 		break;
 	}
 }
 
+void
+tape_partition_read_position(struct tape_partition *partition, struct qsio_scsiio *ctio, uint8_t service_action)
+{
+	struct tape_position_info info;
+
+	tape_partition_print_cur_position(partition, "At READ POSITION");
+	tape_partition_position_info(partition, &info);
+	tape_position_format(ctio, service_action, &info);
+}
+
 int
 tape_partition_write_filemarks(struct tape_partition *partition, uint8_t wmsk, uint32_t transfer_length)
 {
@@ -901,13 +934,13 @@ tape_partition_lookup_segments(struct tape_partition *partition)
 }
 
 int
-tape_partition_write(struct tape_partition *partition, struct qsio_scsiio *ctio, uint32_t block_size, uint32_t num_blocks, uint32_t *blocks_written, uint8_t compression_enabled, uint32_t *compressed_size)
+tape_partition_write(struct tape_partition *partition, struct qsio_scsiio *ctio, uint32_t block_size, uint32_t num_blocks, uint32_t *blocks_written, uint16_t comp_type, uint32_t *compressed_size, uint32_t *sample_size)
 {
 	int retval;
 
 	tape_partition_pre_write(partition);
-	retval = blk_map_write(partition, ctio, block_size, num_blocks, blocks_written, compression_enabled, compressed_size);
-	if (retval == 0)
+	retval = blk_map_write(partition, ctio, block_size, num_blocks, blocks_written, comp_type, compressed_size, sample_size);
+	if (retval == 0 || *blocks_written)
 		tape_partition_post_write(partition);
 	return retval;
 }
@@ -1001,6 +1034,7 @@ tape_partition_locate(struct tape_partition *partition, uint64_t block_address,
 
 	tape_partition_print_cur_position(partition, "Before LOCATE");
 	tape_partition_pre_space(partition);
+	partition->locate_visited = 0;
 	if (TAILQ_EMPTY(&partition->mlookup_list)) {
 		tape_partition_print_cur_position(partition, "After LOCATE");
 		if (!block_address)
@@ -1217,6 +1251,10 @@ tmap_eod_segments(struct tape_partition *partition, struct tsegment_map *tmap, i
 	pagestruct_t *page;
 
 	debug_info("partition used before %llu\n", (unsigned long long)partition->used);
+	retval = tape_invalidate_usage(partition->tape);
+	if (unlikely(retval != 0))
+		return -1;
+
 	page = vm_pg_alloc(0);
 	if (unlikely(!page))
 		return -1;
@@ -1250,7 +1288,7 @@ tmap_eod_segments(struct tape_partition *partition, struct tsegment_map *tmap, i
 			debug_warn("Cannot find bint at id %u\n", BLOCK_BID(entry->block));
 			continue;
 		}
-		bdev_release_block(bint, BLOCK_BLOCKNR(entry->block));
+		bdev_release_block_batch(bint, BLOCK_BLOCKNR(entry->block));
 		entry->block = 0;
 	}
 	debug_check((done * BINT_UNIT_SIZE) > partition->used);
@@ -1260,7 +1298,7 @@ tmap_eod_segments(struct tape_partition *partition, struct tsegment_map *tmap, i
 }
 
 static int 
-eod_segments(struct tape_partition *partition, int type, int segment_id, int inclusive)
+__eod_segments(struct tape_partition *partition, int type, int segment_id, int inclusive)
 {
 	int tmap_id, tmap_entry_id;
 	int max_tmaps;
@@ -1294,6 +1332,20 @@ eod_segments(struct tape_partition *partition, int type, int segment_id, int inc
 	return 0;
 }
 
+/*
+ * Segments are released in a batch, the bitmaps of the disks they belong
+ * to are written out once at the end instead of once per segment
+ */
+static int
+eod_segments(struct tape_partition *partition, int type, int segment_id, int inclusive)
+{
+	int retval;
+
+	retval = __eod_segments(partition, type, segment_id, inclusive);
+	bdev_release_flush();
+	return retval;
+}
+
 static int
 tape_partition_eod_cur_segment(struct tape_partition *partition)
 {
@@ -1770,15 +1822,89 @@ tmap_get_usage(struct tsegment_map *tmap)
 	return used;
 }
 
+#define TMAPS_READ_BATCH	32
+
+/* Read in tmaps [start, start + count) with a single tcache */
+static int
+tmaps_read_batch(struct tape_partition *partition, int type, int start, int count)
+{
+	struct tmap_list *tmap_list, read_list;
+	struct tsegment_map *tmap;
+	struct tcache *tcache;
+	int i, retval;
+
+	TAILQ_INIT(&read_list);
+	tcache = tcache_alloc(count);
+	for (i = start; i < (start + count); i++) {
+		if (tmap_find(partition, type, i))
+			continue;
+
+		tmap = zalloc(sizeof (*tmap), M_TMAPS, Q_WAITOK);
+		if (unlikely(!tmap))
+			goto err;
+
+		tmap->metadata = vm_pg_alloc(0);
+		if (unlikely(!tmap->metadata)) {
+			free(tmap, M_TMAPS);
+			goto err;
+		}
+		tmap->b_start = tmap_bstart(partition, type, i);
+		tmap->tmap_id = i;
+		TAILQ_INSERT_TAIL(&read_list, tmap, t_list);
+
+		retval = tcache_add_page(tcache, tmap->metadata, tmap->b_start, partition->tmaps_bint, LBA_SIZE, QS_IO_READ);
+		if (unlikely(retval != 0))
+			goto err;
+	}
+
+	if (TAILQ_EMPTY(&read_list)) {
+		tcache_put(tcache);
+		return 0;
+	}
+
+	tcache_entry_rw(tcache, QS_IO_READ);
+	wait_for_done(tcache->completion);
+	if (atomic_test_bit(TCACHE_IO_ERROR, &tcache->flags)) {
+		debug_warn("Reading tmaps from %d failed\n", start);
+		goto err;
+	}
+	tcache_put(tcache);
+
+	tmap_list = tmap_head(partition, type);
+	while ((tmap = TAILQ_FIRST(&read_list)) != NULL) {
+		TAILQ_REMOVE(&read_list, tmap, t_list);
+		retval = tmap_validate(tmap);
+		if (unlikely(retval != 0)) {
+			tmap_free(tmap);
+			tmap_list_free_all(&read_list);
+			return -1;
+		}
+		TAILQ_INSERT_TAIL(tmap_list, tmap, t_list);
+	}
+	return 0;
+err:
+	tcache_put(tcache);
+	tmap_list_free_all(&read_list);
+	return -1;
+}
+
 static uint64_t 
 tmaps_get_usage(struct tape_partition *partition, int type, int *error)
 {
 	struct tsegment_map *tmap;
-	int max_tmaps, i;
+	int max_tmaps, i, retval;
 	uint64_t used, total_used = 0;
 
 	max_tmaps = tape_partition_get_max_tmaps(partition, type);
 	for (i = 0; i < max_tmaps; i++) {
+		if (!(i % TMAPS_READ_BATCH)) {
+			retval = tmaps_read_batch(partition, type, i, min_t(int, TMAPS_READ_BATCH, max_tmaps - i));
+			if (unlikely(retval != 0)) {
+				*error = -1;
+				break;
+			}
+		}
+
 		tmap = tmap_locate(partition, type, i);
 		if (unlikely(!tmap)) {
 			*error = -1;
@@ -1867,20 +1993,23 @@ tape_partition_load(struct tape *tape, int partition_id)
 		return NULL;
 	}
 
-	error = 0;
-	used = tmaps_get_usage(partition, SEGMENT_TYPE_META, &error);
-	if (unlikely(error != 0)) {
-		tape_partition_free(partition, 0);
-		return NULL;
-	}
-	total_used += used;
+	retval = tape_get_saved_usage(tape, partition_id, &total_used);
+	if (retval != 0) {
+		error = 0;
+		used = tmaps_get_usage(partition, SEGMENT_TYPE_META, &error);
+		if (unlikely(error != 0)) {
+			tape_partition_free(partition, 0);
+			return NULL;
+		}
+		total_used += used;
 
-	used = tmaps_get_usage(partition, SEGMENT_TYPE_DATA, &error);
-	if (unlikely(error != 0)) {
-		tape_partition_free(partition, 0);
-		return NULL;
+		used = tmaps_get_usage(partition, SEGMENT_TYPE_DATA, &error);
+		if (unlikely(error != 0)) {
+			tape_partition_free(partition, 0);
+			return NULL;
+		}
+		total_used += used;
 	}
-	total_used += used;
 	partition->used = total_used;
 	atomic_set_bit(PARTITION_LOOKUP_SEGMENTS, &partition->flags);
 
@@ -97,8 +97,10 @@ struct blk_entry {
 	struct bdevint *bint;
 	STAILQ_ENTRY(blk_entry) c_list;
 	uint16_t entry_id;
+	uint16_t comp_type;
 	uint32_t comp_size;
 	uint32_t block_size;
+	uint32_t csum; /* CRC32C of the uncompressed block */
 
 	int flags;
 	int pglist_cnt;
@@ -134,15 +136,40 @@ struct map_lookup {
 	uint16_t f_ids;
 	uint16_t s_ids;
 
+	/* Marks before each entry, rebuilt when the entries change */
+	uint16_t *f_ids_prefix;
+	uint16_t *s_ids_prefix;
+	int prefix_valid;
+
 	wait_chan_t *map_lookup_wait;
 	atomic_t refs;
 };
 TAILQ_HEAD(maplookup_list, map_lookup);
 
+/*
+ * In memory index of the map lookup chain, in chain order. Entries are
+ * appended as lookups are read so that a later LOCATE or SPACE can go
+ * straight to a lookup instead of following next_block from BOP
+ */
+struct mlookup_index_entry {
+	uint64_t l_ids_start;
+	uint32_t f_ids_start;
+	uint32_t s_ids_start;
+	uint64_t block;
+};
+
+struct mlookup_index {
+	struct mlookup_index_entry *entries;
+	int count;
+	int size;
+	int complete;
+};
+
 struct blk_map {
 	uint64_t b_start; 
 	struct bdevint *bint;
 	uint16_t nr_entries;
+	uint8_t version;
 	uint32_t segment_id;
 	uint16_t f_ids; /* number of file marks */
 	uint16_t s_ids; /* number of set marks */ 
@@ -151,6 +178,7 @@ struct blk_map {
 
 	struct blkentry_list entry_list;
 	TAILQ_ENTRY(blk_map) m_list;
+	STAILQ_ENTRY(blk_map) w_list; /* Metadata write group */
 	struct tcache_list tcache_list;
 
 	int32_t cached_data;
@@ -163,6 +191,13 @@ struct blk_map {
 	uint16_t mlookup_entry_id;
 	struct blk_entry *c_entry;
 
+	/* Entry array and marks before each entry, built on demand for locate */
+	struct blk_entry **entry_index;
+	uint16_t *f_ids_prefix;
+	uint16_t *s_ids_prefix;
+	int index_entries;
+	int index_size;
+
 	/* Error Related */
 	struct blk_entry *read_error_entry; /* If not null error in blk map */
 	struct blk_entry *write_error_entry; /* If not null error in blk map */
@@ -173,6 +208,7 @@ struct blk_map {
 	atomic_t refs;
 };
 TAILQ_HEAD(blkmap_list, blk_map);
+STAILQ_HEAD(blkmap_wlist, blk_map);
 
 #define PARTITION_CACHED_WRITES_MAX	(4 * 1024 * 1024)
 
@@ -209,6 +245,8 @@ struct tape_partition {
 	struct blk_map *cur_map;
 	struct blkmap_list map_list;
 	struct maplookup_list mlookup_list;
+	struct mlookup_index mlookup_index;
+	uint32_t locate_visited; /* entries examined by the last locate */
 	SLIST_ENTRY(tape_partition) p_list;
 	int flags;
 	pagestruct_t *mam_data;
@@ -237,7 +275,7 @@ void tape_partition_read_position(struct tape_partition *partition, struct qsio_
 int tape_partition_locate(struct tape_partition *partition, uint64_t block_address, uint8_t locate_type);
 int tape_partition_write_filemarks(struct tape_partition *partition, uint8_t wmsk, uint32_t transfer_length);
 int tape_partition_read(struct tape_partition *partition, struct qsio_scsiio *ctio, uint32_t block_size, uint32_t num_blocks, uint8_t fixed,  uint32_t *blocks_read, uint32_t *ili_block_size, uint32_t *compressed_size);
-int tape_partition_write(struct tape_partition *partition, struct qsio_scsiio *ctio, uint32_t block_size, uint32_t num_blocks, uint32_t *blocks_written, uint8_t compression_enabled, uint32_t *compressed_size);
+int tape_partition_write(struct tape_partition *partition, struct qsio_scsiio *ctio, uint32_t block_size, uint32_t num_blocks, uint32_t *blocks_written, uint16_t comp_type, uint32_t *compressed_size, uint32_t *sample_size);
 int tape_partition_validate_write(struct tape_partition *partition, uint32_t block_size, uint32_t num_blocks);
 int tape_partition_at_bop(struct tape_partition *partition);
 
@@ -316,15 +354,8 @@ int tape_partition_get_max_tmaps(struct tape_partition *partition, int type);
 struct tsegment_map * tmap_locate(struct tape_partition *partition, int type, uint16_t tmap_id);
 void tape_partition_print_cur_position(struct tape_partition *partition, char *msg);
 
-struct tape_position_info {
-	uint8_t bop;
-	uint8_t eop;
-	uint32_t blocks_in_buffer;
-	uint64_t bytes_in_buffer;
-	uint64_t block_number; 
-	uint64_t file_number;
-	uint64_t set_number;
-};
+void tape_partition_position_info(struct tape_partition *partition, struct tape_position_info *info);
+void tape_position_format(struct qsio_scsiio *ctio, uint8_t service_action, struct tape_position_info *info);
 int tape_partition_mam_set_byte(struct tape_partition *partition, uint16_t identifier, uint8_t val);
 int tape_partition_mam_set_word(struct tape_partition *partition, uint16_t identifier, uint32_t val);
 int tape_partition_mam_set_long(struct tape_partition *partition, uint16_t identifier, uint64_t val);
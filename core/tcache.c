@@ -120,6 +120,8 @@ void tcache_end_bio(struct bio *bio, int err)
 	if (!(atomic_dec_and_test(&tcache->bio_remain)))
 		return;
 
+	if (tcache->end_io)
+		(*tcache->end_io)(tcache, tcache->priv);
 	wait_complete(tcache->completion);
 	tcache_put(tcache);
 }
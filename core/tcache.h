@@ -30,6 +30,9 @@ struct tcache {
 	struct bio **bio_list;
 #endif
 	wait_compl_t *completion;
+	/* Called once all bios have completed, before waiters are woken up */
+	void (*end_io)(struct tcache *tcache, void *priv);
+	void *priv;
 	int flags;
 	uint16_t bio_count;
 	uint16_t last_idx;
@@ -24,6 +24,8 @@ extern struct tdevice *tdevices[];
 int 
 tdevice_init(struct tdevice *tdevice, int type, int tl_id, int target_id, char *name, void (*proc_cmd) (void *, void *), char *thr_name)
 {
+	int i;
+
 	tdevice->type = type;
 	tdevice->tl_id = tl_id;
 	tdevice->target_id = target_id;
@@ -34,6 +36,8 @@ tdevice_init(struct tdevice *tdevice, int type, int tl_id, int target_id, char *
 		return -1;
 
 	SLIST_INIT(&tdevice->istate_list);
+	for (i = 0; i < ISTATE_HASH_BUCKETS; i++)
+		SLIST_INIT(&tdevice->istate_hash[i]);
 	SLIST_INIT(&tdevice->reservation.registration_list);
 	tdevice->reservation_lock = sx_alloc("tdevice reservation lock");
 
@@ -47,7 +51,7 @@ tdevice_exit(struct tdevice *tdevice)
 		devq_exit(tdevice->devq);
 		tdevice->devq = NULL;
 	}
-	device_free_all_initiators(&tdevice->istate_list);
+	device_free_all_initiators(tdevice);
 	persistent_reservation_clear(&tdevice->reservation.registration_list);
 	sx_free(tdevice->reservation_lock);
 }
@@ -135,12 +139,53 @@ vdevice_new(struct vdeviceinfo *deviceinfo)
 	return 0;
 }
 
+struct vcart_load_job {
+	struct vcartridge vinfo;
+	STAILQ_ENTRY(vcart_load_job) j_list;
+};
+STAILQ_HEAD(vcart_load_jlist, vcart_load_job);
+
+struct vcart_loader {
+	kproc_t *task;
+	int exit_flags;
+	int id;
+};
+
+#define VCART_LOADER_EXIT	0x02
+#define VCART_LOAD_THREADS	8
+
+/*
+ * Cartridges are loaded by a pool of threads. Reading the tape metadata and
+ * partition usage runs in parallel, adding the tape to its drive or changer
+ * is serialized by vcart_load_lock
+ */
+static struct vcart_load_jlist vcart_load_queue = STAILQ_HEAD_INITIALIZER(vcart_load_queue);
+static struct vcart_loader *vcart_loaders[VCART_LOAD_THREADS];
+static wait_chan_t *vcart_load_wait;
+static wait_chan_t *vcart_load_done_wait;
+static sx_t *vcart_load_lock;
+static atomic_t vcart_load_pending;
+static uint8_t vcart_load_failed[(MAX_VTAPES + 7) / 8];
+
+static void
+vcart_load_set_failed(uint32_t tape_id, int failed)
+{
+	chan_lock(vcart_load_wait);
+	if (failed)
+		vcart_load_failed[tape_id >> 3] |= (1 << (tape_id & 0x7));
+	else
+		vcart_load_failed[tape_id >> 3] &= ~(1 << (tape_id & 0x7));
+	chan_unlock(vcart_load_wait);
+}
+
 int
 vcartridge_new(struct vcartridge *vcartridge)
 {
 	struct tdevice *tdevice;
 	int retval;
 
+	vcartridge_load_wait();
+
 	if (vcartridge->tl_id >= TL_MAX_DEVICES)
 		return -1;
 
@@ -152,35 +197,203 @@ vcartridge_new(struct vcartridge *vcartridge)
 		retval = tdrive_new_vcartridge((struct tdrive *)tdevice, vcartridge);
 	else
 		retval = mchanger_new_vcartridge((struct mchanger *)tdevice, vcartridge);
+	if (retval == 0 && vcartridge->tape_id < MAX_VTAPES)
+		vcart_load_set_failed(vcartridge->tape_id, 0);
 	return retval;
 }
 
-int
-vcartridge_load(struct vcartridge *vcartridge)
+static int
+__vcartridge_load(struct vcartridge *vcartridge)
 {
 	struct tdevice *tdevice;
+	struct tape *tape;
 	int retval;
 
-	if (vcartridge->tl_id >= TL_MAX_DEVICES)
-		return -1;
-
 	tdevice = tdevices[vcartridge->tl_id];
 	if (!tdevice)
 		return -1;
 
+	tape = tape_load(tdevice, vcartridge);
+	if (!tape)
+		return -1;
+
+	sx_xlock(vcart_load_lock);
 	if (tdevice->type == T_SEQUENTIAL)
-		retval = tdrive_load_vcartridge((struct tdrive *)tdevice, vcartridge);
+		retval = tdrive_load_vcartridge((struct tdrive *)tdevice, vcartridge, tape);
 	else
-		retval = mchanger_load_vcartridge((struct mchanger *)tdevice, vcartridge);
+		retval = mchanger_load_vcartridge((struct mchanger *)tdevice, vcartridge, tape);
+	sx_xunlock(vcart_load_lock);
+
+	if (retval != 0)
+		tape_free(tape, 0);
 	return retval;
 }
 
+static struct vcart_load_job *
+vcart_load_next_job(void)
+{
+	struct vcart_load_job *job;
+
+	chan_lock(vcart_load_wait);
+	job = STAILQ_FIRST(&vcart_load_queue);
+	if (job)
+		STAILQ_REMOVE_HEAD(&vcart_load_queue, j_list);
+	chan_unlock(vcart_load_wait);
+	return job;
+}
+
+#ifdef FREEBSD 
+static void vcart_load_thread(void *data)
+#else
+static int vcart_load_thread(void *data)
+#endif
+{
+	struct vcart_loader *loader = data;
+	struct vcart_load_job *job;
+	int retval;
+
+	__sched_prio(curthread, QS_PRIO_INOD);
+
+	for (;;)
+	{
+		wait_on_chan_interruptible(vcart_load_wait, !STAILQ_EMPTY(&vcart_load_queue) || kernel_thread_check(&loader->exit_flags, VCART_LOADER_EXIT));
+
+		while ((job = vcart_load_next_job()) != NULL) {
+			retval = __vcartridge_load(&job->vinfo);
+			if (unlikely(retval != 0)) {
+				debug_warn("Loading of tape %s failed\n", job->vinfo.label);
+				vcart_load_set_failed(job->vinfo.tape_id, 1);
+			}
+			free(job, M_QUADSTOR);
+			chan_lock(vcart_load_done_wait);
+			atomic_dec(&vcart_load_pending);
+			chan_wakeup_unlocked(vcart_load_done_wait);
+			chan_unlock(vcart_load_done_wait);
+		}
+
+		if (unlikely(kernel_thread_check(&loader->exit_flags, VCART_LOADER_EXIT)))
+		{
+			break;
+		}
+	}
+#ifdef FREEBSD 
+	kproc_exit(0);
+#else
+	return 0;
+#endif
+}
+
+void
+vcartridge_load_wait(void)
+{
+	if (!atomic_read(&vcart_load_pending))
+		return;
+	wait_on_chan(vcart_load_done_wait, !atomic_read(&vcart_load_pending));
+}
+
+int
+vcartridge_load(struct vcartridge *vcartridge)
+{
+	struct vcart_load_job *job;
+
+	if (vcartridge->tl_id >= TL_MAX_DEVICES || vcartridge->tape_id >= MAX_VTAPES)
+		return -1;
+
+	if (!tdevices[vcartridge->tl_id])
+		return -1;
+
+	job = zalloc(sizeof(*job), M_QUADSTOR, Q_WAITOK);
+	memcpy(&job->vinfo, vcartridge, sizeof(*vcartridge));
+	vcart_load_set_failed(vcartridge->tape_id, 0);
+	atomic_inc(&vcart_load_pending);
+
+	chan_lock(vcart_load_wait);
+	STAILQ_INSERT_TAIL(&vcart_load_queue, job, j_list);
+	chan_wakeup_one_unlocked(vcart_load_wait);
+	chan_unlock(vcart_load_wait);
+	return 0;
+}
+
+int
+vcartridge_load_status(struct vcartridge *vcartridge)
+{
+	int failed;
+
+	if (vcartridge->tape_id >= MAX_VTAPES)
+		return -1;
+
+	vcartridge_load_wait();
+	chan_lock(vcart_load_wait);
+	failed = vcart_load_failed[vcartridge->tape_id >> 3] & (1 << (vcartridge->tape_id & 0x7));
+	chan_unlock(vcart_load_wait);
+	return failed ? -1 : 0;
+}
+
+int
+init_vcart_load_threads(void)
+{
+	struct vcart_loader *loader;
+	int i, retval;
+
+	vcart_load_wait = wait_chan_alloc("vcart load wait");
+	vcart_load_done_wait = wait_chan_alloc("vcart load done wait");
+	vcart_load_lock = sx_alloc("vcart load lock");
+
+	for (i = 0; i < VCART_LOAD_THREADS; i++) {
+		loader = zalloc(sizeof(*loader), M_QUADSTOR, Q_WAITOK);
+		loader->id = i;
+		retval = kernel_thread_create(vcart_load_thread, loader, loader->task, "vcartld_%d", i);
+		if (unlikely(retval != 0)) {
+			debug_warn("Failed to run vcart loader %d\n", i);
+			free(loader, M_QUADSTOR);
+			return -1;
+		}
+		vcart_loaders[i] = loader;
+	}
+	return 0;
+}
+
+void
+exit_vcart_load_threads(void)
+{
+	struct vcart_loader *loader;
+	int err, i, failed = 0;
+
+	if (!vcart_load_wait)
+		return;
+
+	vcartridge_load_wait();
+	for (i = 0; i < VCART_LOAD_THREADS; i++) {
+		loader = vcart_loaders[i];
+		if (!loader)
+			continue;
+		err = kernel_thread_stop(loader->task, &loader->exit_flags, vcart_load_wait, VCART_LOADER_EXIT);
+		if (err) {
+			debug_warn("Shutting down vcart loader failed\n");
+			failed = 1;
+			continue;
+		}
+		free(loader, M_QUADSTOR);
+		vcart_loaders[i] = NULL;
+	}
+
+	if (failed)
+		return;
+
+	wait_chan_free(vcart_load_wait);
+	wait_chan_free(vcart_load_done_wait);
+	sx_free(vcart_load_lock);
+	vcart_load_wait = NULL;
+}
+
 int
 vcartridge_delete(struct vcartridge *vcartridge)
 {
 	struct tdevice *tdevice;
 	int retval;
 
+	vcartridge_load_wait();
+
 	if (vcartridge->tl_id >= TL_MAX_DEVICES)
 		return -1;
 
@@ -201,6 +414,8 @@ vcartridge_reload(struct vcartridge *vcartridge)
 	struct tdevice *tdevice;
 	int retval;
 
+	vcartridge_load_wait();
+
 	if (vcartridge->tl_id >= TL_MAX_DEVICES)
 		return -1;
 
@@ -222,6 +437,8 @@ vcartridge_info(struct vcartridge *vcartridge)
 	struct tdevice *tdevice;
 	int retval;
 
+	vcartridge_load_wait();
+
 	if (vcartridge->tl_id >= TL_MAX_DEVICES)
 		return -1;
 
@@ -241,6 +458,8 @@ tdevice_delete(uint32_t tl_id, int free_alloc)
 {
 	struct tdevice *tdevice;
 
+	vcartridge_load_wait();
+
 	if (tl_id >= TL_MAX_DEVICES)
 		return -1;
 
@@ -275,6 +494,8 @@ vdevice_load(struct vdeviceinfo *deviceinfo)
 	struct tdevice *tdevice;
 	uint32_t tl_id = deviceinfo->tl_id;
 
+	vcartridge_load_wait();
+
 	if (tl_id >= TL_MAX_DEVICES)
 		return -1;
 
@@ -332,7 +553,7 @@ tdevice_insert_ccb(struct qsio_hdr *ccb_h)
 {
 	struct tdevice *tdevice = ccb_h->tdevice;
 
-	devq_insert_ccb(tdevice->devq, ccb_h);
+	devq_insert_ccb(tdevice_devq(tdevice, ccb_h), ccb_h);
 }
 
 int
@@ -44,12 +44,28 @@ struct initiator_state {
 	atomic_t refs;
 	uint32_t timestamp;
 	SLIST_ENTRY(initiator_state) i_list;
+	SLIST_ENTRY(initiator_state) h_list;
 	SLIST_HEAD(, sense_info) sense_list;
 	wait_chan_t *istate_wait;
 };
 
 SLIST_HEAD(istate_list, initiator_state);
 
+#define ISTATE_HASH_BUCKETS	64
+#define ISTATE_HASH_MASK	(ISTATE_HASH_BUCKETS - 1)
+
+static inline int
+istate_hash(uint64_t i_prt[], uint64_t t_prt[], uint8_t init_int)
+{
+	uint64_t val;
+
+	val = i_prt[0] ^ i_prt[1] ^ t_prt[0] ^ t_prt[1] ^ init_int;
+	val ^= (val >> 32);
+	val ^= (val >> 16);
+	val ^= (val >> 8);
+	return (int)(val & ISTATE_HASH_MASK);
+}
+
 struct tdevice {
 	int type;
 	int tl_id;
@@ -61,8 +77,10 @@ struct tdevice {
 	void *hpriv;
 	sx_t *reservation_lock;
 	struct qs_devq *devq;
+	struct qs_devq *fast_devq; /* Commands that can run without the device lock */
 	struct reservation reservation;
 	struct istate_list istate_list;
+	struct istate_list istate_hash[ISTATE_HASH_BUCKETS]; /* Lookup by i_prt, t_prt, init_int */
 };
 
 static inline char *
@@ -77,6 +95,28 @@ do {                                                                    \
         sx_xunlock((tdev)->reservation_lock);                            \
 } while (0)
 
+static inline int
+tdevice_cmd_fast(struct qsio_scsiio *ctio)
+{
+	switch (ctio->cdb[0]) {
+	case INQUIRY:
+	case TEST_UNIT_READY:
+	case REPORT_LUNS:
+	case READ_BLOCK_LIMITS:
+	case READ_POSITION:
+		return 1;
+	}
+	return 0;
+}
+
+static inline struct qs_devq *
+tdevice_devq(struct tdevice *tdevice, struct qsio_hdr *ccb_h)
+{
+	if (tdevice->fast_devq && tdevice_cmd_fast((struct qsio_scsiio *)ccb_h))
+		return tdevice->fast_devq;
+	return tdevice->devq;
+}
+
 int tdevice_init(struct tdevice *tdevice, int type, int tl_id, int target_id, char *name, void (*proc_cmd) (void *, void *), char *thr_name);
 void tdevice_exit(struct tdevice *tdevice);
 void tdevice_reset(struct tdevice *tdevice, uint64_t i_prt[], uint64_t t_prt[], uint8_t init_int);
@@ -98,6 +138,10 @@ int vcartridge_load(struct vcartridge *vcartridge);
 int vcartridge_delete(struct vcartridge *vcartridge);
 int vcartridge_info(struct vcartridge *vcartridge);
 int vcartridge_reload(struct vcartridge *vcartridge);
+int vcartridge_load_status(struct vcartridge *vcartridge);
+void vcartridge_load_wait(void);
+int init_vcart_load_threads(void);
+void exit_vcart_load_threads(void);
 
 #define tdevice_get(tdev)	do {} while (0)
 #define tdevice_put(tdev)	do {} while (0)
@@ -27,8 +27,7 @@
 static void
 tdrive_wait_for_write_queue(struct tdrive *tdrive)
 {
-	while (atomic_read(&tdrive->write_devq->pending_cmds))
-		pause("psg", 100);
+	devq_wait_for_drain(tdrive->write_devq);
 }
 
 void
@@ -84,6 +83,34 @@ tdrive_init_device_configuration_ext_page(struct tdrive *tdrive)
 }
 
 
+/*
+ * The algorithm in use is kept in the compression algorithm field of the
+ * data compression page, so that MODE SENSE reports it. The default
+ * algorithm value stands for the built in default, anything else is a
+ * vendor specific value.
+ */
+static void
+tdrive_set_comp_alg(struct tdrive *tdrive, int alg, int level)
+{
+	struct data_compression_page *page = &tdrive->compression_page;
+
+	if (alg == DRIVE_COMP_ALG_DEFAULT || alg > DRIVE_COMP_ALG_MAX)
+		page->compression_algorithm = htobe32(DATA_COMPRESSION_ALG_DEFAULT);
+	else
+		page->compression_algorithm = htobe32(DATA_COMPRESSION_ALG_VENDOR + alg);
+	tdrive->comp_level = level;
+}
+
+static int
+tdrive_get_comp_alg(struct tdrive *tdrive)
+{
+	uint32_t algorithm = be32toh(tdrive->compression_page.compression_algorithm);
+
+	if (algorithm > DATA_COMPRESSION_ALG_VENDOR && algorithm <= (DATA_COMPRESSION_ALG_VENDOR + DRIVE_COMP_ALG_MAX))
+		return algorithm - DATA_COMPRESSION_ALG_VENDOR;
+	return DRIVE_COMP_ALG_DEFAULT;
+}
+
 static void
 tdrive_init_data_compression_page(struct tdrive *tdrive, struct vdeviceinfo *deviceinfo)
 {
@@ -96,6 +123,10 @@ tdrive_init_data_compression_page(struct tdrive *tdrive, struct vdeviceinfo *dev
 	if (deviceinfo->enable_compression)
 		page->dcc |= 0x80; /* Data compression enable by default*/
 	page->red |= 0x80; /* Data decompression enabled all the times */
+
+	tdrive->def_comp_alg = deviceinfo->comp_alg;
+	tdrive->def_comp_level = deviceinfo->comp_level;
+	tdrive_set_comp_alg(tdrive, deviceinfo->comp_alg, deviceinfo->comp_level);
 }
 
 static int 
@@ -308,8 +339,24 @@ tdrive_init(struct tdrive *tdrive, struct vdeviceinfo *deviceinfo)
 		return -1;
 	}
 
+	tdrive->tdevice.fast_devq = devq_init(deviceinfo->tl_id, deviceinfo->target_id, &tdrive->tdevice, "tdrvf", tdrive_proc_fast_cmd);
+	if (unlikely(!tdrive->tdevice.fast_devq)) {
+		tdevice_exit(&tdrive->tdevice);
+		devq_exit(tdrive->write_devq);
+		return -1;
+	}
+
 	tdrive->stats_lock = mtx_alloc("tdrive stats lock");
+	tdrive->state_lock = mtx_alloc("tdrive state lock");
 	tdrive->tdrive_lock = sx_alloc("tdrive lock");
+	tdrive->write_cache_wait = wait_chan_alloc("tdrive write cache wait");
+	if (deviceinfo->write_cache_size)
+		tdrive->write_cache_size = deviceinfo->write_cache_size << 20;
+	else
+		tdrive->write_cache_size = TDRIVE_WRITE_CACHE_SIZE;
+	tdrive->write_cache_size = max_t(uint32_t, tdrive->write_cache_size, TDRIVE_WRITE_CACHE_SIZE_MIN);
+	tdrive->write_cache_size = min_t(uint32_t, tdrive->write_cache_size, TDRIVE_WRITE_CACHE_SIZE_MAX);
+	tdrive->data_csum = deviceinfo->data_csum;
 	SLIST_INIT(&tdrive->density_list);
 	LIST_INIT(&tdrive->media_list);
 	TDRIVE_SET_BUFFERED_MODE(tdrive);
@@ -446,9 +493,12 @@ tdrive_free(struct tdrive *tdrive, int delete)
 	tdrive_cbs_remove(tdrive);
 	tdrive_free_tapes(tdrive, delete);
 	tdrive_free_density_list(tdrive);
+	devq_exit(tdrive->tdevice.fast_devq);
 	tdevice_exit(&tdrive->tdevice);
 	devq_exit(tdrive->write_devq);
+	wait_chan_free(tdrive->write_cache_wait);
 	mtx_free(tdrive->stats_lock);
+	mtx_free(tdrive->state_lock);
 	sx_free(tdrive->tdrive_lock);
 	free(tdrive, M_DRIVE);
 }
@@ -458,8 +508,7 @@ tdrive_incr_pending_writes(struct tdrive *tdrive, uint32_t block_size, uint32_t
 {
 	struct tape_partition *partition = tdrive->tape->cur_partition;
 
-	while (atomic_read(&partition->pending_size) > TDRIVE_WRITE_CACHE_SIZE)
-		pause("psg", 10);
+	wait_on_chan(tdrive->write_cache_wait, atomic_read(&partition->pending_size) <= tdrive->write_cache_size);
 
 	atomic_add((block_size * num_blocks), &partition->pending_size);
 	atomic_add(num_blocks, &partition->pending_writes);
@@ -472,6 +521,7 @@ tdrive_decr_pending_writes(struct tdrive *tdrive, uint32_t block_size, uint32_t
 
 	atomic_sub((block_size * num_blocks), &partition->pending_size);
 	atomic_sub(num_blocks, &partition->pending_writes);
+	chan_wakeup(tdrive->write_cache_wait);
 }
 
 int
@@ -482,6 +532,132 @@ tdrive_compression_enabled(struct tdrive *tdrive)
 	return (dev_page->select_data_compression_algorithm && (page->dcc & 0x80));
 }
 
+uint16_t
+tdrive_comp_type(struct tdrive *tdrive)
+{
+	int alg;
+
+	if (!tdrive_compression_enabled(tdrive))
+		return 0;
+
+	switch (tdrive_get_comp_alg(tdrive)) {
+	case DRIVE_COMP_ALG_LZ4_HC:
+		alg = COMP_ALG_LZ4_HC;
+		break;
+	case DRIVE_COMP_ALG_LZF:
+		alg = COMP_ALG_LZF;
+		break;
+	default:
+		alg = COMP_ALG_LZ4;
+		break;
+	}
+	return COMP_TYPE(alg, tdrive->comp_level);
+}
+
+static uint16_t
+tdrive_write_comp_type(struct tdrive *tdrive, uint64_t write_size)
+{
+	uint16_t comp_type;
+
+	comp_type = tdrive_comp_type(tdrive);
+	if (!comp_type || !tdrive->comp_bypass_bytes)
+		return comp_type;
+
+	if (tdrive->comp_bypass_bytes > write_size)
+		tdrive->comp_bypass_bytes -= write_size;
+	else
+		tdrive->comp_bypass_bytes = 0;
+	TDRIVE_STATS_ADD(tdrive, compression_bypassed_bytes, write_size);
+	return 0;
+}
+
+static void
+tdrive_comp_sample(struct tdrive *tdrive, uint64_t write_size, uint32_t stored_size)
+{
+	tdrive->comp_sample_bytes += write_size;
+	tdrive->comp_sample_stored += stored_size;
+	if (tdrive->comp_sample_bytes < COMP_SAMPLE_SIZE)
+		return;
+
+	if ((tdrive->comp_sample_stored * 100) >= (tdrive->comp_sample_bytes * COMP_BYPASS_RATIO)) {
+		if (!tdrive->comp_bypass_interval)
+			tdrive->comp_bypass_interval = COMP_BYPASS_INTERVAL_MIN;
+		else if (tdrive->comp_bypass_interval < COMP_BYPASS_INTERVAL_MAX)
+			tdrive->comp_bypass_interval <<= 1;
+		tdrive->comp_bypass_bytes = tdrive->comp_bypass_interval;
+	}
+	else {
+		tdrive->comp_bypass_interval = 0;
+	}
+	tdrive->comp_sample_bytes = 0;
+	tdrive->comp_sample_stored = 0;
+}
+
+static void
+tdrive_get_state(struct tdrive *tdrive, struct tdrive_state *state)
+{
+	struct tape *tape = tdrive->tape;
+
+	bzero(state, sizeof(*state));
+	if (!tape)
+		return;
+
+	state->tape_present = 1;
+	state->tape_loaded = atomic_test_bit(TDRIVE_FLAGS_TAPE_LOADED, &tdrive->flags);
+	state->locked_other = (tape->locked && tape->locked_by != tdrive);
+	state->media_valid = tdrive_media_valid(tdrive, tape->make);
+}
+
+/*
+ * Called with tdrive_lock held whenever the tape or its position may have
+ * changed. Reading the position is costly, so it is only published on load
+ * and by READ POSITION, and dropped again by any command which can move the
+ * tape. It is also not published while buffered writes are pending, READ
+ * POSITION then falls back to the command devq.
+ */
+static void
+tdrive_publish_state(struct tdrive *tdrive, int with_position)
+{
+	struct tdrive_state state;
+
+	tdrive_get_state(tdrive, &state);
+	if (with_position && state.tape_loaded && !state.locked_other && !state.media_valid && !atomic_read(&tdrive->write_devq->pending_cmds)) {
+		if (tdrive->state.position_valid)
+			memcpy(&state.position, &tdrive->state.position, sizeof(state.position));
+		else
+			tape_cmd_position_info(tdrive->tape, &state.position);
+		state.position_valid = 1;
+	}
+
+	/* Only tdrive_lock holders update the state */
+	if (!memcmp(&tdrive->state, &state, sizeof(state)))
+		return;
+
+	mtx_lock(tdrive->state_lock);
+	memcpy(&tdrive->state, &state, sizeof(state));
+	mtx_unlock(tdrive->state_lock);
+}
+
+/* Returns 0 for commands which neither move the tape nor change the drive state */
+static int
+tdrive_cmd_changes_state(uint8_t op)
+{
+	switch (op) {
+	case INQUIRY:
+	case TEST_UNIT_READY:
+	case REPORT_LUNS:
+	case READ_BLOCK_LIMITS:
+	case MODE_SENSE_6:
+	case MODE_SENSE_10:
+	case LOG_SENSE:
+	case REQUEST_SENSE:
+	case REPORT_DENSITY_SUPPORT:
+	case PERSISTENT_RESERVE_IN:
+		return 0;
+	}
+	return 1;
+}
+
 int
 __tdrive_load_tape(struct tdrive *tdrive, struct tape *tape)
 {
@@ -491,12 +667,14 @@ __tdrive_load_tape(struct tdrive *tdrive, struct tape *tape)
 	}
 
 	tdrive->tape = tape;
+	tape->data_csum = tdrive->data_csum;
 	if (tdrive->handlers.load_tape)
 	{
 		(*tdrive->handlers.load_tape)(tdrive, tape);
 	}
 	atomic_set_bit(TDRIVE_FLAGS_TAPE_LOADED, &tdrive->flags);
 	tdrive_init_medium_partition_page(tdrive);
+	tdrive_publish_state(tdrive, 1);
 	TDRIVE_STATS_ADD(tdrive, load_count, 1);
 	return 0;
 }
@@ -569,6 +747,7 @@ int
 tdrive_reset_stats(struct tdrive *tdrive, struct vdeviceinfo *deviceinfo)
 {
 	bzero(&tdrive->stats, sizeof(tdrive->stats));
+	devq_reset_stats(tdrive->tdevice.devq);
 	return 0;
 }
 
@@ -591,9 +770,14 @@ tdrive_get_info(struct tdrive *tdrive, struct vdeviceinfo *deviceinfo)
 	if (tdrive->tape)
 		strcpy(deviceinfo->tape_label, tdrive->tape->label);
 	memcpy(&deviceinfo->stats, &tdrive->stats, sizeof(tdrive->stats));
+	deviceinfo->write_cache_size = tdrive->write_cache_size >> 20;
 	deviceinfo->stats.write_ticks = ticks_to_msecs(tdrive->stats.write_ticks);
 	deviceinfo->stats.read_ticks = ticks_to_msecs(tdrive->stats.read_ticks);
 	deviceinfo->stats.compression_enabled = tdrive_compression_enabled(tdrive);
+	deviceinfo->stats.cmd_queue_depth = atomic_read(&tdrive->tdevice.devq->pending_cmds);
+	deviceinfo->stats.cmd_batch_max = tdrive->tdevice.devq->batch_max;
+	deviceinfo->stats.cmd_batches = tdrive->tdevice.devq->batch_count;
+	deviceinfo->stats.cmd_batch_cmds = tdrive->tdevice.devq->batch_cmds;
 	tdrive_unlock(tdrive);
 	return 0;
 }
@@ -623,16 +807,9 @@ tdrive_delete_vcartridge(struct tdrive *tdrive, struct vcartridge *vcartridge)
 }
 
 int
-tdrive_load_vcartridge(struct tdrive *tdrive, struct vcartridge *vinfo)
+tdrive_load_vcartridge(struct tdrive *tdrive, struct vcartridge *vinfo, struct tape *tape)
 {
-	struct tape *tape;
-
 	debug_check(tdrive->mchanger);
-	tape = tape_load((struct tdevice *)tdrive, vinfo);
-
-	if (!tape)
-		return -1;
-
 	LIST_INSERT_HEAD(&tdrive->media_list, tape, t_list);
 	return 0;
 }
@@ -669,6 +846,7 @@ int tdrive_unload_tape(struct tdrive *tdrive, struct qsio_scsiio *ctio)
 	if (!atomic_test_bit(TDRIVE_FLAGS_TAPE_LOADED, &tdrive->flags)) {
 		tdrive->tape = NULL;
 		tdrive_init_medium_partition_page(tdrive);
+		tdrive_publish_state(tdrive, 0);
 		tdrive_unlock(tdrive);
 		return 0;
 	}
@@ -701,6 +879,7 @@ int tdrive_unload_tape(struct tdrive *tdrive, struct qsio_scsiio *ctio)
 	if (tdrive->handlers.unload_tape)
 		(*tdrive->handlers.unload_tape)(tdrive);
 	tdrive_init_medium_partition_page(tdrive);
+	tdrive_publish_state(tdrive, 0);
 	tdrive_unlock(tdrive);
 	return 0;
 }
@@ -861,22 +1040,17 @@ tdrive_media_valid(struct tdrive *tdrive, int voltype)
 
 
 static int
-tdrive_cmd_test_unit_ready(struct tdrive *tdrive, struct qsio_scsiio *ctio)
+__tdrive_cmd_test_unit_ready(struct tdrive_state *state, struct qsio_scsiio *ctio)
 {
-
-	int media_valid = 0;
 	uint8_t asc, ascq;
 
-	if (tdrive->tape && tdrive->handlers.valid_medium)
-		media_valid = (*tdrive->handlers.valid_medium)(tdrive, tdrive->tape->make);
-
-	if (!tdrive->tape || (tdrive->tape->locked && tdrive->tape->locked_by != tdrive) || (media_valid != 0) || !atomic_read(&mdaemon_load_done)) {
-		if (!tdrive->tape)
+	if (!state->tape_present || state->locked_other || (state->media_valid != 0) || !atomic_read(&mdaemon_load_done)) {
+		if (!state->tape_present)
 		{
 			asc = MEDIUM_NOT_PRESENT_ASC;
 			ascq = MEDIUM_NOT_PRESENT_ASCQ;
 		}
-		else if (media_valid != 0)
+		else if (state->media_valid != 0)
 		{
 			asc = INCOMPATIBLE_MEDIUM_INSTALLED_ASC;
 			ascq = INCOMPATIBLE_MEDIUM_INSTALLED_ASCQ;
@@ -892,6 +1066,15 @@ tdrive_cmd_test_unit_ready(struct tdrive *tdrive, struct qsio_scsiio *ctio)
 	return 0;
 }
 
+static int
+tdrive_cmd_test_unit_ready(struct tdrive *tdrive, struct qsio_scsiio *ctio)
+{
+	struct tdrive_state state;
+
+	tdrive_get_state(tdrive, &state);
+	return __tdrive_cmd_test_unit_ready(&state, ctio);
+}
+
 static int
 tdrive_cmd_erase(struct tdrive *tdrive, struct qsio_scsiio *ctio)
 {
@@ -1026,11 +1209,14 @@ tdrive_cmd_load_unload(struct tdrive *tdrive, struct qsio_scsiio *ctio)
 static int
 __tdrive_cmd_locate(struct tdrive *tdrive, struct qsio_scsiio *ctio, uint64_t block_address, uint8_t cp, uint8_t pnum, uint8_t locate_type)
 {
+	uint32_t entries_visited = 0;
 	int retval;
 
 	tdrive_empty_write_queue(tdrive);
 
-	retval = tape_cmd_locate(tdrive->tape, block_address, cp, pnum, locate_type);
+	retval = tape_cmd_locate(tdrive->tape, block_address, cp, pnum, locate_type, &entries_visited);
+	TDRIVE_STATS_ADD(tdrive, locate_count, 1);
+	TDRIVE_STATS_ADD(tdrive, locate_entries_visited, entries_visited);
 	if (retval == 0)
 		return 0; /* Always check for retval == 0 first */
 
@@ -1658,7 +1844,9 @@ tdrive_cmd_write6(struct tdrive *tdrive, struct qsio_scsiio *ctio)
 	uint32_t done_blocks = 0;
 	uint32_t block_size;
 	uint32_t num_blocks;
-	uint32_t compressed_size;
+	uint32_t compressed_size, sample_size;
+	uint32_t info = 0;
+	uint16_t comp_type;
 
 	fixed = READ_BIT(cdb[1], 0);
 	transfer_length = READ_24(cdb[2], cdb[3], cdb[4]);
@@ -1682,11 +1870,15 @@ tdrive_cmd_write6(struct tdrive *tdrive, struct qsio_scsiio *ctio)
 	}
 
 	compressed_size = 0;
-	retval = tape_cmd_write(tdrive->tape, ctio, block_size, num_blocks, &done_blocks, tdrive_compression_enabled(tdrive), &compressed_size);
+	sample_size = 0;
+	comp_type = tdrive_write_comp_type(tdrive, (uint64_t)block_size * num_blocks);
+	retval = tape_cmd_write(tdrive->tape, ctio, block_size, num_blocks, &done_blocks, comp_type, &compressed_size, &sample_size);
 	if (ctio_buffered(ctio))
 		tdrive_decr_pending_writes(tdrive, block_size, num_blocks);
 
 	if (retval == 0) {
+		if (comp_type)
+			tdrive_comp_sample(tdrive, (uint64_t)block_size * num_blocks, sample_size);
 		TDRIVE_STATS_ADD(tdrive, write_bytes_processed, (block_size * num_blocks));
 		if (compressed_size) {
 			TDRIVE_STATS_ADD(tdrive, bytes_written_to_tape, compressed_size);
@@ -1714,14 +1906,16 @@ tdrive_cmd_write6(struct tdrive *tdrive, struct qsio_scsiio *ctio)
 		return 0;
 	}
 
+	/* Blocks already inserted stay on the tape, report only the rest */
+	INFORMATION_FIELD(info, fixed, num_blocks, done_blocks, block_size, (done_blocks ? block_size : 0));
 	if (!ctio_buffered(ctio))
-		ctio_construct_sense(ctio, SSD_CURRENT_ERROR, sense_key, htobe32(transfer_length), asc, ascq);
+		ctio_construct_sense(ctio, SSD_CURRENT_ERROR, sense_key, info, asc, ascq);
 	else {
 		struct initiator_state *istate;
 		istate = ctio->istate;
 
 		tdevice_reservation_lock(&tdrive->tdevice);
-		device_add_sense(istate, SSD_DEFERRED_ERROR, sense_key, htobe32(transfer_length), asc, ascq);
+		device_add_sense(istate, SSD_DEFERRED_ERROR, sense_key, info, asc, ascq);
 		tdevice_reservation_unlock(&tdrive->tdevice);
 	}
 	return 0;
@@ -1801,12 +1995,52 @@ tdrive_construct_eod_sense(struct tdrive *tdrive, struct qsio_scsiio *ctio, uint
 
 }
 
+static void
+tdrive_construct_read_sense(struct tdrive *tdrive, struct qsio_scsiio *ctio, int retval, uint8_t fixed, uint8_t sili, uint32_t num_blocks, uint32_t done_blocks, uint32_t block_size, uint32_t ili_block_size)
+{
+	switch (retval) {
+	case FILEMARK_ENCOUNTERED:
+		tdrive_construct_filemark_sense(tdrive,
+			ctio, fixed,
+			num_blocks, done_blocks, block_size, ili_block_size);
+		break;
+	case SETMARK_ENCOUNTERED:
+		tdrive_construct_setmark_sense(tdrive,
+			ctio, fixed,
+			num_blocks, done_blocks, block_size, ili_block_size);
+		break;
+	case EOD_REACHED:
+		tdrive_construct_eod_sense(tdrive,
+			ctio, fixed,
+			num_blocks, done_blocks, block_size, ili_block_size);
+		break;
+	case UNDERLENGTH_COND_ENCOUNTERED:
+		tdrive_construct_ili_sense(tdrive,
+			ctio, fixed,
+			num_blocks, done_blocks, block_size,
+			sili, UNDERLENGTH_COND_ENCOUNTERED, ili_block_size);
+		break;
+	case OVERLENGTH_COND_ENCOUNTERED:
+		tdrive_construct_ili_sense(tdrive,
+			ctio, fixed,
+			num_blocks, done_blocks, block_size,
+			sili, OVERLENGTH_COND_ENCOUNTERED, ili_block_size);
+		break;
+	case MEDIA_ERROR:
+		TDRIVE_STATS_ADD(tdrive, read_errors, 1);
+		ctio_construct_sense(ctio, SSD_CURRENT_ERROR,
+			SSD_KEY_MEDIUM_ERROR, 0,
+			UNRECOVERED_READ_ERROR_ASC,
+			UNRECOVERED_READ_ERROR_ASCQ);
+		break;
+	default:
+		break;
+	}
+}
+
 static int
-tdrive_cmd_read6(struct tdrive *tdrive, struct qsio_scsiio *ctio)
+__tdrive_cmd_read(struct tdrive *tdrive, struct qsio_scsiio *ctio, uint8_t fixed, uint8_t sili, uint32_t transfer_length)
 {
-	uint8_t *cdb = ctio->cdb;
-	uint8_t sili, fixed;
-	uint32_t transfer_length;
 	int retval;
 	uint32_t done_blocks = 0;
 	uint32_t block_size;
@@ -1815,18 +2049,8 @@ tdrive_cmd_read6(struct tdrive *tdrive, struct qsio_scsiio *ctio)
 	uint32_t compressed_size = 0;
 	uint32_t start_ticks;
 
-	fixed = READ_BIT(cdb[1], 0);
-	sili = READ_BIT(cdb[1], 1);
-
-	if (fixed && sili) {
-		ctio_construct_sense(ctio, SSD_CURRENT_ERROR, SSD_KEY_ILLEGAL_REQUEST, 0, INVALID_FIELD_IN_CDB_ASC, INVALID_FIELD_IN_CDB_ASCQ);  
-		return 0;
-	}
-
 	tdrive_empty_write_queue(tdrive);
 
-	transfer_length = READ_24(cdb[2], cdb[3], cdb[4]);
-
 	/* Return 0 for zero transfer length */
 	if (!transfer_length)
 		return 0;
@@ -1859,46 +2083,84 @@ tdrive_cmd_read6(struct tdrive *tdrive, struct qsio_scsiio *ctio)
 		TDRIVE_STATS_ADD(tdrive, bytes_read_from_tape, ctio->dxfer_len);
 	TDRIVE_STATS_ADD(tdrive, read_ticks, (ticks - start_ticks));
 
-	if (retval == 0)
+	tdrive_construct_read_sense(tdrive, ctio, retval, fixed, sili, num_blocks, done_blocks, block_size, ili_block_size);
+	return 0;
+}
+
+static int
+tdrive_cmd_read6(struct tdrive *tdrive, struct qsio_scsiio *ctio)
+{
+	uint8_t *cdb = ctio->cdb;
+	uint8_t sili, fixed;
+	uint32_t transfer_length;
+
+	fixed = READ_BIT(cdb[1], 0);
+	sili = READ_BIT(cdb[1], 1);
+
+	if (fixed && sili) {
+		ctio_construct_sense(ctio, SSD_CURRENT_ERROR, SSD_KEY_ILLEGAL_REQUEST, 0, INVALID_FIELD_IN_CDB_ASC, INVALID_FIELD_IN_CDB_ASCQ);  
 		return 0;
+	}
 
-	switch (retval) {
-	case FILEMARK_ENCOUNTERED:
-		tdrive_construct_filemark_sense(tdrive,
-			ctio, fixed,
-			num_blocks, done_blocks, block_size, ili_block_size);
-		break;
-	case SETMARK_ENCOUNTERED:
-		tdrive_construct_setmark_sense(tdrive,
-			ctio, fixed,
-			num_blocks, done_blocks, block_size, ili_block_size);
-		break;
-	case EOD_REACHED:
-		tdrive_construct_eod_sense(tdrive,
-			ctio, fixed,
-			num_blocks, done_blocks, block_size, ili_block_size);
-		break;
-	case UNDERLENGTH_COND_ENCOUNTERED:
-		tdrive_construct_ili_sense(tdrive,
-			ctio, fixed,
-			num_blocks, done_blocks, block_size,
-			sili, UNDERLENGTH_COND_ENCOUNTERED, ili_block_size);
-		break;
-	case OVERLENGTH_COND_ENCOUNTERED:
-		tdrive_construct_ili_sense(tdrive,
-			ctio, fixed,
-			num_blocks, done_blocks, block_size,
-			sili, OVERLENGTH_COND_ENCOUNTERED, ili_block_size);
-		break;
-	case MEDIA_ERROR:
-		TDRIVE_STATS_ADD(tdrive, read_errors, 1);
-		ctio_construct_sense(ctio, SSD_CURRENT_ERROR,
-			SSD_KEY_HARDWARE_ERROR, 0,
-			INTERNAL_TARGET_FAILURE_ASC,
-			INTERNAL_TARGET_FAILURE_ASCQ);
-	default:
-		break;
+	transfer_length = READ_24(cdb[2], cdb[3], cdb[4]);
+	return __tdrive_cmd_read(tdrive, ctio, fixed, sili, transfer_length);
+}
+
+/*
+ * Reads the blocks as READ(6) would, checking their data checksums, and
+ * drops the data. Byte compare and protection information aren't supported
+ */
+static int
+tdrive_cmd_verify6(struct tdrive *tdrive, struct qsio_scsiio *ctio)
+{
+	uint8_t *cdb = ctio->cdb;
+	uint8_t fixed, bytcmp;
+	uint32_t verify_length, block_size, num_blocks;
+	uint32_t done_blocks, total_blocks = 0;
+	uint32_t ili_block_size = 0, compressed_size = 0;
+	int retval;
+
+	fixed = READ_BIT(cdb[1], 0);
+	bytcmp = READ_BIT(cdb[1], 1);
+
+	if (bytcmp || (cdb[1] & 0x38)) {
+		ctio_free_data(ctio);
+		ctio_construct_sense(ctio, SSD_CURRENT_ERROR, SSD_KEY_ILLEGAL_REQUEST, 0, INVALID_FIELD_IN_CDB_ASC, INVALID_FIELD_IN_CDB_ASCQ);  
+		return 0;
 	}
+
+	verify_length = READ_24(cdb[2], cdb[3], cdb[4]);
+	tdrive_empty_write_queue(tdrive);
+	if (!verify_length)
+		return 0;
+
+	if (!fixed) {
+		block_size = verify_length;
+		verify_length = 1;
+	}
+	else {
+		block_size = tdrive_get_block_length(tdrive);
+		if (unlikely(!block_size)) {
+			ctio_construct_sense(ctio, SSD_CURRENT_ERROR, SSD_KEY_ILLEGAL_REQUEST, 0, INVALID_FIELD_IN_CDB_ASC, INVALID_FIELD_IN_CDB_ASCQ);
+			return 0;
+		}
+	}
+
+	/* Read at most TDRIVE_VERIFY_SIZE_MAX bytes at a time */
+	do {
+		num_blocks = min_t(uint32_t, verify_length - total_blocks, max_t(uint32_t, 1, TDRIVE_VERIFY_SIZE_MAX / block_size));
+		done_blocks = 0;
+		retval = tape_cmd_read(tdrive->tape, ctio, block_size, num_blocks, fixed, &done_blocks, &ili_block_size, &compressed_size);
+		ctio_free_data(ctio);
+		if (unlikely(retval < 0)) {
+			debug_warn("tape_partition_read failed\n");
+			ctio_construct_sense(ctio, SSD_CURRENT_ERROR, SSD_KEY_HARDWARE_ERROR, 0, INTERNAL_TARGET_FAILURE_ASC, INTERNAL_TARGET_FAILURE_ASCQ);
+			return 0;
+		}
+		total_blocks += done_blocks;
+	} while (retval == 0 && total_blocks < verify_length);
+
+	tdrive_construct_read_sense(tdrive, ctio, retval, fixed, 0, verify_length, total_blocks, block_size, ili_block_size);
 	return 0;
 }
 
@@ -1944,14 +2206,13 @@ tdrive_cmd_read_block_limits(struct tdrive *tdrive, struct qsio_scsiio *ctio)
 }
 
 static int
-tdrive_cmd_read_position(struct tdrive *tdrive, struct qsio_scsiio *ctio)
+tdrive_read_position_buffer(struct qsio_scsiio *ctio, uint8_t *service_action)
 {
 	uint8_t *cdb = ctio->cdb;
-	uint8_t service_action;
 	uint16_t allocation_length;
 
-	service_action = cdb[1] & 0x1F;
-	switch (service_action) {
+	*service_action = cdb[1] & 0x1F;
+	switch (*service_action) {
 	case READ_POSITION_SHORT:
 		allocation_length = 20;
 		break;
@@ -1969,6 +2230,18 @@ tdrive_cmd_read_position(struct tdrive *tdrive, struct qsio_scsiio *ctio)
 	ctio_allocate_buffer(ctio, allocation_length, Q_WAITOK);
 	if (unlikely(!ctio->data_ptr))
 		return -1;
+	return 0;
+}
+
+static int
+tdrive_cmd_read_position(struct tdrive *tdrive, struct qsio_scsiio *ctio)
+{
+	uint8_t service_action;
+	int retval;
+
+	retval = tdrive_read_position_buffer(ctio, &service_action);
+	if (retval != 0 || !ctio->data_ptr)
+		return retval;
 
 	tdrive_empty_write_queue(tdrive);
 	tape_cmd_read_position(tdrive->tape, ctio, service_action);
@@ -2766,13 +3039,23 @@ static int
 update_data_compression_page(struct tdrive *tdrive, uint8_t *data, int data_len)
 {
 	struct data_compression_page *new = (struct data_compression_page *)data;
+	uint32_t algorithm;
 	uint8_t dce;
 	uint8_t dcc;
 
-	/* Only thing from the data compression page is the dce bit */
+	/* Only thing from the data compression page is the dce bit and the algorithm */
 	dce = new->dcc & 0x80;
 	dcc = tdrive->compression_page.dcc & 0x7F;
 	tdrive->compression_page.dcc = (dcc | dce);
+
+	if (data_len < offsetof(struct data_compression_page, decompression_algorithm))
+		return 0;
+
+	algorithm = be32toh(new->compression_algorithm);
+	if (algorithm == DATA_COMPRESSION_ALG_DEFAULT)
+		tdrive_set_comp_alg(tdrive, tdrive->def_comp_alg, tdrive->def_comp_level);
+	else if (algorithm > DATA_COMPRESSION_ALG_VENDOR && algorithm <= (DATA_COMPRESSION_ALG_VENDOR + DRIVE_COMP_ALG_MAX))
+		tdrive_set_comp_alg(tdrive, algorithm - DATA_COMPRESSION_ALG_VENDOR, 0);
 	return 0;
 }
 
@@ -3165,6 +3448,7 @@ copy_changeable_data_compression_page(struct tdrive *tdrive, uint8_t *buffer, in
 	page.page_code = DATA_COMPRESSION_PAGE;
 	page.page_length = sizeof(struct data_compression_page) - offsetof(struct data_compression_page, dcc);
 	page.dcc |= 0x80; /* Data compression enable modifyable */
+	page.compression_algorithm = 0xFFFFFFFF;
 	memcpy(buffer, &page, min_len);
 }
 
@@ -3896,6 +4180,7 @@ tdrive_cmd_access_ok(struct tdrive *tdrive, struct qsio_scsiio *ctio)
 			case LOCATE_16:
 			case LOAD_UNLOAD:
 			case READ_6:
+			case VERIFY_6:
 			case READ_POSITION:
 			case REWIND:
 			case SPACE:
@@ -3981,6 +4266,7 @@ tdrive_cmd_access_ok(struct tdrive *tdrive, struct qsio_scsiio *ctio)
 		case LOCATE:
 		case LOCATE_16:
 		case READ_6:
+		case VERIFY_6:
 		case READ_POSITION:
 		case REWIND:
 		case SPACE:
@@ -4070,6 +4356,7 @@ tdrive_check_cmd(void *drive, uint8_t op)
 		case SET_CAPACITY:
 		case FORMAT_MEDIUM:
 		case READ_6:
+		case VERIFY_6:
 		case SPACE:
 		case REPORT_LUNS:
 		case PREVENT_ALLOW:
@@ -4255,6 +4542,9 @@ tdrive_proc_cmd(void *drive, void *iop)
 		case READ_6:
 			retval = tdrive_cmd_read6(tdrive, ctio);
 			break;
+		case VERIFY_6:
+			retval = tdrive_cmd_verify6(tdrive, ctio);
+			break;
 		case SPACE:
 			retval = tdrive_cmd_space(tdrive, ctio);
 			break;
@@ -4306,6 +4596,10 @@ tdrive_proc_cmd(void *drive, void *iop)
 	}
 
 out:
+	if (cdb[0] == READ_POSITION)
+		tdrive_publish_state(tdrive, 1);
+	else if (tdrive_cmd_changes_state(cdb[0]))
+		tdrive_publish_state(tdrive, 0);
 	if (!ctio_buffered(ctio))
 		device_send_ccb(ctio);
 	else
@@ -4313,6 +4607,83 @@ out:
 	tdrive_unlock(tdrive);
 }
 
+/*
+ * Serves INQUIRY, TEST UNIT READY, REPORT LUNS, READ BLOCK LIMITS and
+ * READ POSITION from the published drive state without taking tdrive_lock.
+ * Anything that needs the drive lock is handed over to the command devq.
+ */
+void
+tdrive_proc_fast_cmd(void *drive, void *iop)
+{
+	struct tdrive *tdrive = drive;
+	struct qsio_scsiio *ctio = iop;
+	uint8_t *cdb = ctio->cdb;
+	struct initiator_state *istate = ctio->istate;
+	struct sense_info *sinfo;
+	struct tdrive_state state;
+	uint8_t service_action;
+	int retval;
+
+	mtx_lock(tdrive->state_lock);
+	memcpy(&state, &tdrive->state, sizeof(state));
+	mtx_unlock(tdrive->state_lock);
+
+	if (!istate || tdrive->tdevice.reservation.is_reserved)
+		goto requeue;
+
+	/* Keep READ POSITION behind any command which could move the tape */
+	if (cdb[0] == READ_POSITION && (!state.position_valid || atomic_read(&tdrive->write_devq->pending_cmds) || atomic_read(&tdrive->tdevice.devq->pending_cmds)))
+		goto requeue;
+
+	switch(cdb[0]) {
+	case INQUIRY:
+	case REPORT_LUNS:
+		break;
+	default:
+		sinfo = device_get_sense(istate);
+		if (!sinfo)
+			break;
+		ctio_free_data(ctio);
+		device_move_sense(ctio, sinfo);
+		goto out;
+	}
+
+	switch(cdb[0]) {
+	case TEST_UNIT_READY:
+		retval = __tdrive_cmd_test_unit_ready(&state, ctio);
+		break;
+	case INQUIRY:
+		retval = tdrive_cmd_inquiry(tdrive, ctio);
+		break;
+	case READ_BLOCK_LIMITS:
+		retval = tdrive_cmd_read_block_limits(tdrive, ctio);
+		break;
+	case REPORT_LUNS:
+		retval = tdrive_cmd_report_luns(tdrive, ctio);
+		break;
+	case READ_POSITION:
+		retval = tdrive_read_position_buffer(ctio, &service_action);
+		if (retval == 0 && ctio->data_ptr)
+			tape_position_format(ctio, service_action, &state.position);
+		break;
+	default:
+		debug_check(1);
+		goto requeue;
+	}
+
+	if (retval != 0)
+	{
+		debug_check(ctio->dxfer_len);
+		ctio_free_data(ctio);
+		ctio_construct_sense(ctio, SSD_CURRENT_ERROR, SSD_KEY_HARDWARE_ERROR, 0, INTERNAL_TARGET_FAILURE_ASC, INTERNAL_TARGET_FAILURE_ASCQ);
+	}
+out:
+	device_send_ccb(ctio);
+	return;
+requeue:
+	devq_insert_ccb(tdrive->tdevice.devq, (struct qsio_hdr *)ctio);
+}
+
 void
 tdrive_proc_write_cmd(void *drive, void *iop)
 {
@@ -41,6 +41,9 @@
 #define TDRIVE_MAX_BLOCK_SIZE		(8 * 1024 * 1024)
 #define TDRIVE_MAX_PENDING_CMDS		64
 #define TDRIVE_WRITE_CACHE_SIZE		(32 * 1024 * 1024)
+#define TDRIVE_WRITE_CACHE_SIZE_MIN	(4 * 1024 * 1024)
+#define TDRIVE_WRITE_CACHE_SIZE_MAX	(512 * 1024 * 1024)
+#define TDRIVE_VERIFY_SIZE_MAX		(256 * 1024)
 
 struct read_attribute {
 	uint16_t identifier;
@@ -96,6 +99,10 @@ struct data_compression_page {
 	uint32_t rsvd;
 } __attribute__ ((__packed__));
 
+/* Compression algorithm values, vendor specific values select a drive algorithm */
+#define DATA_COMPRESSION_ALG_DEFAULT	0x01
+#define DATA_COMPRESSION_ALG_VENDOR	0xF0
+
 struct medium_partition_page {
 	uint8_t page_code;
 	uint8_t page_length;
@@ -290,6 +297,27 @@ do {									\
 	mtx_unlock(tdrv->stats_lock);					\
 } while (0)
 
+struct tape_position_info {
+	uint8_t bop;
+	uint8_t eop;
+	uint32_t blocks_in_buffer;
+	uint64_t bytes_in_buffer;
+	uint64_t block_number; 
+	uint64_t file_number;
+	uint64_t set_number;
+	uint8_t partition_id;
+};
+
+/* Drive state published for the fast devq under state_lock */
+struct tdrive_state {
+	uint8_t tape_present;
+	uint8_t tape_loaded;
+	uint8_t locked_other;
+	uint8_t position_valid;
+	int media_valid;
+	struct tape_position_info position;
+};
+
 struct tdrive {
 	struct tdevice tdevice;
 	struct qs_devq *write_devq;
@@ -312,8 +340,24 @@ struct tdrive {
 	uint8_t erase_from_bot; /* Set if this tape erases the entire medium on receiving an erase command */
 	uint8_t add_sense_len;
 	uint8_t serial_len;
+	uint8_t comp_level;
+	uint8_t def_comp_alg;
+	uint8_t def_comp_level;
+	uint8_t data_csum;
+
+	/* Adaptive compression bypass, only updated from the write devq */
+	uint64_t comp_sample_bytes;
+	uint64_t comp_sample_stored;
+	uint64_t comp_bypass_bytes;
+	uint64_t comp_bypass_interval;
+
+	/* Buffered writes block while the partition has this much pending */
+	uint32_t write_cache_size;
+	wait_chan_t *write_cache_wait;
 
 	mtx_t *stats_lock;
+	mtx_t *state_lock;
+	struct tdrive_state state;
 	sx_t *tdrive_lock;
 	struct tdrive_handlers handlers;
 	struct tdrive_stats stats;
@@ -344,6 +388,17 @@ do {									\
 	sx_xunlock((tdrv)->tdrive_lock);				\
 } while (0)
 
+/*
+ * Compression is sampled over COMP_SAMPLE_SIZE bytes of writes. If the data
+ * saved is below COMP_BYPASS_RATIO percent, compression is skipped for the
+ * next comp_bypass_interval bytes, which doubles each time the data probes
+ * incompressible again
+ */
+#define COMP_SAMPLE_SIZE		(4ULL * 1024 * 1024)
+#define COMP_BYPASS_RATIO		97
+#define COMP_BYPASS_INTERVAL_MIN	(16ULL * 1024 * 1024)
+#define COMP_BYPASS_INTERVAL_MAX	(1024ULL * 1024 * 1024)
+
 #define TDRIVE_COMPRESSION_ENABLED(tdrive) ((tdrive->compression_page.dcc & 0x80))
 #define TDRIVE_GET_BUFFERED_MODE(tdrive) (((tdrive->mode_header.wp >> 4) & 0x07))
 #define TDRIVE_SET_BUFFERED_MODE(tdrive) (tdrive->mode_header.wp |= (1 << 4));
@@ -412,6 +467,7 @@ void tdrive_proc_cmd(void *drive, void *iop);
 void  __tdrive_proc_cmd(struct tdrive *tdrive, struct qsio_scsiio *ctio);
 int tdrive_check_cmd(void *drive, uint8_t op);
 void tdrive_proc_write_cmd(void *drive, void *iop);
+void tdrive_proc_fast_cmd(void *drive, void *iop);
 int tdrive_load_tape(struct tdrive *drive, struct tape *tape);
 int tdrive_unload_tape(struct tdrive *drive, struct qsio_scsiio *ctio);
 int tdrive_config_worm(struct tdrive *tdrive, int enable);
@@ -421,10 +477,11 @@ int tdrive_copy_vital_product_page_info(struct tdrive *tdrive, uint8_t *buffer,
 
 
 int tdrive_new_vcartridge(struct tdrive *tdrive, struct vcartridge *vinfo);
-int tdrive_load_vcartridge(struct tdrive *tdrive, struct vcartridge *vinfo);
+int tdrive_load_vcartridge(struct tdrive *tdrive, struct vcartridge *vinfo, struct tape *tape);
 
 /* exported routines */
 int tdrive_compression_enabled(struct tdrive *tdrive);
+uint16_t tdrive_comp_type(struct tdrive *tdrive);
 int tdrive_read_position(struct tdrive *tdrive, struct tl_entryinfo *entryinfo);
 int tdrive_delete_vcartridge(struct tdrive *tdrive, struct vcartridge *vcartridge);
 int tdrive_vcartridge_info(struct tdrive *tdrive, struct vcartridge *vcartridge);
@@ -156,9 +156,14 @@ device_wait_all_initiators(struct istate_list *lhead)
 }
 
 void
-device_free_all_initiators(struct istate_list *lhead)
+device_free_all_initiators(struct tdevice *tdevice)
 {
+	struct istate_list *lhead = &tdevice->istate_list;
 	struct initiator_state *iter;
+	int i;
+
+	for (i = 0; i < ISTATE_HASH_BUCKETS; i++)
+		SLIST_INIT(&tdevice->istate_hash[i]);
 
 	while ((iter = SLIST_FIRST(lhead)) != NULL) {
 		SLIST_REMOVE_HEAD(lhead, i_list);
@@ -167,12 +172,13 @@ device_free_all_initiators(struct istate_list *lhead)
 }
 
 void
-device_free_stale_initiators(struct istate_list *lhead)
+device_free_stale_initiators(struct tdevice *tdevice)
 {
-	struct initiator_state *iter, *prev = NULL;
+	struct istate_list *lhead = &tdevice->istate_list;
+	struct initiator_state *iter, *next, *prev = NULL;
 	unsigned long elapsed;
 
-	SLIST_FOREACH(iter, lhead, i_list) {
+	SLIST_FOREACH_SAFE(iter, lhead, i_list, next) {
 		elapsed = get_elapsed(iter->timestamp);
 		if (ticks_to_msecs(elapsed) < stale_initiator_timeout) {
 			prev = iter;
@@ -183,6 +189,7 @@ device_free_stale_initiators(struct istate_list *lhead)
 			SLIST_REMOVE_AFTER(prev, i_list);
 		else
 			SLIST_REMOVE_HEAD(lhead, i_list);
+		SLIST_REMOVE(&tdevice->istate_hash[istate_hash(iter->i_prt, iter->t_prt, iter->init_int)], iter, initiator_state, h_list);
 		free_initiator_state(iter);
 	}
 }
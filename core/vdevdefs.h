@@ -536,22 +536,18 @@ int fc_initiator_check(uint64_t wwpn[], void *device);
 static inline struct initiator_state *
 __device_get_initiator_state(struct tdevice *tdevice, uint64_t i_prt[], uint64_t t_prt[], uint16_t r_prt, uint8_t init_int, int alloc, int check)
 {
-	struct istate_list *istate_list = &tdevice->istate_list;
-	struct initiator_state *iter, *prev = NULL;
+	struct istate_list *istate_bucket;
+	struct initiator_state *iter;
 
-	SLIST_FOREACH(iter, istate_list, i_list) {
+	istate_bucket = &tdevice->istate_hash[istate_hash(i_prt, t_prt, init_int)];
+	SLIST_FOREACH(iter, istate_bucket, h_list) {
 		if (port_equal(iter->i_prt, i_prt) && port_equal(iter->t_prt, t_prt) && iter->init_int == init_int) {
 			if (iter->disallowed)
 				return NULL;
-			if (prev) {
-				SLIST_REMOVE_AFTER(prev, i_list);
-				SLIST_INSERT_HEAD(istate_list, iter, i_list);
-			}
 			iter->timestamp = ticks;
 			istate_get(iter);
 			return iter;
 		}
-		prev = iter;
 	}
 
 	if (!alloc)
@@ -568,7 +564,8 @@ __device_get_initiator_state(struct tdevice *tdevice, uint64_t i_prt[], uint64_t
 	iter = __uma_zalloc(istate_cache, Q_WAITOK | Q_ZERO, sizeof(*iter));
 	init_istate(iter, i_prt, t_prt, r_prt, init_int);
 	iter->timestamp = ticks; 
-	SLIST_INSERT_HEAD(istate_list, iter, i_list);
+	SLIST_INSERT_HEAD(&tdevice->istate_list, iter, i_list);
+	SLIST_INSERT_HEAD(istate_bucket, iter, h_list);
 	istate_get(iter);
 	return iter;
 }
@@ -662,18 +659,17 @@ free_initiator_state(struct initiator_state *istate)
 static inline void
 device_free_initiator_state2(struct tdevice *tdevice, uint64_t i_prt[], uint64_t t_prt[], uint8_t init_int)
 {
-	struct initiator_state *iter, *prev = NULL;
+	struct istate_list *istate_bucket;
+	struct initiator_state *iter;
 
+	istate_bucket = &tdevice->istate_hash[istate_hash(i_prt, t_prt, init_int)];
 	tdevice_reservation_lock(tdevice);
-	SLIST_FOREACH(iter, &tdevice->istate_list, i_list) {
+	SLIST_FOREACH(iter, istate_bucket, h_list) {
 		if (port_equal(iter->i_prt, i_prt) && port_equal(iter->t_prt, t_prt) && iter->init_int == init_int) {
-			if (prev)
-				SLIST_REMOVE_AFTER(prev, i_list);
-			else
-				SLIST_REMOVE_HEAD(&tdevice->istate_list, i_list);
+			SLIST_REMOVE(istate_bucket, iter, initiator_state, h_list);
+			SLIST_REMOVE(&tdevice->istate_list, iter, initiator_state, i_list);
 			break;
 		}
-		prev = iter;
 	}
 	tdevice_reservation_unlock(tdevice);
 
@@ -717,7 +713,7 @@ device_queue_ctio_list(struct ccb_list *ctio_list)
 			(*fc_icbs->ctio_exec)(ctio);
 		}
 		else {
-			devq_insert_ccb(ccb_h->tdevice->devq, ccb_h);
+			devq_insert_ccb(tdevice_devq(ccb_h->tdevice, ccb_h), ccb_h);
 		}
 	}
 }
@@ -763,7 +759,7 @@ device_queue_ctio(struct tdevice *tdevice, struct qsio_scsiio *ctio)
 	ctio->istate = istate;
 	exec = istate_queue_cmd(istate, ctio, 0);
 	if (exec)
-		devq_insert_ccb(ccb_h->tdevice->devq, ccb_h);
+		devq_insert_ccb(tdevice_devq(ccb_h->tdevice, ccb_h), ccb_h);
 	return exec;
 }
 
@@ -813,9 +809,9 @@ void device_add_sense(struct initiator_state *istate, uint8_t error_code, uint8_
 int device_find_sense(struct initiator_state *istate, uint8_t sense_key, uint8_t asc, uint8_t ascq);
 int device_request_sense(struct qsio_scsiio *ctio, struct initiator_state *istate, int add_sense_len);
 void device_unit_attention(struct tdevice *tdevice, int all, uint64_t i_prt[], uint64_t t_prt[], uint8_t init_int, uint8_t asc, uint8_t ascq, int ignore_dup);
-void device_free_all_initiators(struct istate_list *lhead);
+void device_free_all_initiators(struct tdevice *tdevice);
 void device_wait_all_initiators(struct istate_list *lhead);
-void device_free_stale_initiators(struct istate_list *lhead);
+void device_free_stale_initiators(struct tdevice *tdevice);
 struct logical_unit_naa_identifier;
 void device_init_naa_identifier(struct logical_unit_naa_identifier *naa_identifier, char *serial_number);
 struct logical_unit_identifier;
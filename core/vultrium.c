@@ -216,7 +216,8 @@ static void
 vultrium_update_data_compression_page(struct tdrive *tdrive)
 {
 	struct data_compression_page *page = &tdrive->compression_page;
-	page->compression_algorithm = be32toh(0x01);
+
+	/* compression_algorithm is set by tdrive_init_data_compression_page */
 	page->decompression_algorithm = be32toh(0x01);
 }
 
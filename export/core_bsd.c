@@ -109,6 +109,7 @@ coremod_ioctl(struct cdev *dev, unsigned long cmd, caddr_t arg, int fflag, struc
 	case TLTARGIOCDELETEVCARTRIDGE:
 	case TLTARGIOCGETVCARTRIDGEINFO:
 	case TLTARGIOCRELOADEXPORT:
+	case TLTARGIOCLOADVCARTRIDGESTATUS:
 		vcartridge = malloc(sizeof(*vcartridge), M_COREBSD, M_WAITOK);
 		if (!vcartridge) {
 			retval = -ENOMEM;
@@ -125,6 +126,8 @@ coremod_ioctl(struct cdev *dev, unsigned long cmd, caddr_t arg, int fflag, struc
 			retval = (*kcbs.vcartridge_info)(vcartridge);
 		else if (cmd == TLTARGIOCRELOADEXPORT)
 			retval = (*kcbs.vcartridge_reload)(vcartridge);
+		else if (cmd == TLTARGIOCLOADVCARTRIDGESTATUS)
+			retval = (*kcbs.vcartridge_load_status)(vcartridge);
 		memcpy(userp, vcartridge, sizeof(*vcartridge));
 		free(vcartridge, M_COREBSD);
 		break;
@@ -887,6 +887,12 @@ get_cpu_count(void)
 	return num_online_cpus();
 }
 
+static int
+get_cpu_id(void)
+{
+	return raw_smp_processor_id();
+}
+
 struct bio_priv {
 	void *priv;
 	void (*end_bio_func)(bio_t *bio, int err);
@@ -1251,6 +1257,7 @@ static struct qs_kern_cbs kcbs = {
 	.kernel_thread_stop	= __kernel_thread_stop,
 	.sched_prio		= sched_prio,
 	.get_cpu_count		= get_cpu_count,
+	.get_cpu_id		= get_cpu_id,
 	.g_new_bio		= g_new_bio,
 	.bio_free_pages		= bio_free_pages,
 	.bio_add_page		= bio_add_page,
@@ -1503,6 +1510,7 @@ static int coremod_ioctl(vnode_t *i, struct file *f, uint32_t cmd, unsigned long
 	case TLTARGIOCDELETEVCARTRIDGE:
 	case TLTARGIOCGETVCARTRIDGEINFO:
 	case TLTARGIOCRELOADEXPORT:
+	case TLTARGIOCLOADVCARTRIDGESTATUS:
 		vcartridge = malloc(sizeof(*vcartridge), M_QUADSTOR, M_WAITOK);
 		if (!vcartridge) {
 			retval = -ENOMEM;
@@ -1524,6 +1532,8 @@ static int coremod_ioctl(vnode_t *i, struct file *f, uint32_t cmd, unsigned long
 			retval = (*kcbs.vcartridge_info)(vcartridge);
 		else if (cmd == TLTARGIOCRELOADEXPORT)
 			retval = (*kcbs.vcartridge_reload)(vcartridge);
+		else if (cmd == TLTARGIOCLOADVCARTRIDGESTATUS)
+			retval = (*kcbs.vcartridge_load_status)(vcartridge);
 		if (retval == 0)
 			retval = copyout(vcartridge, userp, sizeof(*vcartridge));
 		else
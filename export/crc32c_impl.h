@@ -0,0 +1,218 @@
+/* 
+ * Copyright (C) Shivaram Upadhyayula <shivaram.u@quadstor.com>
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * Version 2 as published by the Free Software Foundation
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+ * Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * CRC32C (Castagnoli) used by both the core block checksums and the iSCSI
+ * digests. Included by a single source file in each module, which then
+ * calls crc32c_impl_init once at load.
+ */
+
+#ifndef QUADSTOR_CRC32C_IMPL_H_
+#define QUADSTOR_CRC32C_IMPL_H_
+
+/* Reflected polynomial */
+#define CRC32C_POLY	0x82F63B78
+
+typedef uint32_t (*crc32c_fn_t)(uint32_t crc, const uint8_t *data, int len);
+
+/* Slicing-by-8 tables, built in crc32c_impl_init */
+static uint32_t crc32c_table[8][256];
+
+#if defined(__amd64__) || defined(__x86_64__)
+/*
+ * Large buffers are split into three interleaved streams of CRC32C_STRIDE
+ * bytes so that the crc32 instruction latency is hidden. The streams are
+ * merged by shifting a crc over CRC32C_STRIDE zero bytes, which is linear
+ * and done with byte tables instead of PCLMUL
+ */
+#define CRC32C_STRIDE	512
+static uint32_t crc32c_shift_table[4][256];
+#endif
+
+static uint32_t
+crc32c_sb8(uint32_t crc, const uint8_t *data, int len)
+{
+	uint32_t lo, hi;
+
+	while (len && ((unsigned long)data & 7)) {
+		crc = crc32c_table[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+		len--;
+	}
+
+	while (len >= 8) {
+		lo = le32toh(*(uint32_t *)data) ^ crc;
+		hi = le32toh(*(uint32_t *)(data + 4));
+		crc = crc32c_table[7][lo & 0xFF] ^
+		      crc32c_table[6][(lo >> 8) & 0xFF] ^
+		      crc32c_table[5][(lo >> 16) & 0xFF] ^
+		      crc32c_table[4][lo >> 24] ^
+		      crc32c_table[3][hi & 0xFF] ^
+		      crc32c_table[2][(hi >> 8) & 0xFF] ^
+		      crc32c_table[1][(hi >> 16) & 0xFF] ^
+		      crc32c_table[0][hi >> 24];
+		data += 8;
+		len -= 8;
+	}
+
+	while (len--)
+		crc = crc32c_table[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+	return crc;
+}
+
+#if defined(__amd64__) || defined(__x86_64__)
+/*
+ * The SSE4.2 crc32 instruction works on general purpose registers, so it
+ * doesn't need the FPU state saved
+ */
+static uint32_t
+crc32c_sse42(uint32_t crc, const uint8_t *data, int len)
+{
+	uint64_t crc64;
+
+	while (len && ((unsigned long)data & 7)) {
+		__asm__ __volatile__("crc32b %1, %0" : "+r" (crc) : "rm" (*data));
+		data++;
+		len--;
+	}
+
+	crc64 = crc;
+	while (len >= 32) {
+		__asm__ __volatile__("crc32q %1, %0" : "+r" (crc64) : "rm" (*(uint64_t *)data));
+		__asm__ __volatile__("crc32q %1, %0" : "+r" (crc64) : "rm" (*(uint64_t *)(data + 8)));
+		__asm__ __volatile__("crc32q %1, %0" : "+r" (crc64) : "rm" (*(uint64_t *)(data + 16)));
+		__asm__ __volatile__("crc32q %1, %0" : "+r" (crc64) : "rm" (*(uint64_t *)(data + 24)));
+		data += 32;
+		len -= 32;
+	}
+
+	while (len >= 8) {
+		__asm__ __volatile__("crc32q %1, %0" : "+r" (crc64) : "rm" (*(uint64_t *)data));
+		data += 8;
+		len -= 8;
+	}
+	crc = (uint32_t)crc64;
+
+	while (len--) {
+		__asm__ __volatile__("crc32b %1, %0" : "+r" (crc) : "rm" (*data));
+		data++;
+	}
+	return crc;
+}
+
+static inline uint32_t
+crc32c_shift(uint32_t crc)
+{
+	return crc32c_shift_table[0][crc & 0xFF] ^
+	       crc32c_shift_table[1][(crc >> 8) & 0xFF] ^
+	       crc32c_shift_table[2][(crc >> 16) & 0xFF] ^
+	       crc32c_shift_table[3][crc >> 24];
+}
+
+static uint32_t
+crc32c_sse42_3way(uint32_t crc, const uint8_t *data, int len)
+{
+	uint64_t crc0, crc1, crc2;
+	const uint8_t *end;
+
+	while (len && ((unsigned long)data & 7)) {
+		__asm__ __volatile__("crc32b %1, %0" : "+r" (crc) : "rm" (*data));
+		data++;
+		len--;
+	}
+
+	while (len >= 3 * CRC32C_STRIDE) {
+		crc0 = crc;
+		crc1 = crc2 = 0;
+		end = data + CRC32C_STRIDE;
+		while (data < end) {
+			__asm__ __volatile__("crc32q %1, %0" : "+r" (crc0) : "rm" (*(uint64_t *)data));
+			__asm__ __volatile__("crc32q %1, %0" : "+r" (crc1) : "rm" (*(uint64_t *)(data + CRC32C_STRIDE)));
+			__asm__ __volatile__("crc32q %1, %0" : "+r" (crc2) : "rm" (*(uint64_t *)(data + 2 * CRC32C_STRIDE)));
+			data += 8;
+		}
+		crc = crc32c_shift(crc32c_shift((uint32_t)crc0) ^ (uint32_t)crc1) ^ (uint32_t)crc2;
+		data += 2 * CRC32C_STRIDE;
+		len -= 3 * CRC32C_STRIDE;
+	}
+
+	return crc32c_sse42(crc, data, len);
+}
+
+static int
+crc32c_cpu_has_sse42(void)
+{
+	uint32_t eax = 1, ebx, ecx, edx;
+
+	__asm__ __volatile__("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+	return (ecx & (1 << 20)) != 0;
+}
+#endif
+
+/* Builds the tables and returns the fastest implementation for this cpu */
+static crc32c_fn_t
+crc32c_impl_init(void)
+{
+	uint32_t crc;
+	int i, j;
+#if defined(__amd64__) || defined(__x86_64__)
+	uint32_t col[32];
+	int k;
+#endif
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = (crc & 1) ? ((crc >> 1) ^ CRC32C_POLY) : (crc >> 1);
+		crc32c_table[0][i] = crc;
+	}
+
+	for (i = 0; i < 256; i++) {
+		crc = crc32c_table[0][i];
+		for (j = 1; j < 8; j++) {
+			crc = crc32c_table[0][crc & 0xFF] ^ (crc >> 8);
+			crc32c_table[j][i] = crc;
+		}
+	}
+
+#if defined(__amd64__) || defined(__x86_64__)
+	/* Shifting a single bit state over zeros gives one bit's contribution */
+	for (i = 0; i < 32; i++) {
+		crc = 1U << i;
+		for (j = 0; j < CRC32C_STRIDE; j++)
+			crc = crc32c_table[0][crc & 0xFF] ^ (crc >> 8);
+		col[i] = crc;
+	}
+
+	for (i = 0; i < 4; i++) {
+		for (j = 0; j < 256; j++) {
+			crc = 0;
+			for (k = 0; k < 8; k++) {
+				if (j & (1 << k))
+					crc ^= col[i * 8 + k];
+			}
+			crc32c_shift_table[i][j] = crc;
+		}
+	}
+
+	if (crc32c_cpu_has_sse42())
+		return crc32c_sse42_3way;
+#endif
+	return crc32c_sb8;
+}
+
+#endif
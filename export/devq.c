@@ -6,34 +6,42 @@ MALLOC_DEFINE(M_DEVQ, "ldev devq", "QUADStor ldev devq allocs");
 #include "ldev_linux.h"
 #endif
 
-static inline struct qsio_hdr *
-get_next_ccb(struct qs_devq *devq)
+static inline void
+get_next_batch(struct qs_devq *devq, struct ccb_list *batch)
 {
-	struct qsio_hdr *ccb;
-#ifdef LINUX
-	unsigned long flags;
-#endif
+	struct qsio_hdr *ccb, *next;
 
-	mtx_lock_irqsave(&devq->devq_lock, flags);
-	ccb = STAILQ_FIRST(&devq->pending_queue);
-	if (ccb)
-		STAILQ_REMOVE_HEAD(&devq->pending_queue, c_list);
-	mtx_unlock_irqrestore(&devq->devq_lock, flags);
-
-	return ccb;
+	ccb = devq_take_ptr(&devq->pending_head);
+	while (ccb) {
+		next = STAILQ_NEXT(ccb, c_list);
+		STAILQ_INSERT_HEAD(batch, ccb, c_list);
+		ccb = next;
+	}
 }
 
 /* process_queue returns only after draining the queue */
 static inline void
 devq_process_queue(struct qs_devq *devq)
 {
+	struct ccb_list batch;
 	struct qsio_hdr *ccb_h;
 
-	while ((ccb_h = get_next_ccb(devq)) != NULL)
-	{
-		/* process the commands.  */
-		ldev_proc_cmd((struct qsio_scsiio *)ccb_h); 
+	STAILQ_INIT(&batch);
+	devq->running = 1;
+	devq_mb();
+	for (;;) {
+		get_next_batch(devq, &batch);
+		if (STAILQ_EMPTY(&batch))
+			break;
+
+		while ((ccb_h = STAILQ_FIRST(&batch)) != NULL) {
+			STAILQ_REMOVE_HEAD(&batch, c_list);
+			/* process the commands.  */
+			ldev_proc_cmd((struct qsio_scsiio *)ccb_h); 
+		}
 	}
+	devq->running = 0;
+	devq_mb();
 }
 
 #ifdef LINUX
@@ -52,7 +60,7 @@ devq_thread(void *data)
 	__set_current_state(TASK_RUNNING);
 
 	for (;;) {
-		wait_on_chan_interruptible(devq->devq_wait, !STAILQ_EMPTY(&devq->pending_queue) || kernel_thread_check(&devq->flags, DEVQ_SHUTDOWN));
+		wait_on_chan_interruptible(devq->devq_wait, devq->pending_head != NULL || kernel_thread_check(&devq->flags, DEVQ_SHUTDOWN));
 
 		devq_process_queue(devq);
 		if (unlikely(kernel_thread_check(&devq->flags, DEVQ_SHUTDOWN)))
@@ -93,10 +101,7 @@ devq_init(uint32_t base_id, const char *name)
 		return NULL;
 	}
 
-	devq->next_ccb = get_next_ccb;
 	wait_chan_init(&devq->devq_wait, "qs devq wait");
-	STAILQ_INIT(&devq->pending_queue);
-	mtx_lock_initt(&devq->devq_lock, "qs devq");
 
 	retval = kernel_thread_create(devq_thread, devq, devq->task, "%s%d", name, base_id);
 	if(retval != 0) {
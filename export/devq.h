@@ -8,13 +8,23 @@
 #endif
 #include "exportdefs.h"
 
+/* Lock-free push, see core/devq.h */
+#ifdef LINUX
+#define devq_cmpset_ptr(p, old, new)	(cmpxchg((p), (old), (new)) == (old))
+#define devq_take_ptr(p)		xchg((p), NULL)
+#define devq_mb()			smp_mb()
+#else
+#define devq_cmpset_ptr(p, old, new)	atomic_cmpset_ptr((volatile uintptr_t *)(p), (uintptr_t)(old), (uintptr_t)(new))
+#define devq_take_ptr(p)		((struct qsio_hdr *)atomic_readandclear_ptr((volatile uintptr_t *)(p)))
+#define devq_mb()			mb()
+#endif
+
 struct qs_devq {
-	struct qsio_hdr *(*next_ccb) (struct qs_devq *);
-	struct ccb_list pending_queue;
+	struct qsio_hdr *pending_head;
 	wait_chan_t devq_wait;
 	kproc_t *task;
 	int flags;
-	mtx_t devq_lock;
+	volatile int running;
 };
 
 struct qs_devq * devq_init(uint32_t base_id, const char *name);
@@ -25,14 +35,15 @@ void devq_exit(struct qs_devq *devq);
 static inline void
 devq_insert_ccb(struct qs_devq *devq, struct qsio_hdr *ccb_h)
 {
-#ifdef LINUX
-	unsigned long flags;
-#endif
+	struct qsio_hdr *head;
+
+	do {
+		head = devq->pending_head;
+		STAILQ_NEXT(ccb_h, c_list) = head;
+	} while (!devq_cmpset_ptr(&devq->pending_head, head, ccb_h));
 
-	mtx_lock_irqsave(&devq->devq_lock, flags);
-	STAILQ_INSERT_TAIL(&devq->pending_queue, ccb_h, c_list);
-	mtx_unlock_irqrestore(&devq->devq_lock, flags);
-	chan_wakeup_one(&devq->devq_wait);
+	if (!head && !devq->running)
+		chan_wakeup_one(&devq->devq_wait);
 }
 
 #ifdef FREEBSD
@@ -150,6 +150,7 @@ struct qs_kern_cbs {
 	int (*kernel_thread_stop)(kproc_t *task, int *flags, void *chan, int bit);
 	void (*sched_prio)(int prio);
 	int (*get_cpu_count)(void);
+	int (*get_cpu_id)(void);
 	bio_t* (*g_new_bio)(iodev_t *iodev, void (*end_bio_func)(bio_t *, int), void *consumer, uint64_t bi_sector, int bio_vec_count, int rw);
 	void (*bio_free_pages)(bio_t *bio);
 	int (*bio_add_page)(bio_t *bio, pagestruct_t *pp, unsigned int len, unsigned int offset);
@@ -198,6 +199,7 @@ struct qs_kern_cbs {
 	int (*vcartridge_delete)(struct vcartridge *);
 	int (*vcartridge_info)(struct vcartridge *);
 	int (*vcartridge_reload)(struct vcartridge *);
+	int (*vcartridge_load_status)(struct vcartridge *);
 	int (*coremod_load_done)(void);
 	int (*coremod_qload_done)(void);
 	int (*coremod_check_disks)(void);
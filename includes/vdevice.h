@@ -48,6 +48,7 @@ struct vtlconf * vtlconf_new(int tl_id, char *name, char *serialnumber);
 struct tdriveconf * tdriveconf_new(int tl_id, int target_id, char *name, char *serialnumber);
 int dump_vdevice(FILE *fp, struct vdevice *vdevice, int dumpdrivelist);
 int dump_volume(FILE *fp, struct vcartridge *vinfo);
+int dump_volume_info(FILE *fp, struct vcartridge *volume);
 struct vdevice * parse_vdevice(FILE *fp);
 void free_vdevice(struct vdevice *);
 struct vdevice * find_vdevice_by_name(char *name);
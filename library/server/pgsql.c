@@ -21,8 +21,47 @@
 #include <apicommon.h>
 #include <physlib.h>
 #include <libpq-fe.h>
+#include <pthread.h>
+#include "pgsql.h"
 
 #define CONN_STRING		"dbname=qsdb user=vtdbuser password=vtdbuser port=9989"
+#define PGSQL_POOL_MAX		8
+
+/*
+ * Connections are kept in a small pool and reused across queries. Statements
+ * on the cartridge add path are prepared once per connection.
+ */
+static PGconn *pgsql_pool[PGSQL_POOL_MAX];
+static int pgsql_pool_count;
+static pthread_mutex_t pgsql_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct pgsql_stmt {
+	char *name;
+	char *query;
+	int nparams;
+} pgsql_stmts[] = {
+	{ PGSQL_STMT_VCART_INSERT, "INSERT INTO VCARTRIDGE (TAPEID, GROUPID, TLID, VTYPE, LABEL, VSIZE, WORM) VALUES ($1, $2, $3, $4, $5, $6, $7)", 7 },
+	{ PGSQL_STMT_VCART_LABEL, "SELECT LABEL FROM VCARTRIDGE WHERE LOWER(LABEL) = LOWER($1)", 1 },
+	{ PGSQL_STMT_VCART_TAPEID, "SELECT TAPEID FROM VCARTRIDGE WHERE TAPEID = $1", 1 },
+};
+
+static int
+pgsql_prepare_stmts(PGconn *conn)
+{
+	PGresult *res;
+	int i;
+
+	for (i = 0; i < sizeof(pgsql_stmts) / sizeof(pgsql_stmts[0]); i++) {
+		res = PQprepare(conn, pgsql_stmts[i].name, pgsql_stmts[i].query, pgsql_stmts[i].nparams, NULL);
+		if (PQresultStatus(res) >= PGRES_BAD_RESPONSE) {
+			DEBUG_ERR_SERVER("Prepare of %s failed error is %s\n", pgsql_stmts[i].name, PQerrorMessage(conn));
+			PQclear(res);
+			return -1;
+		}
+		PQclear(res);
+	}
+	return 0;
+}
 
 PGconn *
 pgsql_make_conn(void)
@@ -35,23 +74,90 @@ pgsql_make_conn(void)
 		PQfinish(conn);
 		return NULL;
 	}
+
+	if (pgsql_prepare_stmts(conn) != 0) {
+		PQfinish(conn);
+		return NULL;
+	}
 	return conn;
 }
 
+PGconn *
+pgsql_get_conn(void)
+{
+	PGconn *conn = NULL;
+
+	pthread_mutex_lock(&pgsql_pool_lock);
+	while (pgsql_pool_count) {
+		conn = pgsql_pool[--pgsql_pool_count];
+		if (PQstatus(conn) == CONNECTION_OK)
+			break;
+		PQfinish(conn);
+		conn = NULL;
+	}
+	pthread_mutex_unlock(&pgsql_pool_lock);
+
+	if (conn)
+		return conn;
+	return pgsql_make_conn();
+}
+
+void
+pgsql_put_conn(PGconn *conn)
+{
+	if (PQstatus(conn) != CONNECTION_OK || PQtransactionStatus(conn) != PQTRANS_IDLE) {
+		PQfinish(conn);
+		return;
+	}
+
+	pthread_mutex_lock(&pgsql_pool_lock);
+	if (pgsql_pool_count < PGSQL_POOL_MAX) {
+		pgsql_pool[pgsql_pool_count++] = conn;
+		conn = NULL;
+	}
+	pthread_mutex_unlock(&pgsql_pool_lock);
+
+	if (conn)
+		PQfinish(conn);
+}
+
+/*
+ * A pooled connection can have gone stale if the db was restarted. Retry
+ * once on a fresh connection
+ */
+static PGresult *
+pgsql_exec_retry(PGconn **ret_conn, char *sqlcmd)
+{
+	PGconn *conn = *ret_conn;
+	PGresult *res;
+
+	res = PQexec(conn, sqlcmd);
+	if (PQresultStatus(res) < PGRES_BAD_RESPONSE || PQstatus(conn) == CONNECTION_OK)
+		return res;
+
+	PQclear(res);
+	PQfinish(conn);
+	conn = pgsql_make_conn();
+	*ret_conn = conn;
+	if (!conn)
+		return NULL;
+	return PQexec(conn, sqlcmd);
+}
+
 PGresult *
-__pgsql_exec_query(char *conn_string, char *sqlcmd, PGconn **ret_conn)
+pgsql_exec_query(char *sqlcmd, PGconn **ret_conn)
 {
 	PGconn *conn;
 	PGresult *res;
 
-	conn = PQconnectdb(conn_string); 
-	if (PQstatus(conn) != CONNECTION_OK) {
-		DEBUG_ERR_SERVER("Connect to db failed error is %s\n", PQerrorMessage(conn));
-		PQfinish(conn);
+	conn = pgsql_get_conn();
+	if (!conn)
+		return NULL;
+
+	res = pgsql_exec_retry(&conn, sqlcmd);
+	if (!conn)
 		return NULL;
-	}
 
-	res = PQexec(conn, sqlcmd);
 	if (PQresultStatus(res) >= PGRES_BAD_RESPONSE) {
 		DEBUG_ERR_SERVER("sqlcmd %s failed error is %s status is %d\n", sqlcmd, PQerrorMessage(conn), PQresultStatus(res));
 		goto err;
@@ -61,13 +167,22 @@ __pgsql_exec_query(char *conn_string, char *sqlcmd, PGconn **ret_conn)
 	return res;
 err:
 	PQclear(res);
-	PQfinish(conn);
+	pgsql_put_conn(conn);
 	return NULL;
 }
 
-PGresult *pgsql_exec_query(char *sqlcmd, PGconn **ret_conn)
+PGresult *
+pgsql_exec_prepared(PGconn *conn, char *stmt, int nparams, const char * const *params)
 {
-	return __pgsql_exec_query(CONN_STRING, sqlcmd, ret_conn);
+	PGresult *res;
+
+	res = PQexecPrepared(conn, stmt, nparams, params, NULL, NULL, 0);
+	if (PQresultStatus(res) >= PGRES_BAD_RESPONSE) {
+		DEBUG_ERR_SERVER("stmt %s failed error is %s status is %d\n", stmt, PQerrorMessage(conn), PQresultStatus(res));
+		PQclear(res);
+		return NULL;
+	}
+	return res;
 }
 
 int
@@ -88,7 +203,7 @@ pgsql_rollback(PGconn *conn)
 	}
 
 	PQclear(res);
-	PQfinish(conn);
+	pgsql_put_conn(conn);
 	return retval;
 }
 
@@ -106,41 +221,35 @@ pgsql_commit(PGconn *conn)
 		return -1;
 	}
 	PQclear(res);
-	PQfinish(conn);
+	pgsql_put_conn(conn);
 	return 0;
 }
 
 PGconn *
-__pgsql_begin(char *conn_string)
+pgsql_begin(void)
 {
 	PGconn *conn;
 	PGresult *res;
 
-	conn = PQconnectdb(conn_string);
-	if (PQstatus(conn) != CONNECTION_OK)
-	{
-		DEBUG_ERR_SERVER("Connect to db failed error is %s\n", PQerrorMessage(conn));
-		PQfinish(conn);
+	conn = pgsql_get_conn();
+	if (!conn)
 		return NULL;
-	}
-	res = PQexec(conn, "BEGIN");
+
+	res = pgsql_exec_retry(&conn, "BEGIN");
+	if (!conn)
+		return NULL;
+
 	if (PQresultStatus(res) >= PGRES_BAD_RESPONSE)
 	{
 		DEBUG_ERR_SERVER("Unable to start a new transaction, error is %s status is %d\n", PQerrorMessage(conn), PQresultStatus(res));
 		PQclear(res);
-		PQfinish(conn);
+		pgsql_put_conn(conn);
 		return NULL;
 	}
 	PQclear(res);
 	return conn;
 }
 
-PGconn *
-pgsql_begin(void)
-{
-	return __pgsql_begin(CONN_STRING);
-}
-
 uint64_t 
 pgsql_exec_query3(PGconn *conn, char *sqlcmd, int isinsert, int *error, char *table, char *seqcol)
 {
@@ -185,37 +294,49 @@ pgsql_exec_query3(PGconn *conn, char *sqlcmd, int isinsert, int *error, char *ta
 
 
 uint64_t 
-__pgsql_exec_query2(char *conn_string, char *sqlcmd, int isinsert, int *error, char *table, char *seqcol)
+pgsql_exec_query2(char *sqlcmd, int isinsert, int *error, char *table, char *seqcol)
 {
 	PGconn *conn;
 	uint64_t id = 0;
 	PGresult *res;
 
 	*error = 0;
-	conn = PQconnectdb(conn_string); 
-	if (PQstatus(conn) != CONNECTION_OK)
+	conn = pgsql_get_conn();
+	if (!conn)
 	{
-		DEBUG_ERR_SERVER("Connect to db failed error is %s\n", PQerrorMessage(conn));
-		PQfinish(conn);
 		*error = -1;
 		return 0;
 	}
 
 	if (isinsert)
 	{
-		res = PQexec(conn, "BEGIN");
+		res = pgsql_exec_retry(&conn, "BEGIN");
+		if (!conn)
+		{
+			*error = -1;
+			return 0;
+		}
 		if (PQresultStatus(res) >= PGRES_BAD_RESPONSE)
 		{
 			DEBUG_ERR_SERVER("Unable to start a new transaction, error is %s status is %d\n", PQerrorMessage(conn), PQresultStatus(res));
 			PQclear(res);
-			PQfinish(conn);
+			pgsql_put_conn(conn);
 			*error = -1;
 			return 0;
 		}
 		PQclear(res);
 	}
 
-	res = PQexec(conn, sqlcmd);
+	if (isinsert)
+		res = PQexec(conn, sqlcmd);
+	else
+		res = pgsql_exec_retry(&conn, sqlcmd);
+	if (!conn)
+	{
+		*error = -1;
+		return 0;
+	}
+
 	if (PQresultStatus(res) >= PGRES_BAD_RESPONSE)
 	{
 		if (isinsert)
@@ -226,7 +347,7 @@ __pgsql_exec_query2(char *conn_string, char *sqlcmd, int isinsert, int *error, c
 
 		DEBUG_ERR_SERVER("sqlcmd %s failed: error is %s status is %d\n", sqlcmd, PQerrorMessage(conn), PQresultStatus(res));
 		PQclear(res);
-		PQfinish(conn);
+		pgsql_put_conn(conn);
 		*error = -1;
 		return 0;
 	}
@@ -263,19 +384,13 @@ __pgsql_exec_query2(char *conn_string, char *sqlcmd, int isinsert, int *error, c
 		PQclear(res);
 
 	}
-	PQfinish(conn);
+	pgsql_put_conn(conn);
 	return id;
 
 inserr:
 	res = PQexec(conn, "ROLLBACK");
 	PQclear(res);
-	PQfinish(conn);
+	pgsql_put_conn(conn);
 	*error = -1;
 	return 0;
 }
-
-uint64_t 
-pgsql_exec_query2(char *sqlcmd, int isinsert, int *error, char *table, char *seqcol)
-{
-	return __pgsql_exec_query2(CONN_STRING, sqlcmd, isinsert, error, table, seqcol);
-}
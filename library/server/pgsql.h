@@ -3,9 +3,16 @@
 #include <physlib.h>
 #include <libpq-fe.h>
 
+#define PGSQL_STMT_VCART_INSERT		"vcart_insert"
+#define PGSQL_STMT_VCART_LABEL		"vcart_label"
+#define PGSQL_STMT_VCART_TAPEID		"vcart_tapeid"
+
 extern PGresult *pgsql_exec_query(char *sqlcmd, PGconn **ret_conn);
 uint64_t pgsql_exec_query2(char *sqlcmd, int isinsert, int *error, char *table, char *seqcol);
 PGconn *pgsql_make_conn(void);
+PGconn *pgsql_get_conn(void);
+void pgsql_put_conn(PGconn *conn);
+extern PGresult *pgsql_exec_prepared(PGconn *conn, char *stmt, int nparams, const char * const *params);
 extern uint64_t pgsql_exec_query3(PGconn *conn, char *sqlcmd, int isinsert, int *error, char *table, char *seqcol);
 extern PGconn *pgsql_begin(void);
 extern int pgsql_commit(PGconn *conn);
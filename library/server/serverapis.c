@@ -41,6 +41,10 @@ int done_socket_init;
 int done_server_init;
 int done_init;
 int enable_drive_compression;
+int drive_comp_alg;
+int drive_comp_level;
+int drive_write_cache_size;
+int drive_data_csum;
 pthread_mutex_t daemon_lock = PTHREAD_MUTEX_INITIALIZER;
 pthread_cond_t daemon_cond = PTHREAD_COND_INITIALIZER;
 pthread_cond_t socket_cond = PTHREAD_COND_INITIALIZER;
@@ -379,41 +383,6 @@ tl_server_msg_success(struct tl_comm *comm, struct tl_msg *msg)
 	tl_msg_close_connection(comm);
 }
 
-static int 
-add_new_vcartridge(struct vcartridge *vinfo, char *errmsg)
-{
-	int retval;
-	PGconn *conn;
-
-	conn = pgsql_begin();
-	if (!conn) {
-		return -1;
-	}
-
-	retval = sql_add_vcartridge(conn, vinfo);
-	if (retval != 0) {
-		sprintf(errmsg, "Adding VCartridge information to DB failed\n");
-		goto rollback;
-	}
-
-	retval = tl_ioctl(TLTARGIOCNEWVCARTRIDGE, vinfo);
-	if (retval != 0) {
-		sprintf(errmsg, "Addition of a new VCartridge failed\n");
-		goto rollback;
-	}
-
-	retval = pgsql_commit(conn);
-	if (retval != 0) {
-		tl_ioctl(TLTARGIOCDELETEVCARTRIDGE, vinfo);
-		return -1;
-	}
-
-	return 0;
-rollback:
-	pgsql_rollback(conn);
-	return -1;
-} 
-
 static int
 check_blkdev_exists(char *devname)
 {
@@ -648,7 +617,8 @@ tl_server_delete_vol_conf(struct tl_comm *comm, struct tl_msg *msg)
 		}
 	}
 
-	pgsql_commit(conn);
+	if (pgsql_commit(conn) == 0)
+		sql_vcart_index_remove(vinfo->label, vinfo->tape_id);
 	TAILQ_REMOVE(&vdevice->vol_list, vinfo, q_entry);
 	vcart_list[vinfo->tape_id] = NULL;
 	free(vinfo);
@@ -694,6 +664,34 @@ blkdev_load_volumes(struct tl_blkdevinfo *blkdev)
 	}
 }
 
+/*
+ * Cartridges are loaded asynchronously by the kernel. Collect the result of
+ * each load once all the volumes have been queued
+ */
+static void
+load_volumes_status(void)
+{
+	struct vdevice *vdevice;
+	struct vcartridge *volume;
+	int retval, i;
+
+	for (i = 0; i < TL_MAX_DEVICES; i++) {
+		vdevice = device_list[i];
+		if (!vdevice)
+			continue;
+
+		TAILQ_FOREACH(volume, &vdevice->vol_list, q_entry) {
+			if (volume->loaderror)
+				continue;
+			retval = tl_ioctl(TLTARGIOCLOADVCARTRIDGESTATUS, volume);
+			if (retval != 0) {
+				DEBUG_ERR("Loading of volume %s failed", volume->label);
+				volume->loaderror = 1;
+			}
+		}
+	}
+}
+
 static int
 tl_server_process_lists(void)
 {
@@ -730,6 +728,7 @@ tl_server_process_lists(void)
 			continue;
 		blkdev_load_volumes(blkdev);
 	}
+	load_volumes_status();
 	pthread_mutex_unlock(&bdev_lock);
 
 	return 0;
@@ -1057,13 +1056,13 @@ query_disk_check(void)
 	nrows = PQntuples(res);
 	if (!nrows) {
 		PQclear(res);
-		PQfinish(conn);
+		pgsql_put_conn(conn);
 		return 0;
 	}
 
 	check = atoi(PQgetvalue(res, 0, 0));
 	PQclear(res);
-	PQfinish(conn);
+	pgsql_put_conn(conn);
 	if (!check)
 		return 0;
 
@@ -1139,14 +1138,14 @@ sys_rid_load(void)
 	if (nrows > 1) {
 		DEBUG_ERR("sys_rid_load: Invalid nrows %d\n", nrows);
 		PQclear(res);
-		PQfinish(conn);
+		pgsql_put_conn(conn);
 		return -1;
 	}
 
 	if (nrows == 1)
 		strcpy(sys_rid, PQgetvalue(res, 0, 0));
 	PQclear(res);
-	PQfinish(conn);
+	pgsql_put_conn(conn);
 	if (!sys_rid[0]) {
 		retval = sys_rid_init();
 		if (retval != 0)
@@ -1404,6 +1403,83 @@ get_label_format(char *label, char *suffix, char *labelformat)
 	return atoi(range);
 }
 
+/*
+ * Cartridges are added in batches. The db rows of a batch are committed in a
+ * single transaction before the cartridges are created in the kernel, so
+ * that a cartridge never exists without its row. A row whose cartridge
+ * could not be created is deleted again, or failing that loads with a load
+ * error on the next start and can then be deleted
+ */
+#define VCART_ADD_BATCH		64
+
+static void
+vcart_batch_undo(struct vdevice *vdevice, struct vcartridge **batch, int nbatch)
+{
+	struct vcartridge *vinfo;
+	int i;
+
+	for (i = 0; i < nbatch; i++) {
+		vinfo = batch[i];
+		sql_vcart_index_remove(vinfo->label, vinfo->tape_id);
+		TAILQ_REMOVE(&vdevice->vol_list, vinfo, q_entry);
+		vcart_list[vinfo->tape_id] = NULL;
+		free(vinfo);
+	}
+}
+
+static void
+vcart_batch_delete(struct vdevice *vdevice, struct vcartridge **batch, int nbatch)
+{
+	PGconn *conn;
+	int i, retval = -1;
+
+	conn = pgsql_begin();
+	if (conn) {
+		for (i = 0; i < nbatch; i++) {
+			retval = sql_delete_vcartridge(conn, batch[i]->label);
+			if (retval != 0)
+				break;
+		}
+		if (retval == 0)
+			retval = pgsql_commit(conn);
+		else
+			pgsql_rollback(conn);
+	}
+
+	if (retval == 0) {
+		vcart_batch_undo(vdevice, batch, nbatch);
+		return;
+	}
+
+	for (i = 0; i < nbatch; i++)
+		batch[i]->loaderror = 1;
+}
+
+static int
+vcart_batch_commit(struct vdevice *vdevice, PGconn *conn, struct vcartridge **batch, int nbatch, int *added, char *errmsg)
+{
+	int retval, i;
+
+	retval = pgsql_commit(conn);
+	if (retval != 0) {
+		sprintf(errmsg, "Unable to commit VCartridge information to DB");
+		vcart_batch_undo(vdevice, batch, nbatch);
+		return -1;
+	}
+
+	for (i = 0; i < nbatch; i++) {
+		retval = tl_ioctl(TLTARGIOCNEWVCARTRIDGE, batch[i]);
+		if (retval != 0) {
+			sprintf(errmsg, "Addition of a new VCartridge failed");
+			vcart_batch_delete(vdevice, batch + i, nbatch - i);
+			*added += i;
+			return -1;
+		}
+	}
+	*added += nbatch;
+	return 0;
+}
+
 int
 vdevice_add_volumes(struct vdevice *vdevice, struct group_info *group_info, int voltype, int nvolumes, int worm, char *errmsg, char *label)
 {
@@ -1414,6 +1490,11 @@ vdevice_add_volumes(struct vdevice *vdevice, struct group_info *group_info, int
 	char labelfmt[24];
 	int start = 0, use_free_slot = 0;;
 	char buf[64];
+	char tmpstr[64];
+	struct vcartridge *batch[VCART_ADD_BATCH];
+	int nbatch = 0, added = 0;
+	PGconn *conn = NULL;
+	int retval;
 
 	buf[0] = 0;
 	get_config_value(QUADSTOR_CONFIG_FILE, "UseFreeSlot", buf);
@@ -1440,7 +1521,6 @@ vdevice_add_volumes(struct vdevice *vdevice, struct group_info *group_info, int
 
 	for (i = 0; i < nvolumes; i++)
 	{
-		int retval;
 		struct vcartridge *vinfo;
 		char vollabel[40];
 
@@ -1456,7 +1536,7 @@ vdevice_add_volumes(struct vdevice *vdevice, struct group_info *group_info, int
 			sprintf(vollabel, labelfmt, start);
 			if (!vollabel_valid(vollabel, voltype))
 			{
-				sprintf(errmsg, "VCartridge label \"%s\" is not valid. Number of VCartridges added are %d", vollabel, i);
+				sprintf(errmsg, "VCartridge label \"%s\" is not valid", vollabel);
 				result = -1;
 				break;
 			}
@@ -1465,7 +1545,7 @@ vdevice_add_volumes(struct vdevice *vdevice, struct group_info *group_info, int
 		retval = sql_virtvol_label_unique(vollabel);
 		if (retval != 0)
 		{
-			sprintf(errmsg, "VCartridge label \"%s\" is not unique. Number of VCartridges added are %d", vollabel, i);
+			sprintf(errmsg, "VCartridge label \"%s\" is not unique", vollabel);
 			result = -1;
 			break;
 		}
@@ -1475,8 +1555,9 @@ vdevice_add_volumes(struct vdevice *vdevice, struct group_info *group_info, int
 		vinfo = malloc(sizeof(struct vcartridge));
 		if (!vinfo)
 		{
-			sprintf(errmsg, "Memory allocation failure. Number of VCartridges added are %d", i);
-			return -1;
+			sprintf(errmsg, "Memory allocation failure");
+			result = -1;
+			break;
 		}
 
 		memset(vinfo, 0, sizeof(struct vcartridge));
@@ -1490,29 +1571,59 @@ vdevice_add_volumes(struct vdevice *vdevice, struct group_info *group_info, int
 		vinfo->use_free_slot = use_free_slot;
 		vinfo->tape_id = get_next_tape_id();
 		if (!vinfo->tape_id) {
-			sprintf(errmsg, "Reached maximum possible tape ids. A service restart might help. Number of VCartridges added are %d", i);
+			sprintf(errmsg, "Reached maximum possible tape ids. A service restart might help");
 			free(vinfo);
-			return -1;
+			result = -1;
+			break;
 		}
 
-		retval = add_new_vcartridge(vinfo, errmsg);
+		if (!conn) {
+			conn = pgsql_begin();
+			if (!conn) {
+				sprintf(errmsg, "Unable to connect to db");
+				free(vinfo);
+				result = -1;
+				break;
+			}
+		}
 
+		retval = sql_add_vcartridge(conn, vinfo);
 		if (retval != 0) {
-			char tmpstr[64];
-
-			sprintf(tmpstr, ". Number of VCartridges added are %d", i);
-			strcat(errmsg, tmpstr);
-
+			sprintf(errmsg, "Adding VCartridge information to DB failed");
 			free(vinfo);
+			pgsql_rollback(conn);
+			conn = NULL;
+			vcart_batch_undo(vdevice, batch, nbatch);
+			nbatch = 0;
 			result = -1;
 			break;
 		}
 		TAILQ_INSERT_TAIL(&vdevice->vol_list, vinfo, q_entry);
 		vcart_list[vinfo->tape_id] = vinfo;
+		sql_vcart_index_add(vinfo->label, vinfo->tape_id);
+		batch[nbatch++] = vinfo;
+
+		if (nbatch == VCART_ADD_BATCH) {
+			retval = vcart_batch_commit(vdevice, conn, batch, nbatch, &added, errmsg);
+			conn = NULL;
+			nbatch = 0;
+			if (retval != 0) {
+				result = -1;
+				break;
+			}
+		}
+	}
+
+	if (nbatch) {
+		retval = vcart_batch_commit(vdevice, conn, batch, nbatch, &added, errmsg);
+		if (retval != 0)
+			result = -1;
 	}
 
 	if (result != 0)
 	{
+		sprintf(tmpstr, ". Number of VCartridges added are %d", added);
+		strcat(errmsg, tmpstr);
 		return -1;
 	}
 
@@ -1638,12 +1749,7 @@ tl_server_vtl_vol_info(struct tl_comm *comm, struct tl_msg *msg)
 	}
 
 	TAILQ_FOREACH(volume, &vdevice->vol_list, q_entry) {
-		/* Updates the used percentage of the volume */
-		if (!volume->loaderror)
-		{
-			tl_ioctl(TLTARGIOCGETVCARTRIDGEINFO, volume);
-		}
-		dump_volume(fp, volume);
+		dump_volume_info(fp, volume);
 	}
 
 	fclose(fp);
@@ -1688,6 +1794,7 @@ delete_volumes(struct vdevice *vdevice)
 
 	while ((vinfo = TAILQ_FIRST(&vdevice->vol_list))) {
 		TAILQ_REMOVE(&vdevice->vol_list, vinfo, q_entry);
+		sql_vcart_index_remove(vinfo->label, vinfo->tape_id);
 		vcart_list[vinfo->tape_id] = NULL;
 		free(vinfo);
 	}
@@ -1824,6 +1931,10 @@ load_vtl(struct vdevice *vdevice)
 		dinfo.iscsi_tid = -1;
 		dinfo.vhba_id = -1;
 		dinfo.enable_compression = enable_drive_compression;
+		dinfo.comp_alg = drive_comp_alg;
+		dinfo.comp_level = drive_comp_level;
+		dinfo.write_cache_size = drive_write_cache_size;
+		dinfo.data_csum = drive_data_csum;
 		strcpy(dinfo.serialnumber, drive_vdevice->serialnumber);
 		strcpy(dinfo.sys_rid, sys_rid_stripped);
 		retval = tl_ioctl(TLTARGIOCNEWDEVICE, &dinfo);
@@ -1859,6 +1970,10 @@ vtl_add_drive(struct vtlconf *vtlconf, int drivetype, int target_id, char *errms
 	deviceinfo.iscsi_tid = -1;
 	deviceinfo.vhba_id = -1;
 	deviceinfo.enable_compression = enable_drive_compression;
+	deviceinfo.comp_alg = drive_comp_alg;
+	deviceinfo.comp_level = drive_comp_level;
+	deviceinfo.write_cache_size = drive_write_cache_size;
+	deviceinfo.data_csum = drive_data_csum;
 	strcpy(deviceinfo.name, dname);
 	strcpy(deviceinfo.serialnumber, serialnumber);
 	strcpy(deviceinfo.sys_rid, sys_rid_stripped);
@@ -1978,6 +2093,10 @@ load_drive(struct vdevice *vdevice)
 	dinfo.tl_id = vdevice->tl_id;
 	dinfo.target_id = vdevice->target_id;
 	dinfo.enable_compression = enable_drive_compression;
+	dinfo.comp_alg = drive_comp_alg;
+	dinfo.comp_level = drive_comp_level;
+	dinfo.write_cache_size = drive_write_cache_size;
+	dinfo.data_csum = drive_data_csum;
 	strcpy(dinfo.serialnumber, vdevice->serialnumber);
 	strcpy(dinfo.sys_rid, sys_rid_stripped);
 
@@ -2036,6 +2155,10 @@ add_new_drive(char *name, int drivetype, char *errmsg)
 	deviceinfo.iscsi_tid = -1;
 	deviceinfo.vhba_id = -1;
 	deviceinfo.enable_compression = enable_drive_compression;
+	deviceinfo.comp_alg = drive_comp_alg;
+	deviceinfo.comp_level = drive_comp_level;
+	deviceinfo.write_cache_size = drive_write_cache_size;
+	deviceinfo.data_csum = drive_data_csum;
 	strcpy(deviceinfo.name, name);
 	strcpy(deviceinfo.serialnumber, serialnumber);
 	strcpy(deviceinfo.sys_rid, sys_rid_stripped);
@@ -3197,6 +3320,7 @@ tl_server_rescan_disks(struct tl_comm *comm, struct tl_msg *msg)
 		}
 
 	}
+	load_volumes_status();
 	tl_server_msg_success(comm, msg);
 	return 0;
 }
@@ -3350,6 +3474,69 @@ check_drive_compression(void)
 		enable_drive_compression = 1;
 }
 
+static void
+check_drive_compression_alg(void)
+{
+	char buf[256];
+	int level;
+
+	buf[0] = 0;
+	drive_comp_alg = DRIVE_COMP_ALG_DEFAULT;
+	get_config_value(QUADSTOR_CONFIG_FILE, "DriveCompression", buf);
+	if (strcasecmp(buf, "lz4") == 0)
+		drive_comp_alg = DRIVE_COMP_ALG_LZ4;
+	else if (strcasecmp(buf, "lz4hc") == 0)
+		drive_comp_alg = DRIVE_COMP_ALG_LZ4_HC;
+	else if (strcasecmp(buf, "lzf") == 0)
+		drive_comp_alg = DRIVE_COMP_ALG_LZF;
+	else if (buf[0])
+		DEBUG_WARN_SERVER("Invalid drive compression algorithm %s\n", buf);
+
+	buf[0] = 0;
+	drive_comp_level = 0;
+	get_config_value(QUADSTOR_CONFIG_FILE, "DriveCompressionLevel", buf);
+	if (buf[0]) {
+		level = atoi(buf);
+		if (level >= 1 && level <= 16)
+			drive_comp_level = level;
+		else
+			DEBUG_WARN_SERVER("Invalid drive compression level %s\n", buf);
+	}
+}
+
+static void
+check_drive_write_cache_size(void)
+{
+	char buf[256];
+	int size;
+
+	buf[0] = 0;
+	drive_write_cache_size = 0;
+	get_config_value(QUADSTOR_CONFIG_FILE, "DriveWriteCacheSize", buf);
+	if (!buf[0])
+		return;
+
+	size = atoi(buf);
+	if (size >= 4 && size <= 512)
+		drive_write_cache_size = size;
+	else
+		DEBUG_WARN_SERVER("Invalid drive write cache size %s\n", buf);
+}
+
+static void
+check_drive_data_csum(void)
+{
+	char buf[256];
+
+	buf[0] = 0;
+	drive_data_csum = 0;
+	get_config_value(QUADSTOR_CONFIG_FILE, "DriveDataChecksum", buf);
+	if (strcasecmp(buf, "yes") == 0)
+		drive_data_csum = 1;
+	else if (buf[0] && strcasecmp(buf, "no") != 0)
+		DEBUG_WARN_SERVER("Invalid drive data checksum setting %s\n", buf);
+}
+
 static int
 tl_server_fix_group_ids(void)
 {
@@ -3379,6 +3566,9 @@ tl_server_load(void)
 	int check;
 
 	check_drive_compression();
+	check_drive_compression_alg();
+	check_drive_write_cache_size();
+	check_drive_data_csum();
 
 	tl_common_scan_physdisk();
 
@@ -3400,6 +3590,10 @@ tl_server_load(void)
 		exit(EXIT_FAILURE);
 	}
 
+	retval = sql_vcart_index_load();
+	if (retval != 0)
+		DEBUG_WARN_SERVER("Cannot load vcartridge label index, label checks will query the db\n");
+
 	retval = load_configured_disks();
 	if (retval != 0) {
 		DEBUG_ERR_SERVER("Getting configure disks failed");
@@ -3790,9 +3984,108 @@ tl_server_get_pool_configured_disks(struct tl_comm *comm, struct tl_msg *msg)
 	return 0;
 }
 
+/*
+ * Requests are served by a pool of workers. Queries take the lock of the
+ * objects they walk shared, so that they run concurrently with each other
+ * and with changes to unrelated objects. Vcartridges have a lock of their
+ * own, taken under a shared vtl lock, so that adding vcartridges doesn't
+ * hold up drive and vtl queries. Locks are taken in the order vtl, vol,
+ * disk.
+ */
+#define SRV_LOCK_VTL		0x01
+#define SRV_LOCK_VOL		0x02
+#define SRV_LOCK_DISK		0x04
+#define SRV_WLOCK_VTL		0x10
+#define SRV_WLOCK_VOL		0x20
+#define SRV_WLOCK_DISK		0x40
+
+#define SRV_WLOCK_ALL		(SRV_WLOCK_VTL | SRV_WLOCK_VOL | SRV_WLOCK_DISK)
+
+static pthread_rwlock_t vtl_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_rwlock_t vol_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_rwlock_t disk_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+
+static int
+tl_server_msg_lock_flags(int msg_id)
+{
+	switch (msg_id) {
+		case MSG_ID_SERVER_STATUS:
+		case MSG_ID_LIST_FC_RULES:
+		case MSG_ID_ADD_FC_RULE:
+		case MSG_ID_REMOVE_FC_RULE:
+			return 0;
+		case MSG_ID_GET_VTL_LIST:
+		case MSG_ID_GET_ISCSICONF:
+		case MSG_ID_GET_VDRIVE_STATS:
+		case MSG_ID_RESET_VDRIVE_STATS:
+			return SRV_LOCK_VTL;
+		case MSG_ID_VTL_INFO:
+		case MSG_ID_VTL_VOL_INFO:
+			return (SRV_LOCK_VTL | SRV_LOCK_VOL);
+		case MSG_ID_GET_VTL_CONF:
+		case MSG_ID_VTL_DRIVE_INFO:
+			/* Refresh the drive and vtl confs in place */
+			return SRV_WLOCK_VTL;
+		case MSG_ID_GET_CONFIGURED_DISKS:
+		case MSG_ID_LIST_DISKS:
+		case MSG_ID_LIST_GROUP:
+		case MSG_ID_LIST_GROUP_CONFIGURED:
+		case MSG_ID_GET_POOL_CONFIGURED_DISKS:
+			return SRV_LOCK_DISK;
+		case MSG_ID_ADD_VOL_CONF:
+			return (SRV_LOCK_VTL | SRV_WLOCK_VOL | SRV_LOCK_DISK);
+		case MSG_ID_ADD_DISK:
+		case MSG_ID_RESCAN_DISKS:
+		case MSG_ID_RUN_DIAGNOSTICS:
+		case MSG_ID_DISK_CHECK:
+			return SRV_WLOCK_DISK;
+		case MSG_ID_ADD_VTL_CONF:
+		case MSG_ID_ADD_DRIVE_CONF:
+		case MSG_ID_DELETE_VOL_CONF:
+		case MSG_ID_DELETE_VTL_CONF:
+		case MSG_ID_SET_ISCSICONF:
+		case MSG_ID_LOAD_DRIVE:
+		case MSG_ID_UNLOAD_DRIVE:
+		default:
+			return SRV_WLOCK_ALL;
+	}
+}
+
+static void
+srv_rwlock_lock(pthread_rwlock_t *lock, int flags, int rflag, int wflag)
+{
+	if (flags & wflag)
+		pthread_rwlock_wrlock(lock);
+	else if (flags & rflag)
+		pthread_rwlock_rdlock(lock);
+}
+
+static void
+tl_server_msg_lock(int flags)
+{
+	srv_rwlock_lock(&vtl_rwlock, flags, SRV_LOCK_VTL, SRV_WLOCK_VTL);
+	srv_rwlock_lock(&vol_rwlock, flags, SRV_LOCK_VOL, SRV_WLOCK_VOL);
+	srv_rwlock_lock(&disk_rwlock, flags, SRV_LOCK_DISK, SRV_WLOCK_DISK);
+}
+
+static void
+tl_server_msg_unlock(int flags)
+{
+	if (flags & (SRV_LOCK_DISK | SRV_WLOCK_DISK))
+		pthread_rwlock_unlock(&disk_rwlock);
+	if (flags & (SRV_LOCK_VOL | SRV_WLOCK_VOL))
+		pthread_rwlock_unlock(&vol_rwlock);
+	if (flags & (SRV_LOCK_VTL | SRV_WLOCK_VTL))
+		pthread_rwlock_unlock(&vtl_rwlock);
+}
+
 static int
 tl_server_handle_msg(struct tl_comm *comm, struct tl_msg *msg)
 {
+	int lock_flags;
+
+	lock_flags = tl_server_msg_lock_flags(msg->msg_id);
+	tl_server_msg_lock(lock_flags);
 
 	switch (msg->msg_id) {
 		case MSG_ID_SERVER_STATUS:
@@ -3926,9 +4219,23 @@ tl_server_handle_msg(struct tl_comm *comm, struct tl_msg *msg)
 			tl_server_msg_invalid(comm, msg);
 			break;
 	}
+
+	tl_server_msg_unlock(lock_flags);
 	return 0;
 }
 
+#define MDAEMON_WORKERS		8
+
+struct server_req {
+	int fd;
+	STAILQ_ENTRY(server_req) r_list;
+};
+STAILQ_HEAD(server_req_list, server_req);
+
+static struct server_req_list server_req_list = STAILQ_HEAD_INITIALIZER(server_req_list);
+static pthread_mutex_t server_req_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t server_req_cond = PTHREAD_COND_INITIALIZER;
+
 int
 tl_server_process_request(int fd, struct sockaddr_un *client_addr)
 {
@@ -3950,14 +4257,61 @@ tl_server_process_request(int fd, struct sockaddr_un *client_addr)
 	return 0;
 }
 
+static void *
+server_worker(void *arg)
+{
+	struct server_req *req;
+
+	while (1) {
+		pthread_mutex_lock(&server_req_lock);
+		while (STAILQ_EMPTY(&server_req_list))
+			pthread_cond_wait(&server_req_cond, &server_req_lock);
+		req = STAILQ_FIRST(&server_req_list);
+		STAILQ_REMOVE_HEAD(&server_req_list, r_list);
+		pthread_mutex_unlock(&server_req_lock);
+
+		if (tl_server_process_request(req->fd, NULL) != 0)
+			close(req->fd);
+		free(req);
+	}
+	return NULL;
+}
+
+static int
+server_queue_request(int fd)
+{
+	struct server_req *req;
+
+	req = malloc(sizeof(*req));
+	if (!req)
+		return -1;
+
+	req->fd = fd;
+	pthread_mutex_lock(&server_req_lock);
+	STAILQ_INSERT_TAIL(&server_req_list, req, r_list);
+	pthread_cond_signal(&server_req_cond);
+	pthread_mutex_unlock(&server_req_lock);
+	return 0;
+}
+
 static void *
 server_init(void * arg)
 {
 	struct sockaddr_un un_addr;
 	struct sockaddr_un client_addr;
 	socklen_t addr_len;
+	pthread_t worker_id;
 	int sockfd, newfd;
 	int reuse = 1;
+	int i;
+
+	for (i = 0; i < MDAEMON_WORKERS; i++) {
+		if (pthread_create(&worker_id, NULL, server_worker, NULL) != 0) {
+			DEBUG_ERR_SERVER("Unable to start server worker thread\n");
+			exit(EXIT_FAILURE);
+		}
+		pthread_detach(worker_id);
+	}
 
 	if ((sockfd = socket(AF_LOCAL, SOCK_STREAM, 0)) < 0) {
 		DEBUG_ERR_SERVER("Unable to create listen socket\n");
@@ -4009,7 +4363,10 @@ server_init(void * arg)
 			continue;
 		}
 
-		tl_server_process_request(newfd, &client_addr);
+		if (server_queue_request(newfd) != 0) {
+			DEBUG_WARN_SERVER("Unable to queue client request\n");
+			close(newfd);
+		}
 	}
 
 	close(sockfd);
@@ -347,7 +347,7 @@ sql_query_iscsiconf(int tl_id, uint32_t target_id, struct iscsiconf *iscsiconf)
 	{
 		DEBUG_ERR("Got more than one row\n");
 		PQclear(res);
-		PQfinish(conn);
+		pgsql_put_conn(conn);
 		if (!nrows)
 		{
 			return -2;
@@ -363,7 +363,7 @@ sql_query_iscsiconf(int tl_id, uint32_t target_id, struct iscsiconf *iscsiconf)
 	iscsiconf->tl_id = tl_id;
 	iscsiconf->target_id = target_id;
 	PQclear(res);
-	PQfinish(conn);
+	pgsql_put_conn(conn);
 	return 0;
 }
 
@@ -388,14 +388,14 @@ sql_query_driveprop(struct tdriveconf *driveconf)
 	{
 		DEBUG_ERR("Got more than one row\n");
 		PQclear(res);
-		PQfinish(conn);
+		pgsql_put_conn(conn);
 		return -1;
 	}	
 
 	driveconf->type = atoi(PQgetvalue(res, 0, 0));
 
 	PQclear(res);
-	PQfinish(conn);
+	pgsql_put_conn(conn);
 	return 0;
 }
 
@@ -441,12 +441,12 @@ sql_query_drives(struct vtlconf *vtlconf)
 	}
 
 	PQclear(res);
-	PQfinish(conn);
+	pgsql_put_conn(conn);
 	return 0;
 
 err:
 	PQclear(res);
-	PQfinish(conn);
+	pgsql_put_conn(conn);
 	return -1;
 }
 
@@ -537,12 +537,12 @@ sql_query_vdevice(struct vdevice *device_list[])
 	}
 
 	PQclear(res);
-	PQfinish(conn);
+	pgsql_put_conn(conn);
 	return 0;
 err:
 
 	PQclear(res);
-	PQfinish(conn);
+	pgsql_put_conn(conn);
 	for (i = 0; i < TL_MAX_DEVICES; i++)
 	{
 		struct vdevice *vdevice = device_list[i];
@@ -559,13 +559,29 @@ err:
 int
 sql_add_vcartridge(PGconn *conn, struct vcartridge *vinfo)
 {
-	char sqlcmd[512];
-	int error = -1;
-
-	snprintf(sqlcmd, sizeof(sqlcmd), "INSERT INTO VCARTRIDGE (TAPEID, GROUPID, TLID, VTYPE, LABEL, VSIZE, WORM) VALUES ('%u', '%u', '%u', '%d', '%s', '%llu', '%d')", vinfo->tape_id, vinfo->group_id, vinfo->tl_id, vinfo->type, vinfo->label, (unsigned long long)vinfo->size, vinfo->worm);
-	pgsql_exec_query3(conn, sqlcmd, 0, &error, NULL, NULL);
+	char tape_id[16], group_id[16], tl_id[16], type[16], size[24], worm[16];
+	const char *params[7];
+	PGresult *res;
 
-	return error;
+	snprintf(tape_id, sizeof(tape_id), "%u", vinfo->tape_id);
+	snprintf(group_id, sizeof(group_id), "%u", vinfo->group_id);
+	snprintf(tl_id, sizeof(tl_id), "%u", vinfo->tl_id);
+	snprintf(type, sizeof(type), "%d", vinfo->type);
+	snprintf(size, sizeof(size), "%llu", (unsigned long long)vinfo->size);
+	snprintf(worm, sizeof(worm), "%d", vinfo->worm);
+	params[0] = tape_id;
+	params[1] = group_id;
+	params[2] = tl_id;
+	params[3] = type;
+	params[4] = vinfo->label;
+	params[5] = size;
+	params[6] = worm;
+
+	res = pgsql_exec_prepared(conn, PGSQL_STMT_VCART_INSERT, 7, params);
+	if (!res)
+		return -1;
+	PQclear(res);
+	return 0;
 }
 
 extern struct vcartridge *vcart_list[];
@@ -619,11 +635,11 @@ sql_query_volumes(struct tl_blkdevinfo *binfo)
 	}
 
 	PQclear(res);
-	PQfinish(conn);
+	pgsql_put_conn(conn);
 	return 0;
 err:
 	PQclear(res);
-	PQfinish(conn);
+	pgsql_put_conn(conn);
 	while ((vinfo = TAILQ_FIRST(&binfo->vol_list))) {
 		TAILQ_REMOVE(&binfo->vol_list, vinfo, q_entry);
 		vcart_list[vinfo->tape_id] = NULL;
@@ -655,7 +671,7 @@ sql_query_groups(struct group_info *group_list[])
 		group_info = malloc(sizeof(struct group_info));
 		if (!group_info) {
 			PQclear(res);
-			PQfinish(conn);
+			pgsql_put_conn(conn);
 			return -1;
 		}
 
@@ -668,7 +684,7 @@ sql_query_groups(struct group_info *group_list[])
 	}
 
 	PQclear(res);
-	PQfinish(conn);
+	pgsql_put_conn(conn);
 	return error;
 }
 
@@ -827,7 +843,7 @@ sql_query_blkdevs(struct tl_blkdevinfo *bdev_list[])
 	}
 
 	PQclear(res);
-	PQfinish(conn);
+	pgsql_put_conn(conn);
 	return 0;
 err:
 	if (binfo)
@@ -835,63 +851,187 @@ err:
 		free(binfo);
 	}
 	PQclear(res);
-	PQfinish(conn);
+	pgsql_put_conn(conn);
 	return -1;
 }
 
 #define MAX_ID_FOR_RANGE 999
 
+/*
+ * In memory index of the labels and tape ids in the VCARTRIDGE table,
+ * including those of pools which are not loaded. Uniqueness checks go to
+ * the db only if the index could not be loaded
+ */
+#define VCART_LABEL_BUCKETS	1024
+
+struct vcart_label {
+	char label[40];
+	uint32_t tape_id;
+	SLIST_ENTRY(vcart_label) h_list;
+};
+SLIST_HEAD(vcart_label_list, vcart_label);
+
+static struct vcart_label_list vcart_label_hash[VCART_LABEL_BUCKETS];
+static uint8_t vcart_tapeid_used[MAX_VTAPES];
+static int vcart_index_loaded;
+static pthread_mutex_t vcart_index_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline struct vcart_label_list *
+vcart_label_bucket(char *label)
+{
+	uint32_t hash = 5381;
+
+	while (*label)
+		hash = (hash * 33) ^ tolower((unsigned char)*label++);
+	return &vcart_label_hash[hash & (VCART_LABEL_BUCKETS - 1)];
+}
+
+static struct vcart_label *
+vcart_label_find(char *label)
+{
+	struct vcart_label *entry;
+
+	SLIST_FOREACH(entry, vcart_label_bucket(label), h_list) {
+		if (strcasecmp(entry->label, label) == 0)
+			return entry;
+	}
+	return NULL;
+}
+
+static void
+__sql_vcart_index_add(char *label, uint32_t tape_id)
+{
+	struct vcart_label *entry;
+
+	if (tape_id < MAX_VTAPES)
+		vcart_tapeid_used[tape_id] = 1;
+
+	entry = malloc(sizeof(*entry));
+	if (!entry) {
+		/* Fall back to the db for the checks */
+		vcart_index_loaded = 0;
+		return;
+	}
+
+	strncpy(entry->label, label, sizeof(entry->label) - 1);
+	entry->label[sizeof(entry->label) - 1] = 0;
+	entry->tape_id = tape_id;
+	SLIST_INSERT_HEAD(vcart_label_bucket(label), entry, h_list);
+}
+
+void
+sql_vcart_index_add(char *label, uint32_t tape_id)
+{
+	pthread_mutex_lock(&vcart_index_lock);
+	if (vcart_index_loaded)
+		__sql_vcart_index_add(label, tape_id);
+	pthread_mutex_unlock(&vcart_index_lock);
+}
+
+void
+sql_vcart_index_remove(char *label, uint32_t tape_id)
+{
+	struct vcart_label_list *bucket = vcart_label_bucket(label);
+	struct vcart_label *entry;
+
+	pthread_mutex_lock(&vcart_index_lock);
+	SLIST_FOREACH(entry, bucket, h_list) {
+		if (entry->tape_id != tape_id || strcasecmp(entry->label, label))
+			continue;
+		SLIST_REMOVE(bucket, entry, vcart_label, h_list);
+		free(entry);
+		break;
+	}
+	if (tape_id < MAX_VTAPES)
+		vcart_tapeid_used[tape_id] = 0;
+	pthread_mutex_unlock(&vcart_index_lock);
+}
+
 int
-sql_virtvol_label_unique(char *label)
+sql_vcart_index_load(void)
 {
-	char sqlcmd[128];
 	PGconn *conn;
 	PGresult *res;
-	int nrows;
-
-	snprintf(sqlcmd, sizeof(sqlcmd), "SELECT LABEL FROM VCARTRIDGE WHERE LOWER(LABEL) = LOWER('%s')", label);
+	int nrows, i;
 
-	res = pgsql_exec_query(sqlcmd, &conn);
-	if (res == NULL)
-	{
-		DEBUG_ERR("error occurred in executing sqlcmd %s\n", sqlcmd); 
+	res = pgsql_exec_query("SELECT LABEL,TAPEID FROM VCARTRIDGE", &conn);
+	if (res == NULL) {
+		DEBUG_ERR("Error occurred in loading vcartridge labels\n");
 		return -1;
 	}
 
+	pthread_mutex_lock(&vcart_index_lock);
+	vcart_index_loaded = 1;
 	nrows = PQntuples(res);
+	for (i = 0; i < nrows; i++)
+		__sql_vcart_index_add(PQgetvalue(res, i, 0), strtoul(PQgetvalue(res, i, 1), NULL, 10));
+	pthread_mutex_unlock(&vcart_index_lock);
+
 	PQclear(res);
-	PQfinish(conn);
-	if (nrows > 0)
-	{
-		return -1;
-	}
+	pgsql_put_conn(conn);
 	return 0;
 }
 
-int
-sql_virtvol_tapeid_unique(uint32_t tape_id)
+static int
+sql_virtvol_exists(char *stmt, const char *param)
 {
-	char sqlcmd[128];
 	PGconn *conn;
 	PGresult *res;
 	int nrows;
 
-	snprintf(sqlcmd, sizeof(sqlcmd), "SELECT TAPEID FROM VCARTRIDGE WHERE TAPEID='%u'", tape_id);
+	conn = pgsql_get_conn();
+	if (!conn)
+		return -1;
 
-	res = pgsql_exec_query(sqlcmd, &conn);
-	if (res == NULL)
-	{
-		DEBUG_ERR("error occurred in executing sqlcmd %s\n", sqlcmd); 
+	res = pgsql_exec_prepared(conn, stmt, 1, &param);
+	if (res == NULL) {
+		pgsql_put_conn(conn);
 		return -1;
 	}
 
 	nrows = PQntuples(res);
 	PQclear(res);
-	PQfinish(conn);
-	if (nrows > 0)
-	{
+	pgsql_put_conn(conn);
+	return (nrows > 0);
+}
+
+int
+sql_virtvol_label_unique(char *label)
+{
+	int retval;
+
+	pthread_mutex_lock(&vcart_index_lock);
+	if (vcart_index_loaded) {
+		retval = vcart_label_find(label) ? -1 : 0;
+		pthread_mutex_unlock(&vcart_index_lock);
+		return retval;
+	}
+	pthread_mutex_unlock(&vcart_index_lock);
+
+	retval = sql_virtvol_exists(PGSQL_STMT_VCART_LABEL, label);
+	if (retval != 0)
 		return -1;
+	return 0;
+}
+
+int
+sql_virtvol_tapeid_unique(uint32_t tape_id)
+{
+	char tapeid_str[16];
+	int retval;
+
+	pthread_mutex_lock(&vcart_index_lock);
+	if (vcart_index_loaded) {
+		retval = vcart_tapeid_used[tape_id] ? -1 : 0;
+		pthread_mutex_unlock(&vcart_index_lock);
+		return retval;
 	}
+	pthread_mutex_unlock(&vcart_index_lock);
+
+	snprintf(tapeid_str, sizeof(tapeid_str), "%u", tape_id);
+	retval = sql_virtvol_exists(PGSQL_STMT_VCART_TAPEID, tapeid_str);
+	if (retval != 0)
+		return -1;
 	return 0;
 }
 
@@ -917,7 +1057,7 @@ sql_query_fc_rules(struct fc_rule_list *fc_rule_list)
 		fc_rule = alloc_buffer(sizeof(*fc_rule));
 		if (!fc_rule) {
 			PQclear(res);
-			PQfinish(conn);
+			pgsql_put_conn(conn);
 			return -1;
 		}
 
@@ -929,7 +1069,7 @@ sql_query_fc_rules(struct fc_rule_list *fc_rule_list)
 	}
 
 	PQclear(res);
-	PQfinish(conn);
+	pgsql_put_conn(conn);
 	return 0;
 
 }
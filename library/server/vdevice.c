@@ -94,6 +94,21 @@ dump_volume(FILE *fp, struct vcartridge *vinfo)
 	return 0;
 }
 
+/*
+ * Dumps the volume with its used percentage updated. Queries run
+ * concurrently, so the update goes into a copy and not the shared vcartridge
+ */
+int
+dump_volume_info(FILE *fp, struct vcartridge *volume)
+{
+	struct vcartridge vinfo;
+
+	memcpy(&vinfo, volume, sizeof(vinfo));
+	if (!vinfo.loaderror)
+		tl_ioctl(TLTARGIOCGETVCARTRIDGEINFO, &vinfo);
+	return dump_volume(fp, &vinfo);
+}
+
 int
 dump_vdevice(FILE *fp, struct vdevice *vdevice, int dumpdrivelist)
 {
@@ -117,12 +132,7 @@ dump_vdevice(FILE *fp, struct vdevice *vdevice, int dumpdrivelist)
 		goto skip;
 
 	TAILQ_FOREACH(volume, &vdevice->vol_list, q_entry) {
-		/* Updates the used percentage of the volume */
-		if (!volume->loaderror)
-		{
-			tl_ioctl(TLTARGIOCGETVCARTRIDGEINFO, volume);
-		}
-		dump_volume(fp, volume);
+		dump_volume_info(fp, volume);
 	}
 
 skip:
@@ -112,6 +112,43 @@ int main()
 	cgi_print_column("value", databuf);
 	cgi_print_row_end();
 
+	cgi_print_row_start();
+	cgi_print_column("name", "Compression bypassed bytes:");
+	cgi_print_comma();
+	get_data_str(stats.compression_bypassed_bytes, databuf);
+	cgi_print_column("value", databuf);
+	cgi_print_row_end();
+
+	cgi_print_row_start();
+	cgi_print_column("name", "Locate commands:");
+	cgi_print_comma();
+	cgi_print_column_format("value", "%llu", (unsigned long long)stats.locate_count);
+	cgi_print_row_end();
+
+	cgi_print_row_start();
+	cgi_print_column("name", "Locate entries visited:");
+	cgi_print_comma();
+	cgi_print_column_format("value", "%llu", (unsigned long long)stats.locate_entries_visited);
+	cgi_print_row_end();
+
+	cgi_print_row_start();
+	cgi_print_column("name", "Command queue depth:");
+	cgi_print_comma();
+	cgi_print_column_format("value", "%u", stats.cmd_queue_depth);
+	cgi_print_row_end();
+
+	cgi_print_row_start();
+	cgi_print_column("name", "Average command batch:");
+	cgi_print_comma();
+	cgi_print_column_format("value", "%llu", stats.cmd_batches ? (unsigned long long)(stats.cmd_batch_cmds / stats.cmd_batches) : 0ULL);
+	cgi_print_row_end();
+
+	cgi_print_row_start();
+	cgi_print_column("name", "Largest command batch:");
+	cgi_print_comma();
+	cgi_print_column_format("value", "%u", stats.cmd_batch_max);
+	cgi_print_row_end();
+
 	if (stats.write_ticks)
 		transfer_rate = ((stats.write_bytes_processed * 1000) / stats.write_ticks);
 	else
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) Shivaram Upadhyayula <shivaram.u@quadstor.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * Version 2 as published by the Free Software Foundation
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * Userspace microbenchmark of the CRC32C paths in export/crc32c_impl.h
+ * Not built or installed by default, run with make && ./crc32cbench
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#ifdef FREEBSD
+#include <sys/endian.h>
+#else
+#include <endian.h>
+#endif
+#include "crc32c_impl.h"
+
+#define BENCH_BYTES	(1ULL << 30)
+
+static double
+bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double
+bench_run(crc32c_fn_t fn, const uint8_t *buf, int len, uint32_t *ret)
+{
+	uint64_t i, iters = BENCH_BYTES / len;
+	uint32_t crc = ~0U;
+	double start;
+
+	start = bench_now();
+	for (i = 0; i < iters; i++)
+		crc = fn(crc, buf, len);
+	*ret = crc;
+	return (iters * (double)len) / (bench_now() - start) / 1e9;
+}
+
+int
+main(void)
+{
+	static const int sizes[] = { 48, 8192, 65536, 262144 };
+	uint32_t crc_sb8, crc;
+	uint8_t *buf;
+	int i, j;
+
+	crc32c_impl_init();
+	if (crc32c_sb8(~0U, (const uint8_t *)"123456789", 9) != ~0xE3069283U) {
+		fprintf(stderr, "crc32c_sb8 check value mismatch\n");
+		exit(EXIT_FAILURE);
+	}
+
+	buf = malloc(sizes[3]);
+	for (i = 0; i < sizes[3]; i++)
+		buf[i] = random();
+
+	printf("%8s %10s %10s %10s  (GB/s)\n", "size", "sb8", "sse42", "sse42_3way");
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		printf("%8d %10.2f", sizes[i], bench_run(crc32c_sb8, buf, sizes[i], &crc_sb8));
+#if defined(__amd64__) || defined(__x86_64__)
+		if (!crc32c_cpu_has_sse42()) {
+			printf("\n");
+			continue;
+		}
+
+		printf(" %10.2f", bench_run(crc32c_sse42, buf, sizes[i], &crc));
+		if (crc != crc_sb8)
+			printf(" (mismatch)");
+		printf(" %10.2f", bench_run(crc32c_sse42_3way, buf, sizes[i], &crc));
+		if (crc != crc_sb8)
+			printf(" (mismatch)");
+		/* Unaligned start and odd length */
+		for (j = 1; j < 8; j++) {
+			if (crc32c_sse42_3way(0, buf + j, sizes[i] - 2 * j) != crc32c_sb8(0, buf + j, sizes[i] - 2 * j))
+				printf(" (unaligned mismatch)");
+		}
+#endif
+		printf("\n");
+	}
+	free(buf);
+	return 0;
+}
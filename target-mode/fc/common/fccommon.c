@@ -35,9 +35,11 @@ struct device_info *device_list[MAX_DINFO_DEVICES];
 #ifdef FREEBSD 
 MALLOC_DEFINE(M_QISP, "QISP", "QUADStor ISP Targ");
 static struct mtx qs_device_lock;
-static struct sx itf_lock;
+struct sx itf_lock;
 MTX_SYSINIT(qs_device_lock, &qs_device_lock, "fcdevice lock", MTX_DEF);
 SX_SYSINIT(itf_lock, &itf_lock, "fcitf lock");
+#define itf_xlock()	sx_xlock(&itf_lock)
+#define itf_xunlock()	sx_xunlock(&itf_lock)
 wait_chan_t alloced_cmds_wait;
 
 static void
@@ -49,7 +51,10 @@ fccommon_sysinit(void)
 SYSINIT(alloced_cmds_sysinit, SI_SUB_LOCK, SI_ORDER_MIDDLE, fccommon_sysinit, NULL);
 #else
 DEFINE_SPINLOCK(qs_device_lock);
-DEFINE_MUTEX(itf_lock);
+/* Taken shared by the fcq threads on the command path */
+DECLARE_RWSEM(itf_lock);
+#define itf_xlock()	down_write(&itf_lock)
+#define itf_xunlock()	up_write(&itf_lock)
 DECLARE_WAIT_QUEUE_HEAD(alloced_cmds_wait);
 #undef free
 #define free(ptr,type)	kfree(ptr)
@@ -503,16 +508,16 @@ fcbridge_check_interface(void)
 	struct device_info *dinfo;
 	struct tdevice *device;
 
-	sx_xlock(&itf_lock);
+	itf_xlock();
 	if (atomic_read(&icbs.itf_enabled) && icbs.qload_done) {
-		sx_xunlock(&itf_lock);
+		itf_xunlock();
 		return;
 	}
 
 	fcbridge_attach_interface();
 
 	if (!atomic_read(&icbs.itf_enabled) || !icbs.qload_done) {
-		sx_xunlock(&itf_lock);
+		itf_xunlock();
 		return;
 	}
 
@@ -527,7 +532,7 @@ fcbridge_check_interface(void)
 			continue;
 		fcbridge_new_device_cb(device);
 	}
-	sx_xunlock(&itf_lock);
+	itf_xunlock();
 }
 
 static int
@@ -558,7 +563,7 @@ fcbridge_cmd_report_luns(struct fcbridge *fcbridge, struct qsio_scsiio *ctio)
 	ptr += 16;
 	avail = done;
 
-	sx_xlock(&itf_lock);
+	itf_xlock();
 	if (!atomic_read(&icbs.itf_enabled))
 		goto skip_luns;
 
@@ -583,7 +588,7 @@ fcbridge_cmd_report_luns(struct fcbridge *fcbridge, struct qsio_scsiio *ctio)
 		avail += 8;
 	}
 skip_luns:
-	sx_xunlock(&itf_lock);
+	itf_xunlock();
 	ptr = (uint8_t *)(ctio->data_ptr);
 	*((uint32_t *)ptr) = htobe32((avail - 8));
 	ctio->dxfer_len = min_t(uint32_t, done, allocation_length);
@@ -694,7 +699,7 @@ fcbridge_target_reset(struct fcbridge *fcbridge, struct qsio_immed_notify *notif
 int
 fcbridge_task_mgmt(struct fcbridge *fcbridge, struct qsio_immed_notify *notify)
 {
-	sx_xlock(&itf_lock);
+	itf_xlock();
 
 	if (!atomic_read(&icbs.itf_enabled))
 		goto skip;
@@ -724,7 +729,7 @@ fcbridge_task_mgmt(struct fcbridge *fcbridge, struct qsio_immed_notify *notify)
 skip:
 	notify->ccb_h.flags = QSIO_SEND_STATUS | QSIO_TYPE_NOTIFY;
 	(*notify->ccb_h.queue_fn)(notify);
-	sx_xunlock(&itf_lock);
+	itf_xunlock();
 	return 0;
 }
 
@@ -818,9 +823,9 @@ linker_detach(linker_file_t lf, void *arg)
 void
 fcbridge_detach_interface(void)
 {
-	sx_xlock(&itf_lock);
+	itf_xlock();
 	if (!atomic_read(&icbs.itf_enabled)) {
-		sx_xunlock(&itf_lock);
+		itf_xunlock();
 		return;
 	}
 
@@ -828,13 +833,13 @@ fcbridge_detach_interface(void)
 	icbs.qload_done = 0;
 
 	while (atomic_read(&alloced_cmds)) {
-		sx_xunlock(&itf_lock);
+		itf_xunlock();
 		wait_on_chan(alloced_cmds_wait, !atomic_read(&alloced_cmds));
-		sx_xlock(&itf_lock);
+		itf_xlock();
 	}
 
 	linker_file_foreach(linker_detach, NULL);
-	sx_xunlock(&itf_lock);
+	itf_xunlock();
 }
 
 static int
@@ -873,30 +878,30 @@ fcbridge_detach_interface(void)
 {
 	void (*unregister_interface)(struct qs_interface_cbs *);
 
-	sx_xlock(&itf_lock);
+	itf_xlock();
 	if (!atomic_read(&icbs.itf_enabled)) {
-		sx_xunlock(&itf_lock);
+		itf_xunlock();
 		return;
 	}
 
 	atomic_set(&icbs.itf_enabled, 0);
 	icbs.qload_done = 0;
 	while(atomic_read(&alloced_cmds)) {
-		sx_xunlock(&itf_lock);
+		itf_xunlock();
 		wait_on_chan(alloced_cmds_wait, !atomic_read(&alloced_cmds));
-		sx_xlock(&itf_lock);
+		itf_xlock();
 	}
 
 	unregister_interface = (void *)symbol_get(vtdevice_unregister_interface);
 	if (!unregister_interface) {
 		DEBUG_WARN_NEW("failed to get vtdevice_unregister_interface symbol\n");
-		sx_xunlock(&itf_lock);
+		itf_xunlock();
 		return;
 	}
 
 	(*unregister_interface)(&icbs);
 	symbol_put_addr(unregister_interface);
-	sx_xunlock(&itf_lock);
+	itf_xunlock();
 	module_put(THIS_MODULE);
 }
 
@@ -20,15 +20,15 @@
 #include "qla_sc.h"
 
 static struct tgtcmd *
-get_next_cmd(struct fcq *fcq)
+get_next_cmd(struct fcq_queue *queue)
 {
 	struct tgtcmd *cmd;
 
-	mtx_lock(&fcq->fcq_lock);
-	cmd = STAILQ_FIRST(&fcq->pending_queue);
+	mtx_lock(&queue->fcq_lock);
+	cmd = STAILQ_FIRST(&queue->pending_queue);
 	if (cmd)
-		STAILQ_REMOVE_HEAD(&fcq->pending_queue, q_list);
-	mtx_unlock(&fcq->fcq_lock);
+		STAILQ_REMOVE_HEAD(&queue->pending_queue, q_list);
+	mtx_unlock(&queue->fcq_lock);
 	return cmd;
 }
 
@@ -66,7 +66,7 @@ process_ctio(struct fcbridge *fcbridge, struct tgtcmd *cmd)
 		return;
 	}
 
-	sx_xlock(&itf_lock);
+	sx_slock(&itf_lock);
 	if (atomic_read(&icbs.itf_enabled) && cmd->target_lun)
 	{
 		atomic_inc(&alloced_cmds);
@@ -77,7 +77,7 @@ process_ctio(struct fcbridge *fcbridge, struct tgtcmd *cmd)
 		ctio = __local_ctio_new(M_WAITOK);
 		cmd->local_pool = 1;
 	}
-	sx_xunlock(&itf_lock);
+	sx_sunlock(&itf_lock);
 
 	ctio->i_prt[0] = cmd->i_prt;
 	ctio->t_prt[0] = cmd->t_prt;
@@ -141,11 +141,11 @@ process_cmd(struct fcbridge *fcbridge, struct tgtcmd *cmd)
 
 /* process_queue returns only after draining the queue */
 static void
-process_queue(struct fcbridge *fcbridge, struct fcq *fcq)
+process_queue(struct fcbridge *fcbridge, struct fcq_queue *queue)
 {
 	struct tgtcmd *cmd;
 
-	while ((cmd = get_next_cmd(fcq)) != NULL)
+	while ((cmd = get_next_cmd(queue)) != NULL)
 	{
 		/* process the commands.  */
 		process_cmd(fcbridge, cmd);
@@ -175,46 +175,52 @@ kernel_thread_stop(kproc_t *task, int *flags, wait_chan_t *chan, int bit)
 static void 
 fcq_thread(void *data)
 {
-	struct fcq *fcq = data;
-	struct fcbridge *fcbridge = fcq->fcbridge;
+	struct fcq_queue *queue = data;
+	struct fcbridge *fcbridge = queue->fcbridge;
 
 	__sched_prio(curthread, PINOD);
 
 	for (;;)
 	{
-		wait_on_chan_interruptible(fcq->fcq_wait, !STAILQ_EMPTY(&fcq->pending_queue) || kernel_thread_check(&fcq->flags, FCQ_SHUTDOWN));
+		wait_on_chan_interruptible(queue->fcq_wait, !STAILQ_EMPTY(&queue->pending_queue) || kernel_thread_check(&queue->flags, FCQ_SHUTDOWN));
 
-		process_queue(fcbridge, fcq);
-		if (unlikely(kernel_thread_check(&fcq->flags, FCQ_SHUTDOWN)))
+		process_queue(fcbridge, queue);
+		if (unlikely(kernel_thread_check(&queue->flags, FCQ_SHUTDOWN)))
 		{
 			break;
 		}
 
 	}
-	free(fcq, M_QISP);
 	kproc_exit(0);
 }
 
+static void
+fcq_stop_threads(struct fcq *fcq, int count)
+{
+	struct fcq_queue *queue;
+	int i, err;
+
+	for (i = 0; i < count; i++) {
+		queue = &fcq->queues[i];
+		err = kernel_thread_stop(queue->task, &queue->flags, &queue->fcq_wait, FCQ_SHUTDOWN);
+		if (err)
+			DEBUG_WARN_NEW("Shutting down fcq thread %d failed\n", i);
+	}
+}
 
 void
 fcq_exit(struct fcq *fcq)
 {
-	int err;
-
-	err = kernel_thread_stop(fcq->task, &fcq->flags, &fcq->fcq_wait, FCQ_SHUTDOWN);
-
-	if (err)
-	{
-		DEBUG_WARN_NEW("Shutting down fcq thread failed\n");
-		return;
-	}	
+	fcq_stop_threads(fcq, fcq->nr_queues);
+	free(fcq, M_QISP);
 }
 
 struct fcq *
 fcq_init(struct fcbridge *fcbridge)
 {
 	struct fcq *fcq;
-	int retval;
+	struct fcq_queue *queue;
+	int retval, i;
 
 	fcq = zalloc(sizeof(struct fcq), M_QISP, M_WAITOK);
 	if (unlikely(!fcq))
@@ -222,18 +228,25 @@ fcq_init(struct fcbridge *fcbridge)
 		return NULL;
 	}
 
-	wait_chan_init(&fcq->fcq_wait, "fcq wait");
-	STAILQ_INIT(&fcq->pending_queue);
-	mtx_lock_initt(&fcq->fcq_lock, "fcq");
-	fcbridge->fcq = fcq;
-	fcq->fcbridge = fcbridge;
-	retval = kernel_thread_create(fcq_thread, fcq, fcq->task, "fcq");
+	fcq->nr_queues = min_t(int, mp_ncpus, FCQ_MAX_QUEUES);
+	for (i = 0; i < fcq->nr_queues; i++) {
+		queue = &fcq->queues[i];
+		wait_chan_init(&queue->fcq_wait, "fcq wait");
+		STAILQ_INIT(&queue->pending_queue);
+		mtx_lock_initt(&queue->fcq_lock, "fcq");
+		queue->fcbridge = fcbridge;
+	}
 
-	if (retval != 0)
-	{
-		fcbridge->fcq = NULL;
-		free(fcq, M_QISP);
-		return NULL;
+	for (i = 0; i < fcq->nr_queues; i++) {
+		queue = &fcq->queues[i];
+		retval = kernel_thread_create(fcq_thread, queue, queue->task, "fcq%d", i);
+		if (retval != 0)
+		{
+			fcq_stop_threads(fcq, i);
+			free(fcq, M_QISP);
+			return NULL;
+		}
 	}
+	fcbridge->fcq = fcq;
 	return fcq;
 }
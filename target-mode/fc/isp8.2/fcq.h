@@ -19,6 +19,7 @@
 #ifndef QUADSTOR_FCQ_H_
 #define QUADSTOR_FCQ_H_
 
+#include <sys/hash.h>
 #include <bsddefs.h>
 #include <exportdefs.h>
 #include <missingdefs.h>
@@ -65,30 +66,46 @@ struct fcbridge {
 	uint32_t id;
 };
 
-struct fcq {
+#define FCQ_MAX_QUEUES		8
+
+struct fcq_queue {
 	mtx_t fcq_lock;
 	int flags;
-	int nice;
 	wait_chan_t fcq_wait;
 	STAILQ_HEAD(, tgtcmd) pending_queue;
 	struct fcbridge *fcbridge;
 	kproc_t *task;
 };
 
+struct fcq {
+	int nr_queues;
+	struct fcq_queue queues[FCQ_MAX_QUEUES];
+};
+
 enum {
 	FCQ_SHUTDOWN	= 1,
 };
 
 struct tgtcmd;
+/*
+ * Notifies do not carry the lun of the task they refer to, so commands
+ * are spread by initiator and stay ordered per I_T nexus
+ */
+static inline struct fcq_queue *
+fcq_cmd_queue(struct fcq *fcq, struct tgtcmd *cmd)
+{
+	return &fcq->queues[hash32_buf(&cmd->i_prt, sizeof(cmd->i_prt), HASHINIT) % fcq->nr_queues];
+}
+
 static inline void
 fcq_insert_cmd(struct fcbridge *fcbridge, struct tgtcmd *cmd)
 {
-	struct fcq *fcq = fcbridge->fcq;
+	struct fcq_queue *queue = fcq_cmd_queue(fcbridge->fcq, cmd);
 
-	mtx_lock(&fcq->fcq_lock);
-	STAILQ_INSERT_TAIL(&fcq->pending_queue, cmd, q_list);
-	mtx_unlock(&fcq->fcq_lock);
-	chan_wakeup_one(&fcq->fcq_wait);
+	mtx_lock(&queue->fcq_lock);
+	STAILQ_INSERT_TAIL(&queue->pending_queue, cmd, q_list);
+	mtx_unlock(&queue->fcq_lock);
+	chan_wakeup_one(&queue->fcq_wait);
 }
 
 struct fcq * fcq_init(struct fcbridge *fcbridge);
@@ -19,6 +19,7 @@
 #ifndef QUADSTOR_FCQ_H_
 #define QUADSTOR_FCQ_H_
 
+#include <linux/hash.h>
 #include "qla_def.h"
 #include "qla_target.h"
 
@@ -29,24 +30,50 @@ struct fcbridge {
 	__u32 id;
 };
 
-struct fcq {
-	unsigned long flags;
+#define FCQ_MAX_QUEUES		8
+#define FCQ_HASH_BITS		16
+
+struct fcq_queue {
 	spinlock_t fcq_lock;
 	wait_queue_head_t fcq_wait;
 	STAILQ_HEAD(, qla_cmd_hdr) pending_queue;
 	struct task_struct *task;
+	struct fcbridge *fcbridge;
+};
+
+struct fcq {
+	unsigned long flags;
+	int nr_queues;
+	struct fcq_queue queues[FCQ_MAX_QUEUES];
 };
 
+/*
+ * All commands and notifies of a session (I_T nexus) go through the same
+ * queue. ABTS and other target wide task management functions don't carry
+ * the lun they act on, so the lun can't be part of the key
+ */
+static inline struct fcq_queue *
+fcq_cmd_queue(struct fcq *fcq, struct qla_cmd_hdr *cmd_h)
+{
+	struct qla_tgt_sess *sess;
+
+	if (cmd_h->type == QLA_HDR_TYPE_CTIO)
+		sess = ((struct qla_tgt_cmd *)cmd_h)->sess;
+	else
+		sess = ((struct qla_tgt_mgmt_cmd *)cmd_h)->sess;
+	return &fcq->queues[hash_ptr(sess, FCQ_HASH_BITS) % fcq->nr_queues];
+}
+
 static inline void
 fcq_insert_cmd(struct fcbridge *fcbridge, struct qla_cmd_hdr *cmd)
 {
-	struct fcq *fcq = fcbridge->fcq;
+	struct fcq_queue *queue = fcq_cmd_queue(fcbridge->fcq, cmd);
 	unsigned long flags = 0;
 
-	spin_lock_irqsave(&fcq->fcq_lock, flags);
-	STAILQ_INSERT_TAIL(&fcq->pending_queue, cmd, q_list);
-	spin_unlock_irqrestore(&fcq->fcq_lock, flags);
-	wake_up(&fcq->fcq_wait);
+	spin_lock_irqsave(&queue->fcq_lock, flags);
+	STAILQ_INSERT_TAIL(&queue->pending_queue, cmd, q_list);
+	spin_unlock_irqrestore(&queue->fcq_lock, flags);
+	wake_up(&queue->fcq_wait);
 }
 
 struct fcq * fcq_init(struct fcbridge *fcbridge);
@@ -31,16 +31,16 @@ cmd_r_prt(struct srpt_device *vha)
 }
 
 static inline struct se_cmd *
-get_next_cmd(struct fcq *fcq)
+get_next_cmd(struct fcq_queue *queue)
 {
 	struct se_cmd *cmd;
 	unsigned long flags = 0;
 
-	spin_lock_irqsave(&fcq->fcq_lock, flags);
-	cmd = STAILQ_FIRST(&fcq->pending_queue);
+	spin_lock_irqsave(&queue->fcq_lock, flags);
+	cmd = STAILQ_FIRST(&queue->pending_queue);
 	if (cmd)
-		STAILQ_REMOVE_HEAD(&fcq->pending_queue, q_list); 
-	spin_unlock_irqrestore(&fcq->fcq_lock, flags);
+		STAILQ_REMOVE_HEAD(&queue->pending_queue, q_list); 
+	spin_unlock_irqrestore(&queue->fcq_lock, flags);
 	return cmd;
 }
 
@@ -51,7 +51,7 @@ srpt_cmd_cdb(struct se_cmd *cmd)
 } 
 
 extern struct qs_interface_cbs icbs;
-extern sx_t itf_lock;
+extern struct rw_semaphore itf_lock;
 extern atomic_t alloced_cmds;
 
 static inline void 
@@ -76,7 +76,7 @@ process_ctio(struct fcbridge *fcbridge, struct se_cmd *cmd)
 	}
 
 	target_lun = cmd->unpacked_lun;
-	sx_xlock(&itf_lock);
+	down_read(&itf_lock);
 	if (atomic_read(&icbs.itf_enabled) && target_lun)
 	{
 		atomic_inc(&alloced_cmds);
@@ -87,7 +87,7 @@ process_ctio(struct fcbridge *fcbridge, struct se_cmd *cmd)
 		ctio = __local_ctio_new(M_WAITOK);
 		cmd->local_pool = 1;
 	}
-	sx_xunlock(&itf_lock);
+	up_read(&itf_lock);
 
 	ctio->i_prt[0] = wwn_to_u64(cmd->sess->ch->i_port_id);
 	ctio->i_prt[1] = wwn_to_u64(&cmd->sess->ch->i_port_id[8]);
@@ -149,11 +149,11 @@ process_cmd(struct fcbridge *fcbridge, struct se_cmd *cmd)
 
 /* process_queue returns only after draining the queue */
 static inline void
-process_queue(struct fcbridge *fcbridge)
+process_queue(struct fcbridge *fcbridge, struct fcq_queue *queue)
 {
 	struct se_cmd *cmd;
 
-	while ((cmd = get_next_cmd(fcbridge->fcq)) != NULL)
+	while ((cmd = get_next_cmd(queue)) != NULL)
 	{
 		/* process the commands.  */
 		process_cmd(fcbridge, cmd);
@@ -165,8 +165,8 @@ extern mempool_t *q2t_pool;
 static int
 fcq_thread(void *data)
 {
-	struct fcbridge *fcbridge = data;
-	struct fcq *fcq = fcbridge->fcq;
+	struct fcq_queue *queue = data;
+	struct fcbridge *fcbridge = queue->fcbridge;
 
 	set_user_nice(current, -20);
 
@@ -174,32 +174,34 @@ fcq_thread(void *data)
 
 	for (;;)
 	{
-		wait_event_interruptible(fcq->fcq_wait, !STAILQ_EMPTY(&fcq->pending_queue) || kthread_should_stop());
+		wait_event_interruptible(queue->fcq_wait, !STAILQ_EMPTY(&queue->pending_queue) || kthread_should_stop());
 
 		if (unlikely(kthread_should_stop()))
 		{
 			break;
 		}
 
-		process_queue(fcbridge);
+		process_queue(fcbridge, queue);
 	}
 	return 0;
 }
 
+static void
+fcq_stop_threads(struct fcq *fcq, int count)
+{
+	int i, err;
+
+	for (i = 0; i < count; i++) {
+		err = kthread_stop(fcq->queues[i].task);
+		if (err)
+			DEBUG_WARN_NEW("Shutting down fcq thread %d failed\n", i);
+	}
+}
 
 void
 fcq_exit(struct fcq *fcq)
 {
-	int err;
-
-	err = kthread_stop(fcq->task);
-
-	if (err)
-	{
-		DEBUG_WARN_NEW("Shutting down fcq thread failed\n");
-		return;
-	}	
-
+	fcq_stop_threads(fcq, fcq->nr_queues);
 	kfree(fcq);
 }
 
@@ -207,7 +209,9 @@ struct fcq *
 fcq_init(struct fcbridge *fcbridge)
 {
 	struct fcq *fcq;
+	struct fcq_queue *queue;
 	struct task_struct *task;
+	int i;
 
 	fcq = kzalloc(sizeof(struct fcq), GFP_KERNEL);
 	if (unlikely(!fcq))
@@ -215,18 +219,26 @@ fcq_init(struct fcbridge *fcbridge)
 		return NULL;
 	}
 
-	init_waitqueue_head(&fcq->fcq_wait);
-	STAILQ_INIT(&fcq->pending_queue);
-	spin_lock_init(&fcq->fcq_lock);
-	fcbridge->fcq = fcq;
-	task = kthread_run(fcq_thread, fcbridge, "fcq");
+	fcq->nr_queues = min_t(int, num_online_cpus(), FCQ_MAX_QUEUES);
+	for (i = 0; i < fcq->nr_queues; i++) {
+		queue = &fcq->queues[i];
+		init_waitqueue_head(&queue->fcq_wait);
+		STAILQ_INIT(&queue->pending_queue);
+		spin_lock_init(&queue->fcq_lock);
+		queue->fcbridge = fcbridge;
+	}
 
-	if (IS_ERR(task))
-	{
-		fcbridge->fcq = NULL;
-		kfree(fcq);
-		return NULL;
+	for (i = 0; i < fcq->nr_queues; i++) {
+		queue = &fcq->queues[i];
+		task = kthread_run(fcq_thread, queue, "fcq%d", i);
+		if (IS_ERR(task))
+		{
+			fcq_stop_threads(fcq, i);
+			kfree(fcq);
+			return NULL;
+		}
+		queue->task = task;
 	}
-	fcq->task = task;
+	fcbridge->fcq = fcq;
 	return fcq;
 }
@@ -22,6 +22,7 @@
 #include <linuxdefs.h>
 #include <exportdefs.h>
 #include <missingdefs.h>
+#include <linux/hash.h>
 #include <scsi/scsi_cmnd.h>
 #include <scsi/scsi_transport_fc.h>
 
@@ -43,24 +44,44 @@ enum {
 	SRPT_CMD_TYPE_NOTIFY,
 };
 
-struct fcq {
-	unsigned long flags;
+#define FCQ_MAX_QUEUES		8
+#define FCQ_HASH_BITS		16
+
+struct fcq_queue {
 	spinlock_t fcq_lock;
 	wait_queue_head_t fcq_wait;
 	STAILQ_HEAD(, se_cmd) pending_queue;
 	struct task_struct *task;
+	struct fcbridge *fcbridge;
 };
 
+struct fcq {
+	unsigned long flags;
+	int nr_queues;
+	struct fcq_queue queues[FCQ_MAX_QUEUES];
+};
+
+/*
+ * All commands and notifies of a session (I_T nexus) go through the same
+ * queue. Task management functions needn't carry the lun of the tasks they
+ * act on, so the lun can't be part of the key
+ */
+static inline struct fcq_queue *
+fcq_cmd_queue(struct fcq *fcq, struct se_cmd *se_cmd)
+{
+	return &fcq->queues[hash_ptr(se_cmd->sess, FCQ_HASH_BITS) % fcq->nr_queues];
+}
+
 static inline void
 fcq_insert_cmd(struct fcbridge *fcbridge, struct se_cmd *se_cmd)
 {
-	struct fcq *fcq = fcbridge->fcq;
+	struct fcq_queue *queue = fcq_cmd_queue(fcbridge->fcq, se_cmd);
 	unsigned long flags = 0;
 
-	spin_lock_irqsave(&fcq->fcq_lock, flags);
-	STAILQ_INSERT_TAIL(&fcq->pending_queue, se_cmd, q_list);
-	spin_unlock_irqrestore(&fcq->fcq_lock, flags);
-	wake_up(&fcq->fcq_wait);
+	spin_lock_irqsave(&queue->fcq_lock, flags);
+	STAILQ_INSERT_TAIL(&queue->pending_queue, se_cmd, q_list);
+	spin_unlock_irqrestore(&queue->fcq_lock, flags);
+	wake_up(&queue->fcq_wait);
 }
 
 struct fcq * fcq_init(struct fcbridge *fcbridge);
@@ -81,12 +81,11 @@ struct iscsi_conn *conn_lookup(struct iscsi_session *session, u16 cid)
 static int iet_data_ready(struct socket *so, void *arg, int waitflag)
 {
 	struct iscsi_conn *conn = (struct iscsi_conn *)(arg);
-	struct iscsi_target *target = conn->session->target;
 
 	if ((so->so_state & SS_ISDISCONNECTING) || (so->so_state & SS_ISDISCONNECTED))
 		conn_close(conn);
 	else if (so->so_rcv.sb_cc || !(so->so_rcv.sb_state & SBS_CANTRCVMORE))
-		nthread_wakeup(target);
+		nthread_wakeup(conn);
 
 	return (SU_OK);
 }
@@ -94,14 +93,13 @@ static int iet_data_ready(struct socket *so, void *arg, int waitflag)
 static int iet_write_space(struct socket *so, void *arg, int waitflag)
 {
 	struct iscsi_conn *conn = (struct iscsi_conn *)(arg);
-	struct iscsi_target *target = conn->session->target;
-	struct network_thread_info *info = &target->nthread_info;
+	struct network_thread_info *info = conn->nthread_info;
 
 	spin_lock(&info->nthread_lock);
 
 	if (test_bit(CONN_WSPACE_WAIT, &conn->state)) {
 		clear_bit(CONN_WSPACE_WAIT, &conn->state);
-		nthread_wakeup(target);
+		nthread_wakeup(conn);
 	}
 
 	spin_unlock(&info->nthread_lock);
@@ -118,9 +116,9 @@ static void iet_state_change(struct sock *sk)
 	if (sk->sk_state != TCP_ESTABLISHED)
 		conn_close(conn);
 	else
-		nthread_wakeup(target);
+		nthread_wakeup(conn);
 
-	target->nthread_info.old_state_change(sk);
+	target->old_state_change(sk);
 }
 
 extern void iet_data_ready(struct sock *sk, int len);
@@ -129,8 +127,8 @@ void iet_data_ready(struct sock *sk, int len)
 	struct iscsi_conn *conn = sk->sk_user_data;
 	struct iscsi_target *target = conn->session->target;
 
-	nthread_wakeup(target);
-	target->nthread_info.old_data_ready(sk, len);
+	nthread_wakeup(conn);
+	target->old_data_ready(sk, len);
 }
 
 /*
@@ -141,18 +139,18 @@ static void iet_write_space(struct sock *sk)
 {
 	struct iscsi_conn *conn = sk->sk_user_data;
 	struct iscsi_target *target = conn->session->target;
-	struct network_thread_info *info = &target->nthread_info;
+	struct network_thread_info *info = conn->nthread_info;
 
 	spin_lock_bh(&info->nthread_lock);
 
 	if (sk_stream_wspace(sk) >= sk_stream_min_wspace(sk) &&
 	    test_bit(CONN_WSPACE_WAIT, &conn->state)) {
 		clear_bit(CONN_WSPACE_WAIT, &conn->state);
-		nthread_wakeup(target);
+		nthread_wakeup(conn);
 	}
 
 	spin_unlock_bh(&info->nthread_lock);
-	info->old_write_space(sk);
+	target->old_write_space(sk);
 }
 #endif
 
@@ -174,13 +172,13 @@ static void iet_socket_bind(struct iscsi_conn *conn)
 	conn->sock->sk->sk_user_data = conn;
 
 	write_lock_bh(&conn->sock->sk->sk_callback_lock);
-	target->nthread_info.old_state_change = conn->sock->sk->sk_state_change;
+	target->old_state_change = conn->sock->sk->sk_state_change;
 	conn->sock->sk->sk_state_change = iet_state_change;
 
-	target->nthread_info.old_data_ready = conn->sock->sk->sk_data_ready;
+	target->old_data_ready = conn->sock->sk->sk_data_ready;
 	conn->sock->sk->sk_data_ready = iet_data_ready;
 
-	target->nthread_info.old_write_space = conn->sock->sk->sk_write_space;
+	target->old_write_space = conn->sock->sk->sk_write_space;
 	conn->sock->sk->sk_write_space = iet_write_space;
 	write_unlock_bh(&conn->sock->sk->sk_callback_lock);
 
@@ -284,15 +282,16 @@ static int iet_conn_alloc(struct iscsi_session *session, struct conn_info *info)
 		return error;
 	}
 #endif
+	nthread_assign(conn);
 	list_add(&conn->list, &session->conn_list);
 
 	set_bit(CONN_ACTIVE, &conn->state);
 
 	iet_socket_bind(conn);
 
-	list_add(&conn->poll_list, &session->target->nthread_info.active_conns);
+	list_add(&conn->poll_list, &conn->nthread_info->active_conns);
 
-	nthread_wakeup(conn->session->target);
+	nthread_wakeup(conn);
 
 	return 0;
 }
@@ -310,7 +309,7 @@ void conn_close(struct iscsi_conn *conn)
 	}
 	spin_unlock(&conn->list_lock);
 
-	nthread_wakeup(conn->session->target);
+	nthread_wakeup(conn);
 }
 
 int conn_add(struct iscsi_session *session, struct conn_info *info)
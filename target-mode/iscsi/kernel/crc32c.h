@@ -7,6 +7,7 @@ struct chksum_ctx {
 	u32 crc;
 };
 
+void chksum_probe(void);
 void chksum_init(struct chksum_ctx *mctx);
 int chksum_setkey(struct chksum_ctx *mctx, u8 *key, unsigned int keylen, u32 *flags);
 void chksum_update(struct chksum_ctx *mctx, const u8 *data, unsigned int length);
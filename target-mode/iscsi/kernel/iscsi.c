@@ -157,7 +157,7 @@ void iscsi_cmnds_init_write(struct list_head *send, int dec_busy)
 
 	spin_unlock(&conn->list_lock);
 
-	nthread_wakeup(conn->session->target);
+	nthread_wakeup(conn);
 }
 
 void iscsi_cmnd_init_write(struct iscsi_cmnd *cmnd, int dec_busy)
@@ -1180,6 +1180,31 @@ static inline char *rsp_desc(int rsp)
 	return rsp_desc[rsp];
 }
 
+/* Called by the network thread with target_lock held */
+void execute_deferred_resets(struct network_thread_info *info)
+{
+	struct iscsi_cmnd *rsp, *req;
+	struct iscsi_task_mgt_hdr *req_hdr;
+	int function;
+
+	while (!list_empty(&info->reset_list)) {
+		rsp = list_entry(info->reset_list.next, struct iscsi_cmnd, list);
+		list_del_init(&rsp->list);
+		req = rsp->req;
+		req_hdr = (struct iscsi_task_mgt_hdr *)&req->pdu.bhs;
+		function = req_hdr->function & ISCSI_FUNCTION_MASK;
+
+		if (function == ISCSI_FUNCTION_LOGICAL_UNIT_RESET)
+			target_reset(req, translate_lun(req_hdr->lun), 0);
+		else
+			target_reset(req, 0, 1);
+
+		if (function == ISCSI_FUNCTION_TARGET_COLD_RESET)
+			set_cmnd_close(rsp);
+		iscsi_cmnd_init_write(rsp, 0);
+	}
+}
+
 static void execute_task_management(struct iscsi_cmnd *req)
 {
 	struct iscsi_conn *conn = req->conn;
@@ -1212,14 +1237,14 @@ static void execute_task_management(struct iscsi_cmnd *req)
 		rsp_hdr->response = ISCSI_RESPONSE_FUNCTION_UNSUPPORTED;
 		break;
 	case ISCSI_FUNCTION_LOGICAL_UNIT_RESET:
-		target_reset(req, translate_lun(req_hdr->lun), 0);
-		break;
 	case ISCSI_FUNCTION_TARGET_WARM_RESET:
 	case ISCSI_FUNCTION_TARGET_COLD_RESET:
-		target_reset(req, 0, 1);
-		if (function == ISCSI_FUNCTION_TARGET_COLD_RESET)
-			set_cmnd_close(rsp);
-		break;
+		/*
+		 * Resets abort commands on the connections of other threads,
+		 * run them once this thread has dropped its conn_sem
+		 */
+		list_add_tail(&rsp->list, &conn->nthread_info->reset_list);
+		return;
 	case ISCSI_FUNCTION_TASK_REASSIGN:
 		rsp_hdr->response = ISCSI_RESPONSE_FUNCTION_UNSUPPORTED;
 		break;
@@ -1836,6 +1861,8 @@ static int iscsi_init(void)
 #else
 	if ((err = iet_mmap_init()) < 0)
 		goto err;
+
+	chksum_probe();
 #endif
 
 #ifdef LINUX
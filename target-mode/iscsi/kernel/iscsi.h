@@ -54,18 +54,21 @@ struct tio {
 	atomic_t count;
 };
 
+#define ISCSI_NTHREADS_MAX	16
+
+struct iscsi_target;
+
 struct network_thread_info {
 	kproc_t *task;
 	unsigned long flags;
 	struct list_head active_conns;
+	struct iscsi_target *target;
+	int id;
 
 	spinlock_t nthread_lock;
 	wait_queue_head_t nthread_wait;
-#ifdef LINUX
-	void (*old_state_change)(struct sock *);
-	void (*old_data_ready)(struct sock *, int);
-	void (*old_write_space)(struct sock *);
-#endif
+	mutex_t conn_sem; /* Held while active_conns is processed */
+	struct list_head reset_list; /* Reset responses, run under target_lock */
 };
 
 struct iscsi_cmnd;
@@ -94,7 +97,14 @@ struct iscsi_target {
 	/* Prevents races between add/del session and adding UAs */
 	spinlock_t session_list_lock;
 
-	struct network_thread_info nthread_info;
+	struct network_thread_info nthread_info[ISCSI_NTHREADS_MAX];
+	int nthreads;
+	int nthread_next;
+#ifdef LINUX
+	void (*old_state_change)(struct sock *);
+	void (*old_data_ready)(struct sock *, int);
+	void (*old_write_space)(struct sock *);
+#endif
 
 	mutex_t target_sem;
 
@@ -202,6 +212,7 @@ struct iscsi_conn {
 	int ddigest_type;
 
 	struct list_head poll_list;
+	struct network_thread_info *nthread_info;
 	struct file *file;
 	struct socket *sock;
 	spinlock_t list_lock;
@@ -223,6 +234,9 @@ struct iscsi_conn {
 	struct iscsi_cmnd *write_cmnd;
 	struct iovec write_iov[ISCSI_CONN_IOV_MAX];
 	struct iovec *write_iop;
+#ifdef FREEBSD
+	struct iovec data_iov[ISCSI_CONN_IOV_MAX];
+#endif
 	struct tio *write_tcmnd;
 	struct qsio_scsiio *ctio;
 	u32 write_size;
@@ -323,9 +337,7 @@ extern void conn_info_show(struct seq_file *, struct iscsi_session *);
 extern int nthread_init(struct iscsi_target *);
 extern int nthread_start(struct iscsi_target *);
 extern int nthread_stop(struct iscsi_target *);
-#if 0
-extern void nthread_wakeup(struct iscsi_target *);
-#endif
+extern void nthread_assign(struct iscsi_conn *);
 
 enum daemon_state_bit {
 	D_ACTIVE,
@@ -333,9 +345,9 @@ enum daemon_state_bit {
 	D_THR_EXIT,
 };
 
-static inline void nthread_wakeup(struct iscsi_target *target)
+static inline void nthread_wakeup(struct iscsi_conn *conn)
 {
-	struct network_thread_info *info = &target->nthread_info;
+	struct network_thread_info *info = conn->nthread_info;
 	chan_wakeup_condition(info->nthread_wait, set_bit(D_DATA_READY, &info->flags));
 }
 
@@ -346,7 +358,7 @@ static inline void nthread_wakeup(struct iscsi_target *target)
  */
 static inline void set_conn_wspace_wait(struct iscsi_conn *conn)
 {
-	struct network_thread_info *info = &conn->session->target->nthread_info;
+	struct network_thread_info *info = conn->nthread_info;
 	struct sock *sk = conn->sock->sk;
 
 	spin_lock_bh(&info->nthread_lock);
@@ -377,7 +389,7 @@ sk_write_space_available(struct iscsi_conn *conn)
 
 static inline void set_conn_wspace_wait(struct iscsi_conn *conn)
 {
-	struct network_thread_info *info = &conn->session->target->nthread_info;
+	struct network_thread_info *info = conn->nthread_info;
 
 	spin_lock_bh(&info->nthread_lock);
 	if (!sk_write_space_available(conn))
@@ -394,15 +406,30 @@ static inline int target_lock(struct iscsi_target *target, int interruptible)
 {
 	int err = 0;
 
+	int i;
+
 	if (interruptible)
 		err = sx_xlock_interruptible(&target->target_sem);
 	else
 		sx_xlock(&target->target_sem);
 
-	return err;
+	if (err)
+		return err;
+
+	/* Keep the network threads out while connections are changed */
+	for (i = 0; i < target->nthreads; i++)
+		sx_xlock(&target->nthread_info[i].conn_sem);
+	return 0;
 }
 
-#define target_unlock(t)	sx_xunlock(&t->target_sem)
+static inline void target_unlock(struct iscsi_target *target)
+{
+	int i;
+
+	for (i = target->nthreads - 1; i >= 0; i--)
+		sx_xunlock(&target->nthread_info[i].conn_sem);
+	sx_xunlock(&target->target_sem);
+}
 #if 0 
 inline void target_unlock(struct iscsi_target *target)
 {
@@ -550,6 +577,7 @@ u32 cmnd_read_size(struct iscsi_cmnd *cmnd);
 u32 cmnd_write_size(struct iscsi_cmnd *cmnd);
 void iscsi_cmnd_init_write(struct iscsi_cmnd *cmnd, int dec_busy);
 void iscsi_cmnds_init_write(struct list_head *send, int dec_busy);
+void execute_deferred_resets(struct network_thread_info *info);
 u32 translate_lun(u16 * data);
 void exit_tx(struct iscsi_conn *conn, int res);
 void close_conn(struct iscsi_conn *conn);
@@ -12,6 +12,22 @@
 
 wait_queue_head_t iscsi_ctl_wait;
 
+/*
+ * Network threads per target, up to ISCSI_NTHREADS_MAX. A target is created
+ * per drive, so the default is a single thread
+ */
+static int nthreads = 1;
+/* Bind network thread n of a target to cpu n */
+static int nthread_cpu_bind = 0;
+
+#ifdef LINUX
+module_param(nthreads, int, S_IRUGO);
+module_param(nthread_cpu_bind, int, S_IRUGO);
+#else
+TUNABLE_INT("kern.iscsit.nthreads", &nthreads);
+TUNABLE_INT("kern.iscsit.nthread_cpu_bind", &nthread_cpu_bind);
+#endif
+
 enum rx_state {
 	RX_INIT_BHS, /* Must be zero. */
 	RX_BHS,
@@ -675,7 +691,7 @@ static void conn_nop_timeout(void *data)
 	dprintk(D_THREAD, "conn %llu:%hu, NOP timer %p\n", conn->session->sid,
 		conn->cid, &conn->nop_timer);
 
-	nthread_wakeup(conn->session->target);
+	nthread_wakeup(conn);
 }
 
 static void conn_reset_nop_timer(struct iscsi_conn *conn)
@@ -710,7 +726,6 @@ static void conn_start_nop_timer(struct iscsi_conn *conn)
 
 static void process_io(struct iscsi_conn *conn)
 {
-	struct iscsi_target *target = conn->session->target;
 	int res, wakeup = 0;
 
 	res = recv(conn);
@@ -738,10 +753,10 @@ static void process_io(struct iscsi_conn *conn)
 
 out:
 	if (wakeup)
-		nthread_wakeup(target);
+		nthread_wakeup(conn);
 	else if (test_and_clear_bit(CONN_NEED_NOP_IN, &conn->state)) {
 		send_nop_in(conn);
-		nthread_wakeup(target);
+		nthread_wakeup(conn);
 	} else
 		conn_start_nop_timer(conn);
 	return;
@@ -760,9 +775,9 @@ void close_conn(struct iscsi_conn *conn)
 	conn->sock->ops->shutdown(conn->sock, 2);
 
 	write_lock_bh(&conn->sock->sk->sk_callback_lock);
-	conn->sock->sk->sk_state_change = target->nthread_info.old_state_change;
-	conn->sock->sk->sk_data_ready = target->nthread_info.old_data_ready;
-	conn->sock->sk->sk_write_space = target->nthread_info.old_write_space;
+	conn->sock->sk->sk_state_change = target->old_state_change;
+	conn->sock->sk->sk_data_ready = target->old_data_ready;
+	conn->sock->sk->sk_write_space = target->old_write_space;
 	write_unlock_bh(&conn->sock->sk->sk_callback_lock);
 
 	fput(conn->file);
@@ -820,17 +835,60 @@ void close_conn(struct iscsi_conn *conn)
 	}
 }
 
+/*
+ * Connections of a session stay on one thread, the session state (cmd sn
+ * window, pending list) is only touched from that thread. So MC/S
+ * connections of a session don't scale over threads, new sessions are
+ * spread round robin over the threads of the target instead. Called with
+ * target_lock held.
+ */
+void nthread_assign(struct iscsi_conn *conn)
+{
+	struct iscsi_session *session = conn->session;
+	struct iscsi_target *target = session->target;
+	struct iscsi_conn *iter;
+
+	if (!list_empty(&session->conn_list)) {
+		iter = list_entry(session->conn_list.next, struct iscsi_conn, list);
+		conn->nthread_info = iter->nthread_info;
+		return;
+	}
+
+	conn->nthread_info = &target->nthread_info[target->nthread_next];
+	target->nthread_next = (target->nthread_next + 1) % target->nthreads;
+}
+
+static void nthread_bind_cpu(struct network_thread_info *info)
+{
+	int cpu;
+
+	if (!nthread_cpu_bind)
+		return;
+
+	/* Spread the threads of all targets, not just those of one target */
+	cpu = (info->target->tid * info->target->nthreads + info->id) % mp_ncpus;
+#ifdef LINUX
+	set_cpus_allowed_ptr(current, cpumask_of(cpu));
+#else
+	thread_lock(curthread);
+	sched_bind(curthread, cpu);
+	thread_unlock(curthread);
+#endif
+}
+
 #ifdef LINUX
 static int istd(void *arg)
 #else
 static void istd(void *arg)
 #endif
 {
-	struct iscsi_target *target = arg;
-	struct network_thread_info *info = &target->nthread_info;
+	struct network_thread_info *info = arg;
+	struct iscsi_target *target = info->target;
 	struct iscsi_conn *conn, *tmp;
+	int closing;
 
 	__sched_prio(curthread, PINOD);
+	nthread_bind_cpu(info);
 
 	__set_current_state(TASK_RUNNING);
 	for (;;) {
@@ -842,11 +900,27 @@ static void istd(void *arg)
 			break;
 		}
 		clear_bit(D_DATA_READY, &info->flags);
-		target_lock(target, 0);
+		closing = 0;
+		sx_xlock(&info->conn_sem);
 		list_for_each_entry_safe(conn, tmp, &info->active_conns, poll_list) {
 			if (test_bit(CONN_ACTIVE, &conn->state))
 				process_io(conn);
 			else
+				closing = 1;
+		}
+		sx_xunlock(&info->conn_sem);
+
+		if (!closing && list_empty(&info->reset_list))
+			continue;
+
+		/*
+		 * Resets walk the connections of every thread and closing a
+		 * connection can free its session
+		 */
+		target_lock(target, 0);
+		execute_deferred_resets(info);
+		list_for_each_entry_safe(conn, tmp, &info->active_conns, poll_list) {
+			if (!test_bit(CONN_ACTIVE, &conn->state))
 				close_conn(conn);
 		}
 		target_unlock(target);
@@ -860,21 +934,32 @@ static void istd(void *arg)
 
 int nthread_init(struct iscsi_target *target)
 {
-	struct network_thread_info *info = &target->nthread_info;
+	struct network_thread_info *info;
+	int i;
 
-	info->flags = 0;
-	info->task = NULL;
+	target->nthreads = max_t(int, 1, min_t(int, nthreads, ISCSI_NTHREADS_MAX));
+	target->nthread_next = 0;
 
 #ifdef LINUX
-	info->old_state_change = NULL;
-	info->old_data_ready = NULL;
-	info->old_write_space = NULL;
+	target->old_state_change = NULL;
+	target->old_data_ready = NULL;
+	target->old_write_space = NULL;
 #endif
 
-	INIT_LIST_HEAD(&info->active_conns);
+	for (i = 0; i < target->nthreads; i++) {
+		info = &target->nthread_info[i];
+		info->flags = 0;
+		info->task = NULL;
+		info->target = target;
+		info->id = i;
 
-	spin_lock_initt(&info->nthread_lock, "nthread");
-	init_waitqueue_head(&info->nthread_wait);
+		INIT_LIST_HEAD(&info->active_conns);
+		INIT_LIST_HEAD(&info->reset_list);
+
+		spin_lock_initt(&info->nthread_lock, "nthread");
+		init_waitqueue_head(&info->nthread_wait);
+		sx_init(&info->conn_sem, "iet nthread");
+	}
 
 	return 0;
 }
@@ -882,21 +967,26 @@ int nthread_init(struct iscsi_target *target)
 int nthread_start(struct iscsi_target *target)
 {
 	int err = 0;
-	struct network_thread_info *info = &target->nthread_info;
+	struct network_thread_info *info;
+	int i;
+
+	for (i = 0; i < target->nthreads; i++) {
+		info = &target->nthread_info[i];
+		if (info->task) {
+			eprintk("Target (%u) already runs\n", target->tid);
+			return -EALREADY;
+		}
 
-	if (info->task) {
-		eprintk("Target (%u) already runs\n", target->tid);
-		return -EALREADY;
+		err = kernel_thread_create(istd, info, info->task, "istd%d.%d", target->tid, i);
+		if (err)
+			return err;
 	}
-
-	err = kernel_thread_create(istd, target, info->task, "istd%d", target->tid);
 	return err;
 }
 
-int nthread_stop(struct iscsi_target *target)
+static int __nthread_stop(struct network_thread_info *info)
 {
 	int err;
-	struct network_thread_info *info = &target->nthread_info;
 
 	if (!info->task)
 		return -ESRCH;
@@ -919,3 +1009,15 @@ int nthread_stop(struct iscsi_target *target)
 
 	return err;
 }
+
+int nthread_stop(struct iscsi_target *target)
+{
+	int i, err, retval = 0;
+
+	for (i = 0; i < target->nthreads; i++) {
+		err = __nthread_stop(&target->nthread_info[i]);
+		if (err < 0 && err != -ESRCH && err != -EINTR)
+			retval = err;
+	}
+	return retval;
+}
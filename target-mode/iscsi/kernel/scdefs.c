@@ -1263,7 +1263,6 @@ int do_send_ctio(struct iscsi_conn *conn, int state)
 
 #ifdef LINUX
 		sendpage = sock->ops->sendpage ? sock->ops->sendpage : sock_no_sendpage;
-#endif
 		for (i = write_cmnd->start_pg_idx; i <= write_cmnd->end_pg_idx; i++)
 		{
 			struct pgdata *pgtmp = pglist[i];
@@ -1275,7 +1274,6 @@ again:
 			else
 				min = pgtmp->pg_len - pg_offset;
 
-#ifdef LINUX
 			flags = MSG_DONTWAIT | MSG_NOSIGNAL;
 			if (i != write_cmnd->end_pg_idx)
 			{
@@ -1283,14 +1281,6 @@ again:
 			}
 
 			res = sendpage(sock, pgtmp->page, pg_offset + pgtmp->pg_offset, min, flags); 
-#else
-			iov[0].iov_base = (u8 *)pgdata_page_address(pgtmp) + pgtmp->pg_offset + pg_offset;
-			iov[0].iov_len  = min;
-			uio_fill(&uio, iov, 1, min, UIO_WRITE);
-			flags = MSG_DONTWAIT | MSG_NOSIGNAL;
-			res = sosend(conn->sock, NULL, &uio, NULL, NULL, flags, curthread);
-			map_result(&res, &uio, min, 0);
-#endif
 			if (unlikely(res <= 0)) {
 				switch (res)
 				{
@@ -1319,6 +1309,62 @@ again:
 			write_cmnd->start_pg_offset = 0;
 			write_cmnd->start_pg_idx++;
 		}
+#else
+		/* Gather the remaining pages of the PDU into a single sosend */
+		while (write_cmnd->start_pg_idx != write_cmnd->end_pg_idx || write_cmnd->start_pg_offset != write_cmnd->end_pg_offset)
+		{
+			int j, len = 0, sent;
+
+			pg_offset = write_cmnd->start_pg_offset;
+			for (i = write_cmnd->start_pg_idx, j = 0; i <= write_cmnd->end_pg_idx && j < ISCSI_CONN_IOV_MAX; i++, j++)
+			{
+				struct pgdata *pgtmp = pglist[i];
+
+				if (i == write_cmnd->end_pg_idx)
+					min = write_cmnd->end_pg_offset - pg_offset;
+				else
+					min = pgtmp->pg_len - pg_offset;
+
+				conn->data_iov[j].iov_base = (u8 *)pgdata_page_address(pgtmp) + pgtmp->pg_offset + pg_offset;
+				conn->data_iov[j].iov_len = min;
+				len += min;
+				pg_offset = 0;
+			}
+
+			uio_fill(&uio, conn->data_iov, j, len, UIO_WRITE);
+			flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+			res = sosend(conn->sock, NULL, &uio, NULL, NULL, flags, curthread);
+			map_result(&res, &uio, len, 0);
+			if (unlikely(res <= 0)) {
+				switch (res)
+				{
+					case -EAGAIN:
+					case -EINTR:
+						break;
+					default:
+						goto err;
+				}
+				goto out_iov;
+			}
+
+			size -= res;
+			sent = res;
+			while (sent) {
+				if (write_cmnd->start_pg_idx == write_cmnd->end_pg_idx)
+					min = write_cmnd->end_pg_offset - write_cmnd->start_pg_offset;
+				else
+					min = pglist[write_cmnd->start_pg_idx]->pg_len - write_cmnd->start_pg_offset;
+
+				if (sent < min || write_cmnd->start_pg_idx == write_cmnd->end_pg_idx) {
+					write_cmnd->start_pg_offset += sent;
+					break;
+				}
+				sent -= min;
+				write_cmnd->start_pg_offset = 0;
+				write_cmnd->start_pg_idx++;
+			}
+		}
+#endif
 	}
 	else if (ctio->dxfer_len > 0)
 	{
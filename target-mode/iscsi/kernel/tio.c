@@ -19,11 +19,7 @@ static int tio_add_pages(struct tio *tio, int count)
 
 	count *= sizeof(pagestruct_t *);
 
-	do {
-		tio->pvec = zalloc(count, M_IETTIO, M_NOWAIT);
-		if (!tio->pvec)
-			yield();
-	} while (!tio->pvec);
+	tio->pvec = zalloc(count, M_IETTIO, M_WAITOK);
 
 	for (i = 0; i < tio->pg_cnt; i++) {
 		do {